@@ -0,0 +1,659 @@
+/* Faults Module - Benchmarks
+ *
+ * Build with 'make bench', see BFLAGS in the Makefile for the sizes.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "faults.h"
+#include "faults_exporter.h"
+#include "faults_loader.h"
+#include "faults_merge.h"
+#include "faults_trace.h"
+#include "faults_whatif.h"
+#include <assert.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MODULES 8
+#define BENCH_CODES   16
+#define BENCH_REPEAT  100
+
+static fault_millisecs mockTime = 0;
+
+fault_millisecs fault_now(void)
+{
+    return mockTime;
+}/* fault_now */
+
+static
+double bench_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}/* bench_secs */
+
+static
+void bench_report(const char *name, double secs, size_t ops)
+{
+    printf("%-32s %10.1f ns/op %12.0f op/s\n",
+           name, secs * 1e9 / (double)ops, (double)ops / secs);
+}/* bench_report */
+
+/* Fill the logs with events of BENCH_MODULES modules, 1 ms apart */
+static
+void bench_setup(void)
+{
+    fault_init();
+
+    for (int m = 0; m < BENCH_MODULES; m++){
+        fault_module mod = fault_conf_module(BENCH_CODES, 1);
+        assert(mod != FAULT_MODULE_KO);
+
+        for (fault_code c = 0; c < BENCH_CODES; c++){
+            fault_policy_count_reset(fault_getid(mod, c), 2, 4, 3);
+        }
+    }/* for modules */
+}/* bench_setup */
+
+static
+void bench_logs_fill(void)
+{
+    fault_logs_reset();
+
+    for (size_t i = 0; i < FAULT_LOG_MAX; i++){
+        fault_module mod = (fault_module)(1 + i % BENCH_MODULES);
+        fault_code code = (fault_code)((i / BENCH_MODULES) % BENCH_CODES);
+        mockTime = i;
+        fault_update(fault_getid(mod, code), (long)i, (i % 3) != 0);
+    }
+}/* bench_logs_fill */
+
+static
+void bench_logs_query(void)
+{
+    static FaultLogSpan spans[FAULT_LOG_MAX];
+
+    bench_setup();
+    bench_logs_fill();
+
+    /* ERROR events of module 3 in the last 5 s */
+    FaultLogFilter filter = {0};
+    filter.fields = FAULT_LF_MODULE | FAULT_LF_STATUS | FAULT_LF_TIME;
+    filter.module = 3;
+    filter.status = FAULT_ST_ERROR;
+    filter.from = mockTime - 5000;
+    filter.to = mockTime;
+
+    size_t expected = 0;
+    size_t found = 0;
+
+    double t0 = bench_secs();
+    for (int r = 0; r < BENCH_REPEAT; r++){
+        expected = 0;
+        size_t len = fault_logs_length();
+        for (size_t i = 0; i < len; i++){
+            FaultLog log = fault_log(i);
+            if (log.module == filter.module &&
+                log.status == filter.status &&
+                log.timestamp >= filter.from &&
+                log.timestamp <= filter.to){
+                expected++;
+            }
+        }
+    }
+    bench_report("logs scan fault_log()", bench_secs() - t0, BENCH_REPEAT);
+
+    t0 = bench_secs();
+    for (int r = 0; r < BENCH_REPEAT; r++){
+        size_t n = fault_logs_query(&filter, spans, FAULT_LOG_MAX);
+        found = 0;
+        for (size_t i = 0; i < n; i++){
+            found += spans[i].len;
+        }
+    }
+    bench_report("logs fault_logs_query()", bench_secs() - t0, BENCH_REPEAT);
+
+    assert(found == expected);
+    (void)found;
+    (void)expected;
+}/* bench_logs_query */
+
+static
+void bench_logs_cold(void)
+{
+    bench_setup();
+    fault_conf_logs_cold(true);
+
+    const size_t n = 4 * (size_t)FAULT_LOG_MAX;
+
+    double t0 = bench_secs();
+    for (size_t i = 0; i < n; i++){
+        fault_module mod = (fault_module)(1 + i % BENCH_MODULES);
+        fault_code code = (fault_code)((i / BENCH_MODULES) % BENCH_CODES);
+        mockTime = i;
+        fault_update(fault_getid(mod, code), (long)(i % 1000), (i % 3) != 0);
+    }
+    bench_report("update with cold tier", bench_secs() - t0, n);
+
+    size_t cold = fault_logs_length() - FAULT_LOG_MAX;
+    size_t bytes = (size_t)FAULT_LOG_COLD_BLOCKS * FAULT_LOG_COLD_BLOCK_SIZE;
+    printf("cold tier: %zu entries, %.1f bytes/entry (FaultLog %zu bytes)\n",
+           cold, (double)bytes / (double)cold, sizeof(FaultLog));
+
+    t0 = bench_secs();
+    long sum = 0;
+    for (size_t i = 0; i < cold; i += 97){
+        sum += fault_log(FAULT_LOG_MAX + i).refValue;
+    }
+    bench_report("fault_log() cold", bench_secs() - t0, cold / 97);
+    (void)sum;
+
+    fault_conf_logs_cold(false);
+}/* bench_logs_cold */
+
+static
+void bench_trace_replay(void)
+{
+    enum {N = 1 << 22};
+    static unsigned char buf[N * 8];
+    FaultTrace trace;
+
+    bench_setup();
+    fault_trace_start(&trace, buf, sizeof(buf));
+
+    unsigned long seed = 1;
+    double t0 = bench_secs();
+    for (size_t i = 0; i < N; i++){
+        seed = seed * 1103515245UL + 12345UL;
+        fault_module mod = (fault_module)(1 + (seed >> 8) % BENCH_MODULES);
+        fault_code code = (fault_code)((seed >> 16) % BENCH_CODES);
+        mockTime = i / 16;
+        fault_update(fault_getid(mod, code), (long)((seed >> 24) % 1000),
+                     ((seed >> 12) % 8) == 0);
+    }
+    bench_report("update with capture", bench_secs() - t0, N);
+
+    fault_trace_stop();
+    printf("trace: %lu events, %.2f bytes/event\n",
+           trace.events, (double)trace.used / (double)trace.events);
+
+    bench_setup();
+    t0 = bench_secs();
+    long n = fault_trace_replay(trace.data, trace.used);
+    bench_report("fault_trace_replay()", bench_secs() - t0, (size_t)n);
+}/* bench_trace_replay */
+
+static
+void bench_whatif(void)
+{
+    enum {N = 1 << 20, GRID = 8};
+    static FaultWhatIfEvent events[N];
+    static FaultWhatIfResult results[GRID * GRID * GRID];
+    unsigned long warn[GRID];
+    unsigned long err[GRID];
+    unsigned long reset[GRID];
+
+    for (int i = 0; i < GRID; i++){
+        warn[i] = 1 + (unsigned long)i * 2;
+        err[i] = 4 + (unsigned long)i * 4;
+        reset[i] = 2 + (unsigned long)i * 8;
+    }
+
+    unsigned long seed = 1;
+    for (size_t i = 0; i < N; i++){
+        seed = seed * 1103515245UL + 12345UL;
+        events[i].timestamp = i * 10; /* 100 Hz */
+        events[i].ref = (long)((seed >> 16) % 1000);
+        events[i].condition = ((seed >> 12) % 16) == 0;
+    }
+
+    FaultWhatIfGrid grid = {FAULT_POL_COUNT_RESET,
+                            warn, GRID, err, GRID, reset, GRID};
+    size_t c = fault_whatif_candidates(&grid);
+
+    double t0 = bench_secs();
+    fault_whatif_run(&grid, events, N, results, c, 0);
+    double secs = bench_secs() - t0;
+    bench_report("what-if candidate x event", secs, c * N);
+    printf("what-if: %zu candidates, one day at 100 Hz in %.1f s\n",
+           c, secs * (86400.0 * 100.0) / (double)N);
+}/* bench_whatif */
+
+/* 1 MHz updates, the statuses are read every 10 ms */
+static
+void bench_lazy(void)
+{
+    enum {N = 1 << 24, READ = 10000};
+    const char *names[2] = {"update eager", "update lazy"};
+
+    for (int lazy = 0; lazy < 2; lazy++){
+        bench_setup();
+        fault_conf_lazy(lazy != 0);
+
+        unsigned long seed = 1;
+        unsigned long sum = 0;
+        double t0 = bench_secs();
+        for (size_t i = 0; i < N; i++){
+            seed = seed * 1103515245UL + 12345UL;
+            fault_module mod = (fault_module)(1 + (seed >> 8) % BENCH_MODULES);
+            fault_code code = (fault_code)((seed >> 16) % BENCH_CODES);
+            mockTime = i / 1000;
+            fault_update(fault_getid(mod, code), (long)i,
+                         ((seed >> 12) % 8) == 0);
+
+            if (i % READ == 0){
+                for (fault_module m = 1; m <= BENCH_MODULES; m++){
+                    sum += fault_status_module(m);
+                }
+            }
+        }
+        fault_flush();
+        bench_report(names[lazy], bench_secs() - t0, N);
+        (void)sum;
+    }
+}/* bench_lazy */
+
+/* a borderline sensor at 1 kHz, faulty one time in three */
+static
+void bench_flap(void)
+{
+    enum {N = 1 << 20};
+    const char *names[3] = {"flap none", "flap hysteresis", "flap damping"};
+    FaultDamping damping = {1000, 2000, 500, 10000};
+
+    for (int mode = 0; mode < 3; mode++){
+        bench_setup();
+        fault_id id = fault_getid(1, 0);
+        fault_policy_count_reset(id, 1, 1, 2);
+        if (mode == 1){
+            fault_conf_hysteresis(id, 100);
+        } else if (mode == 2){
+            fault_conf_damping(id, &damping);
+        }
+
+        unsigned long changes = 0;
+        fault_status_type prev = FAULT_ST_NORMAL;
+        double t0 = bench_secs();
+        for (size_t i = 0; i < N; i++){
+            mockTime = i;
+            fault_update(id, (long)i, (i % 3) == 0);
+            fault_status_type s = fault_status(id);
+            changes += (s != prev);
+            prev = s;
+        }
+        bench_report(names[mode], bench_secs() - t0, N);
+        printf("%s: %lu status changes\n", names[mode], changes);
+    }
+}/* bench_flap */
+
+/* faults on the ids of bench_setup(): nothing, a history of 64,
+ * the statistics of the reference values
+ */
+static
+void bench_history(void)
+{
+    enum {N = 1 << 20};
+    const char *names[3] = {"fault_update() no history",
+                            "fault_update() history",
+                            "fault_update() refstats"};
+    FaultSample out[64];
+
+    for (int mode = 0; mode < 3; mode++){
+        bench_setup();
+        fault_id ids = BENCH_MODULES * BENCH_CODES;
+        for (fault_id id = 1; id <= ids; id++){
+            if (mode == 1){
+                fault_conf_history(id, 64);
+            } else if (mode == 2){
+                fault_conf_refstats(id, 8);
+            }
+        }
+
+        double t0 = bench_secs();
+        for (size_t i = 0; i < N; i++){
+            mockTime = i;
+            fault_update((fault_id)(1 + i % ids), (long)i, true);
+        }
+        bench_report(names[mode], bench_secs() - t0, N);
+    }
+
+    bench_setup();
+    for (fault_id id = 1; id <= 16; id++){
+        fault_conf_history(id, 64);
+        for (int i = 0; i < 64; i++){
+            fault_update(id, i, true);
+        }
+    }
+
+    double t0 = bench_secs();
+    size_t n = 0;
+    for (int r = 0; r < BENCH_REPEAT; r++){
+        n += fault_history(1 + (fault_id)r % 16, out, 64);
+    }
+    bench_report("fault_history() 64", bench_secs() - t0, BENCH_REPEAT);
+    assert(n == 64 * BENCH_REPEAT);
+    (void)n;
+}/* bench_history */
+
+/* Every fault starts a series (a clear resets it),
+ * bursts of 80 ids in the incidents window of 5 ms
+ */
+static
+void bench_incidents(void)
+{
+    enum {N = 1 << 20};
+    const char *names[2] = {"fault_update() no incidents",
+                            "fault_update() incidents"};
+
+    for (int mode = 0; mode < 2; mode++){
+        bench_setup();
+        fault_id ids = BENCH_MODULES * BENCH_CODES;
+        for (fault_id id = 1; id <= ids; id++){
+            fault_policy_count_reset(id, 2, 4, 1);
+        }
+        if (mode == 1){
+            fault_conf_incidents(5, 2);
+        }
+
+        double t0 = bench_secs();
+        for (size_t i = 0; i < N; i++){
+            mockTime = i / 32;
+            fault_update((fault_id)(1 + (i / 2) % ids), (long)i, i % 2 == 0);
+        }
+        bench_report(names[mode], bench_secs() - t0, N);
+    }
+
+    printf("incidents: %zu kept\n", fault_incidents());
+}/* bench_incidents */
+
+/* Sweep of 64k ids, half of them with heartbeats,
+ * the time of a check divided by the ids
+ */
+static
+void bench_stale(void)
+{
+    enum {MODULES = 16, CODES = 4095, REPEAT = 256};
+    const fault_id ids = MODULES * CODES;
+
+    fault_init();
+    mockTime = 0;
+    for (int m = 0; m < MODULES; m++){
+        fault_module mod = fault_conf_module(CODES, 1);
+        for (fault_code c = 0; c < CODES; c += 2){
+            fault_policy_heartbeat(fault_getid(mod, c), 100, 200);
+        }
+    }
+
+    /* all alive: no status changes */
+    size_t changed = 0;
+    double t0 = bench_secs();
+    for (int r = 0; r < REPEAT; r++){
+        changed += fault_check_stale(50);
+    }
+    bench_report("fault_check_stale() per id", bench_secs() - t0,
+                 (size_t)REPEAT * ids);
+    assert(changed == 0);
+
+    t0 = bench_secs();
+    changed = fault_check_stale(150);
+    bench_report("fault_check_stale() all warning", bench_secs() - t0, ids);
+    printf("stale: %zu ids changed\n", changed);
+}/* bench_stale */
+
+/* faults only, on 64k ids with a few noisy ones */
+static
+void bench_top_k(void)
+{
+    enum {N = 1 << 24, MODULES = 16, CODES = 4095};
+    FaultTopK top[FAULT_TOPK_MAX + 1];
+
+    fault_init();
+    for (int m = 0; m < MODULES; m++){
+        fault_module mod = fault_conf_module(CODES, 1);
+        assert(mod != FAULT_MODULE_KO);
+        (void)mod;
+    }
+
+    unsigned long seed = 1;
+    double t0 = bench_secs();
+    for (size_t i = 0; i < N; i++){
+        seed = seed * 1103515245UL + 12345UL;
+        /* half of the faults from 8 ids */
+        fault_id id = (seed >> 8) % 2 ? (fault_id)(1 + (seed >> 16) % 8)
+                                      : (fault_id)(1 + (seed >> 16) % (MODULES * CODES));
+        fault_update(id, (long)i, true);
+    }
+    bench_report("update faults with top-k", bench_secs() - t0, N);
+
+    size_t n = fault_top_k(top, 8);
+    for (size_t i = 0; i < n; i++){
+        assert(top[i].id >= 1 && top[i].id <= 8);
+    }
+    printf("top-k: %zu ids, first %u with %lu faults (error %lu)\n",
+           n, n > 0 ? top[0].id : 0, n > 0 ? top[0].count : 0,
+           n > 0 ? top[0].error : 0);
+}/* bench_top_k */
+
+/* 50k ids, with the API, a policy for each id or for each module */
+static
+void bench_loader(void)
+{
+    enum {MODULES = 15, CODES = 3334, REPEAT = 20};
+    static char text[MODULES * CODES * 32];
+    static unsigned char bin[MODULES * CODES * 48];
+    FaultLoaderError err;
+
+    /* fault_init() excluded */
+    double secs = 0;
+    for (int r = 0; r < REPEAT; r++){
+        fault_init();
+        double t0 = bench_secs();
+        for (int m = 0; m < MODULES; m++){
+            fault_module mod = fault_conf_module(CODES, 1);
+            for (fault_code c = 0; c < CODES; c++){
+                fault_policy_count_reset(fault_getid(mod, c), 2, 4, 3);
+            }
+        }
+        secs += bench_secs() - t0;
+    }
+    bench_report("conf API 50k ids", secs, REPEAT);
+
+    for (int each = 1; each >= 0; each--){
+        size_t len = 0;
+        for (int m = 0; m < MODULES; m++){
+            len += (size_t)sprintf(text + len, "module %d 1\n", CODES);
+            if (!each){
+                len += (size_t)sprintf(text + len, "policy * count_reset 2 4 3\n");
+                continue;
+            }
+            for (int c = 0; c < CODES; c++){
+                len += (size_t)sprintf(text + len,
+                                       "policy %d count_reset 2 4 3\n", c);
+            }
+        }
+
+        secs = 0;
+        for (int r = 0; r < REPEAT; r++){
+            fault_init();
+            double t0 = bench_secs();
+            bool ok = fault_load_text(text, len, &err);
+            secs += bench_secs() - t0;
+            assert(ok);
+            (void)ok;
+        }
+        bench_report(each ? "fault_load_text() 50k policies"
+                          : "fault_load_text() 15 policies",
+                     secs, REPEAT);
+
+        size_t blen = fault_load_compile(text, len, bin, sizeof(bin), &err);
+        assert(blen > 0 && blen <= sizeof(bin));
+
+        secs = 0;
+        for (int r = 0; r < REPEAT; r++){
+            fault_init();
+            double t0 = bench_secs();
+            bool ok = fault_load_binary(bin, blen, &err);
+            secs += bench_secs() - t0;
+            assert(ok);
+            (void)ok;
+        }
+        bench_report(each ? "fault_load_binary() 50k policies"
+                          : "fault_load_binary() 15 policies",
+                     secs, REPEAT);
+    }
+}/* bench_loader */
+
+/* Producer on 50k ids, collector of deltas of 1k ids with 8 changes */
+static
+void bench_merge(void)
+{
+    enum {MODULES = 15, CODES = 3334, REPEAT = 20,
+          DELTAS = 8192, STRIDE = 1024, SOURCES = 8, CHANGES = 8};
+    static unsigned char big[1 << 20];
+    static unsigned char deltas[DELTAS * STRIDE];
+    static size_t lens[DELTAS];
+    const char *path = "/tmp/faults_bench.sock";
+
+    fault_init();
+    for (int m = 0; m < MODULES; m++){
+        fault_module mod = fault_conf_module(CODES, 1);
+        for (fault_code c = 0; c < CODES; c++){
+            fault_policy_count_abs(fault_getid(mod, c), 2, 4);
+        }
+    }
+    fault_merge_delta(0, big, sizeof(big));
+
+    /* 1% of the ids change between the deltas */
+    double secs = 0;
+    size_t len = 0;
+    for (int r = 0; r < REPEAT; r++){
+        for (fault_id i = 0; i < MODULES * CODES / 100; i++){
+            fault_update((fault_id)(r + i * 100) % (MODULES * CODES), r, true);
+        }
+        double t0 = bench_secs();
+        len = fault_merge_delta(0, big, sizeof(big));
+        secs += bench_secs() - t0;
+    }
+    bench_report("fault_merge_delta() 50k, 1%", secs, REPEAT);
+    printf("merge: %zu bytes delta\n", len);
+
+    fault_init();
+    for (int m = 0; m < BENCH_MODULES; m++){
+        fault_module mod = fault_conf_module(128, 1);
+        for (fault_code c = 0; c < 128; c++){
+            fault_policy_count_reset(fault_getid(mod, c), 2, 4, 3);
+        }
+    }
+
+    fault_id ids = BENCH_MODULES * 128;
+    for (size_t d = 0; d < DELTAS; d++){
+        for (fault_id i = 0; i < CHANGES; i++){
+            fault_id id = (fault_id)(d * 7 + i * 131) % ids;
+            fault_update(id, (long)d, (d + i) % 3 != 0);
+        }
+        lens[d] = fault_merge_delta((uint32_t)(d % SOURCES),
+                                    deltas + d * STRIDE, STRIDE);
+        assert(lens[d] > 0);
+    }
+
+    /* first touch of the tables excluded */
+    for (size_t d = 0; d < DELTAS; d++){
+        fault_merge_apply(deltas + d * STRIDE, lens[d]);
+    }
+
+    fault_merge_reset();
+    double t0 = bench_secs();
+    for (size_t d = 0; d < DELTAS; d++){
+        fault_merge_apply(deltas + d * STRIDE, lens[d]);
+    }
+    bench_report("fault_merge_apply() 8 sources", bench_secs() - t0, DELTAS);
+
+    /* through the socket, drained every 8 datagrams */
+    fault_merge_reset();
+    if (!fault_merge_listen(path)){
+        return;
+    }
+    int fd = fault_merge_connect(path);
+    assert(fd >= 0);
+
+    size_t merged = 0;
+    t0 = bench_secs();
+    for (size_t d = 0; d < DELTAS; d++){
+        send(fd, deltas + d * STRIDE, lens[d], 0);
+        if (d % 8 == 7){
+            merged += fault_merge_poll(0);
+        }
+    }
+    merged += fault_merge_poll(0);
+    bench_report("send() + fault_merge_poll()", bench_secs() - t0, DELTAS);
+    printf("merge: %zu/%d deltas\n", merged, DELTAS);
+
+    close(fd);
+    fault_merge_close();
+}/* bench_merge */
+
+/* 50k ids */
+static
+void bench_exporter(void)
+{
+    enum {MODULES = 15, CODES = 3334, REPEAT = 20};
+
+    fault_init();
+    for (int m = 0; m < MODULES; m++){
+        fault_module mod = fault_conf_module(CODES, 1);
+        assert(mod != FAULT_MODULE_KO);
+        for (fault_code c = 0; c < CODES; c++){
+            fault_id id = fault_getid(mod, c);
+            fault_policy_count_abs(id, 2, 4);
+            fault_update(id, -(long)(c * 1000), (c % 3) == 0);
+        }
+    }
+
+    double t0 = bench_secs();
+    for (int r = 0; r < REPEAT; r++){
+        fault_exporter_publish();
+    }
+    bench_report("fault_exporter_publish() 50k", bench_secs() - t0, REPEAT);
+
+    size_t len = 0;
+    t0 = bench_secs();
+    fault_exporter_render(&len);
+    bench_report("fault_exporter_render() first", bench_secs() - t0, 1);
+
+    /* 1% of the ids change between the scrapes */
+    double secs = 0;
+    for (int r = 0; r < REPEAT; r++){
+        for (fault_id i = 0; i < MODULES * CODES / 100; i++){
+            fault_update((fault_id)(r + i * 100) % (MODULES * CODES), r, true);
+        }
+        fault_exporter_publish();
+
+        t0 = bench_secs();
+        fault_exporter_render(&len);
+        secs += bench_secs() - t0;
+    }
+    bench_report("fault_exporter_render() 50k", secs, REPEAT);
+    printf("exporter: %zu bytes\n", len);
+}/* bench_exporter */
+
+int main()
+{
+    printf("FAULT_LOG_MAX=%d FAULT_ID_MAX=%d\n", FAULT_LOG_MAX, FAULT_ID_MAX);
+    bench_logs_query();
+    bench_logs_cold();
+    bench_trace_replay();
+    bench_whatif();
+    bench_lazy();
+    bench_top_k();
+    bench_flap();
+    bench_history();
+    bench_incidents();
+    bench_stale();
+    bench_loader();
+    bench_merge();
+    bench_exporter();
+    return 0;
+}/* main */
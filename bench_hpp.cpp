@@ -0,0 +1,76 @@
+/* Faults Module - C++ interface against the C interface
+ *
+ * Build with 'make bench_hpp'.
+ */
+#include "faults.hpp"
+#include <cstdio>
+#include <ctime>
+
+enum class Bench {
+    A, B, C, D, E, F, G, H,
+    ALL
+};
+
+static constexpr size_t N = 1 << 24;
+
+static fault_millisecs mockTime = 0;
+
+fault_millisecs fault_now(void)
+{
+    return mockTime;
+}/* fault_now */
+
+static double bench_secs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}/* bench_secs */
+
+static void bench_report(const char *name, double secs, size_t ops)
+{
+    printf("%-32s %10.1f ns/op %12.0f op/s\n",
+           name, secs * 1e9 / (double)ops, (double)ops / secs);
+}/* bench_report */
+
+int main()
+{
+    fault_init();
+    auto mod = faults::Module<Bench>::configure(1);
+    faults::Id ids[] = {
+        mod->id<Bench::A>(), mod->id<Bench::B>(),
+        mod->id<Bench::C>(), mod->id<Bench::D>(),
+        mod->id<Bench::E>(), mod->id<Bench::F>(),
+        mod->id<Bench::G>(), mod->id<Bench::H>()
+    };
+    fault_id raw[8];
+
+    for (int i = 0; i < 8; i++){
+        ids[i].policy(faults::CountReset{2, 4, 3});
+        raw[i] = ids[i].raw();
+    }
+
+    /* alternate the two a few times, to smooth the frequency changes */
+    for (int round = 0; round < 2; round++){
+        double t0 = bench_secs();
+        unsigned long sum = 0;
+        for (size_t i = 0; i < N; i++){
+            fault_update(raw[i & 7], (long)i, (i % 5) == 0);
+            sum += fault_status(raw[(i + 3) & 7]);
+        }
+        bench_report("C fault_update()+status", bench_secs() - t0, N);
+
+        t0 = bench_secs();
+        for (size_t i = 0; i < N; i++){
+            ids[i & 7].update((long)i, (i % 5) == 0);
+            sum += (unsigned long)ids[(i + 3) & 7].status();
+        }
+        bench_report("C++ Id::update()+status", bench_secs() - t0, N);
+
+        if (sum == 1){
+            puts("");
+        }
+    }
+
+    return 0;
+}/* main */
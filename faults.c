@@ -7,55 +7,33 @@
  */
 
 #include "faults.h"
+#include "faults_private.h"
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
 
-/* Configuration for FAULT_POL_COUNT_ABS */
-struct FaultPolicyCountAbs {
-    fault_counter cntWarning;
-    fault_counter cntError;
-};
-
-/* Configuration for FAULT_POL_COUNT_RESET */
-struct FaultPolicyCountReset {
-    fault_counter cntWarning;
-    fault_counter cntError;
-    fault_counter cntReset;
-};
-
-/* Configuration for FAULT_POL_TIME_RESET */
-struct FaultPolicyTimeReset {
-    fault_millisecs msWarning;
-    fault_millisecs msError;
-    fault_millisecs msReset;
-};
-
-struct FaultPolicy {
-    fault_policy_type type;
-    union { /* 'conf' based on 'type' */
-        /* FAULT_POL_NONE has no configuration */
-        /* FAULT_POL_COUNT_ABS */
-        struct FaultPolicyCountAbs countAbs;
-        /* FAULT_POL_COUNT_RESET */
-        struct FaultPolicyCountReset countReset;
-        /* FAULT_POL_TIME_RESET */
-        struct FaultPolicyTimeReset timeReset;
-    } conf;
-};
-
-typedef struct FaultPolicy FaultPolicy;
-
 /* Single fault configuration record */
 struct FaultConfRecord {
     fault_id id; /* primary key, row index */
     fault_module module;
     fault_code code;
-    FaultPolicy policy;
+    fault_counter recover; /* hysteresis, 0 for none */
+    FaultDamping damping;  /* penalty 0 for none */
 };
 
 typedef struct FaultConfRecord FaultConfRecord;
 
+/* Hysteresis and damping state of a record */
+struct FaultFlapRecord {
+    fault_counter pending;  /* evaluations with a lower status */
+    unsigned long penalty;  /* damping penalty at 'stamp' */
+    fault_millisecs stamp;
+    unsigned char raw;      /* last status computed by the policy */
+    bool suppressed;
+};
+
+typedef struct FaultFlapRecord FaultFlapRecord;
+
 /* The fault_id is calculated by (module, code).
  * off = table[module].conf_offset
  * fault_id = off + code
@@ -72,21 +50,154 @@ struct FaultModuleRecord {
 
 typedef struct FaultModuleRecord FaultModuleRecord;
 
-/* Register for a single fault.
- * It is updated during the validations and the policies applications.
+/* Log queue over a slice of the logs pool.
+ * The slots are globals.logs[offset .. offset+cap-1].
+ */
+struct FaultLogRing {
+    size_t offset; /* first slot in the pool */
+    size_t cap;    /* number of slots, 0 for no dedicated ring */
+    size_t front;  /* oldest entry, relative to offset */
+    size_t len;    /* number of entries stored */
+};
+
+typedef struct FaultLogRing FaultLogRing;
+
+/* Position of the merge of the rings in fault_log(), kept between the
+ * calls: consecutive indexes (in both directions) cost a single step.
+ */
+struct FaultLogCursor {
+    bool valid;
+    size_t seq;   /* logsSeq of the position, no logs added since */
+    size_t index; /* entries consumed */
+    size_t taken[FAULT_MODULE_MAX + 1]; /* by ring, see fault_log_rings() */
+};
+
+typedef struct FaultLogCursor FaultLogCursor;
+
+/* Reference values history of an id, over a slice of the samples pool.
+ * The slots are globals.history[offset .. offset+cap-1].
+ */
+struct FaultHistoryRing {
+    unsigned int offset;
+    unsigned int cap;  /* 0 for no history */
+    unsigned int next; /* slot of the next sample, relative to offset */
+    unsigned int len;
+};
+
+typedef struct FaultHistoryRing FaultHistoryRing;
+
+#if FAULT_REFSTATS_MAX > 0
+#if FAULT_REFSTATS_MAX >= USHRT_MAX
+#error "FAULT_REFSTATS_MAX must be less than USHRT_MAX"
+#endif
+
+/* Reference values statistics of an id, see fault_conf_refstats() */
+struct FaultRefStatsRecord {
+    unsigned long count;
+    unsigned long faults;
+    long min;
+    long max;
+    double mean;
+    double m2; /* sum of the squared differences from the mean */
+    unsigned int shift;
+    unsigned long buckets[FAULT_REFSTATS_BUCKETS];
+};
+
+typedef struct FaultRefStatsRecord FaultRefStatsRecord;
+#endif
+
+/* fault_record_count() events */
+#define FAULT_REC_OVERFLOW 1 /* the total counter overflowed */
+#define FAULT_REC_EXPIRED  2 /* reset by the policy */
+
+/* Bits in a word of the dirty ids set */
+#define FAULT_DIRTY_BITS  (sizeof(unsigned long) * CHAR_BIT)
+#define FAULT_DIRTY_WORDS ((FAULT_ID_MAX + FAULT_DIRTY_BITS - 1) / FAULT_DIRTY_BITS)
+/* Records of the heartbeats, see fault_check_stale() */
+#define FAULT_BEAT_IDS    (FAULT_DIRTY_WORDS * FAULT_DIRTY_BITS)
+
+#if FAULT_INCIDENT_MAX > 0
+/* Words of the modules set of an incident */
+#define FAULT_MODULE_WORDS ((FAULT_MODULE_MAX + FAULT_DIRTY_BITS - 1) / FAULT_DIRTY_BITS)
+
+/* An incident, see fault_conf_incidents() */
+struct FaultIncidentRecord {
+    fault_millisecs start;
+    fault_millisecs end;
+    size_t ids;
+    size_t modulesLen;
+    unsigned long modules[FAULT_MODULE_WORDS];
+    unsigned long members[FAULT_DIRTY_WORDS]; /* one bit for each id */
+};
+
+typedef struct FaultIncidentRecord FaultIncidentRecord;
+#endif
+
+#if FAULT_INHIBIT_MAX < 1 || FAULT_INHIBIT_MAX > 32
+#error "FAULT_INHIBIT_MAX must be in 1..32"
+#endif
+
+#if FAULT_TOPK_MAX > 0
+#if FAULT_TOPK_MAX >= USHRT_MAX
+#error "FAULT_TOPK_MAX must be less than USHRT_MAX"
+#endif
+
+/* no slot or bucket */
+#define FAULT_TOPK_NIL FAULT_TOPK_MAX
+
+/* An id monitored by the heavy hitters sketch (space-saving).
+ * The slots with the same count are listed in their bucket.
  */
-struct FaultCounterRecord {
-    fault_id id;    /* primary key, row index */
-    fault_counter errors; /* fault counter */
-    fault_counter total;  /* all (faults + not faults) counter */
-    fault_counter clear;   /* number of consecutive not faults */
-    fault_millisecs msFirst; /* timestamp of the first fault */
-    fault_millisecs msLast;  /* timestamp of the last fault */
-    fault_status_type status;
-    long refValue; /* a user reference value to add information */
+struct FaultTopKSlot {
+    fault_id id;
+    unsigned long error; /* count of the id replaced */
+    unsigned int bucket;
+    unsigned int prev;
+    unsigned int next;
 };
 
-typedef struct FaultCounterRecord FaultCounterRecord;
+typedef struct FaultTopKSlot FaultTopKSlot;
+
+/* The buckets are listed by increasing count */
+struct FaultTopKBucket {
+    unsigned long count;
+    unsigned int first; /* slots list */
+    unsigned int prev;
+    unsigned int next;
+};
+
+typedef struct FaultTopKBucket FaultTopKBucket;
+#endif
+
+#if FAULT_INVALID_WIDTH > 0 && (FAULT_INVALID_DEPTH < 1 || FAULT_INVALID_DEPTH > 8)
+#error "FAULT_INVALID_DEPTH must be in 1..8"
+#endif
+
+/* Worst case size of a packed log entry, 5 varints */
+#define FAULT_COLD_ENTRY_MAX 48
+
+#if FAULT_LOG_COLD_BLOCKS > 0 && FAULT_LOG_COLD_BLOCK_SIZE < FAULT_COLD_ENTRY_MAX
+#error "FAULT_LOG_COLD_BLOCK_SIZE must be at least 48 (FAULT_COLD_ENTRY_MAX)"
+#endif
+
+#if FAULT_LOG_COLD_BLOCKS > 0
+/* Block of packed log entries (cold tier).
+ * Every entry is a sequence of varints:
+ *   zigzag(timestamp delta), zigzag(sequence delta),
+ *   (module << 2 | status), code, zigzag(refValue)
+ * The deltas are with respect to the previous entry in the block,
+ * the first entry is relative to zero.
+ */
+struct FaultColdBlock {
+    unsigned int count; /* number of entries */
+    unsigned int used;  /* bytes used in data */
+    fault_millisecs tsLast; /* timestamp of the last entry */
+    size_t seqLast;         /* sequence number of the last entry */
+    unsigned char data[FAULT_LOG_COLD_BLOCK_SIZE];
+};
+
+typedef struct FaultColdBlock FaultColdBlock;
+#endif
 
 /* GLOBAL STUCTURES */
 struct FaultGlobals {
@@ -98,19 +209,193 @@ struct FaultGlobals {
     FaultConfRecord config[FAULT_ID_MAX];
     fault_id configLen;
 
+    /* policies of the records, two tables for fault_reconf_begin().
+     * The update thread reads policies[policyCur].
+     */
+    FaultPolicy policies[2][FAULT_ID_MAX];
+    unsigned int policyCur;
+    /* live reconfiguration, see fault_reconf_begin() */
+    unsigned int reconfActive; /* table published by the writer */
+    unsigned int reconfSeen;   /* table in use by the update thread */
+    bool reconfBuilding;       /* writer only */
+    bool reconfReset;          /* reset the counters of the changed ids */
+    unsigned long reconfChanged[FAULT_DIRTY_WORDS];
+
     /* records table, len = configLen */
     FaultCounterRecord records[FAULT_ID_MAX];
-
-    /* log queue */
+    /* fault_status_type of the records */
+    unsigned char status[FAULT_ID_MAX];
+    /* hysteresis and damping of the records */
+    FaultFlapRecord flaps[FAULT_ID_MAX];
+
+    /* heartbeats, apart for the sweep of fault_check_stale(), in 32 bits
+     * and whole blocks of ids to be vectorized: time of the last update
+     * (compared by difference) and thresholds of the silence
+     * (0 for the other policies) of the records
+     */
+    uint32_t beatLast[FAULT_BEAT_IDS];
+    int32_t beatWarn[FAULT_BEAT_IDS];
+    int32_t beatErr[FAULT_BEAT_IDS];
+    /* fault_status_type of the silence, at the last check */
+    int32_t beatLevel[FAULT_BEAT_IDS];
+
+    /* logs pool, shared by all the log rings.
+     * In the pool, FaultLog.index holds the sequence number of the entry.
+     */
     FaultLog logs[FAULT_LOG_MAX];
-    size_t logsFront;
-    size_t logsLen;
+    size_t logsSeq; /* next sequence number */
+
+    /* dedicated log rings, by module */
+    FaultLogRing logsModules[FAULT_MODULE_MAX];
+    /* the pool left to the modules without a dedicated ring */
+    FaultLogRing logsShared;
+    /* merge position of fault_log() */
+    FaultLogCursor logsCursor;
+
+#if FAULT_LOG_COLD_BLOCKS > 0
+    /* compressed logs history, queue of blocks.
+     * The last block is the one being filled.
+     */
+    FaultColdBlock cold[FAULT_LOG_COLD_BLOCKS];
+    size_t coldFront;
+    size_t coldLen;   /* number of blocks */
+    size_t coldCount; /* number of entries in all the blocks */
+#endif
+    bool coldEnabled;
+
+    /* user procedure for the new log entries */
+    fault_log_hook logsHook;
+    void *logsHookCtx;
+
+    /* user procedure for the fault_update() calls */
+    fault_update_hook updateHook;
+    void *updateHookCtx;
+
+    /* time source, NULL for fault_now() */
+    fault_clock clock;
+
+    /* lazy evaluation, see fault_conf_lazy() */
+    bool lazy;
+    /* ids updated but not evaluated, one bit for each id */
+    unsigned long dirty[FAULT_DIRTY_WORDS];
+
+    /* inhibitions, one bit for each parent slot */
+    fault_id inhibitParents[FAULT_INHIBIT_MAX]; /* id of the slots */
+    unsigned int inhibitParentsLen;
+    /* slot + 1 of the parent ids, 0 for the others */
+    unsigned char inhibitSlot[FAULT_ID_MAX];
+    /* parents of every id */
+    unsigned long inhibitBy[FAULT_ID_MAX];
+    /* parents in error */
+    unsigned long inhibitActive;
+
+#if FAULT_HISTORY_MAX > 0
+    /* reference values history, see fault_conf_history() */
+    FaultSample history[FAULT_HISTORY_MAX];
+    size_t historyUsed; /* samples of the pool given to the ids */
+    FaultHistoryRing historyRings[FAULT_ID_MAX];
+#endif
+
+#if FAULT_REFSTATS_MAX > 0
+    /* reference values statistics, see fault_conf_refstats() */
+    FaultRefStatsRecord refstats[FAULT_REFSTATS_MAX];
+    unsigned int refstatsLen;
+    /* slot + 1 of the ids, 0 for the others */
+    unsigned short refstatsSlot[FAULT_ID_MAX];
+#endif
+
+#if FAULT_INCIDENT_MAX > 0
+    /* bursts of faults, see fault_conf_incidents(),
+     * the kept ones before the current, one more slot for it
+     */
+    FaultIncidentRecord incidents[FAULT_INCIDENT_MAX + 1];
+    unsigned int incidentsCur; /* slot of the current incident */
+    unsigned int incidentsLen; /* incidents kept before the current */
+    bool incidentsOpen;        /* the current incident has faults */
+    fault_millisecs incidentsWindow; /* 0 if disabled */
+    size_t incidentsMin;
+#endif
+
+#if FAULT_TOPK_MAX > 0
+    /* heavy hitters sketch, see fault_top_k() */
+    FaultTopKSlot topSlots[FAULT_TOPK_MAX];
+    unsigned int topSlotsLen;
+    FaultTopKBucket topBuckets[FAULT_TOPK_MAX];
+    unsigned int topFree; /* unused buckets, linked by next */
+    unsigned int topMin;  /* bucket with the lowest count */
+    unsigned int topMax;  /* bucket with the highest count */
+    /* slot + 1 of the monitored ids, 0 for the others */
+    unsigned short topSlot[FAULT_ID_MAX];
+#endif
+
+#if FAULT_INVALID_WIDTH > 0
+    /* count-min sketch of the wrong ids, see fault_invalid_ids() */
+    unsigned long invalid[FAULT_INVALID_DEPTH][FAULT_INVALID_WIDTH];
+    /* wrong ids with the highest estimates */
+    FaultInvalidId invalidTop[FAULT_INVALID_TOP];
+    size_t invalidTopLen;
+#endif
+
+#if FAULT_STATS
+    /* single writer, read with fault_stats() */
+    FaultStats stats;
+#endif
 };
 
 static struct FaultGlobals globals;
 
+/* Static tracepoints, see FAULT_USDT */
+#if FAULT_USDT
+#include <sys/sdt.h>
+#define FAULT_PROBE3(name, a, b, c) DTRACE_PROBE3(faults, name, a, b, c)
+#define FAULT_PROBE4(name, a, b, c, d) DTRACE_PROBE4(faults, name, a, b, c, d)
+#define FAULT_PROBE5(name, a, b, c, d, e) \
+    DTRACE_PROBE5(faults, name, a, b, c, d, e)
+#else
+#define FAULT_PROBE3(name, a, b, c) ((void)0)
+#define FAULT_PROBE4(name, a, b, c, d) ((void)0)
+#define FAULT_PROBE5(name, a, b, c, d, e) ((void)0)
+#endif
+
+/* Add to a statistics counter, readable from other threads */
+#if FAULT_STATS
+#define FAULT_STAT_ADD(field, n) \
+    __atomic_store_n(&globals.stats.field, \
+                     __atomic_load_n(&globals.stats.field, __ATOMIC_RELAXED) + \
+                     (unsigned long)(n), __ATOMIC_RELAXED)
+#else
+#define FAULT_STAT_ADD(field, n) ((void)0)
+#endif
+
+#if FAULT_INVALID_WIDTH > 0
+/* Multipliers of the sketch hash functions, odd */
+static const unsigned long long invalidSeeds[8] = {
+    0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL,
+    0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL,
+    0xFF51AFD7ED558CCDULL, 0xC4CEB9FE1A85EC53ULL,
+    0x94D049BB133111EBULL, 0xBF58476D1CE4E5B9ULL
+};
+#endif
+
+/* 2^(-i/16) in Q16, for the decay of the damping penalty */
+static const unsigned int dampingDecay[16] = {
+    65536, 62757, 60097, 57549, 55109, 52773, 50535, 48393,
+    46341, 44376, 42495, 40693, 38968, 37316, 35734, 34219
+};
+
 /* PROCEDURES */
 
+/* Current time from the configured source */
+static
+fault_millisecs fault_time(void)
+{
+    if (globals.clock != NULL){
+        return globals.clock();
+    }
+
+    return fault_now();
+}/* fault_time */
+
 /* fault_id range validation */
 static
 bool fault_id_valid(fault_id id)
@@ -118,121 +403,518 @@ bool fault_id_valid(fault_id id)
     return (id < globals.configLen);
 }
 
+/* i % cap for i < 2 * cap, without the division */
 static
-void fault_log_enqueue(const FaultLog log)
+size_t fault_ring_wrap(size_t i, size_t cap)
 {
-    size_t front = globals.logsFront;
-    size_t len = globals.logsLen;
-    size_t rear = (front + len) % FAULT_LOG_MAX;
+    assert(i < 2 * cap);
 
-    assert(len <= FAULT_LOG_MAX);
-    assert(front + len < 2 * FAULT_LOG_MAX);
-    assert(rear < FAULT_LOG_MAX);
+    return (i >= cap) ? i - cap : i;
+}/* fault_ring_wrap */
 
-    if (len == FAULT_LOG_MAX){
-        /* queue full */
-        front = (front + 1) % FAULT_LOG_MAX;
-    } else {
-        /* queue not full */
-        len = (len + 1); /* since len < size, no modulo needed*/
+static
+FaultLogRing *fault_log_ring(fault_module mod)
+{
+    if (mod < FAULT_MODULE_MAX && globals.logsModules[mod].cap > 0){
+        return &globals.logsModules[mod];
     }
 
-    assert(len <= FAULT_LOG_MAX);
-    assert(front + len < 2 * FAULT_LOG_MAX);
+    return &globals.logsShared;
+}/* fault_log_ring */
+
+/* Entry of the ring at position 'rev', 0 is the most recent */
+static
+const FaultLog *fault_log_ring_at(const FaultLogRing *ring, size_t rev)
+{
+    assert(rev < ring->len);
 
-    globals.logs[rear] = log;
-    globals.logs[rear].saved = true;
-    globals.logs[rear].index = rear;
+    size_t i = fault_ring_wrap(ring->front + ring->len - rev - 1, ring->cap);
 
-    globals.logsFront = front;
-    globals.logsLen = len;
-}/* fault_log_enqueue */
+    return &globals.logs[ring->offset + i];
+}/* fault_log_ring_at */
 
+/* Position in the ring, 0 is the oldest */
 static
-fault_status_type fault_policy_apply_count_abs(fault_id id)
+size_t fault_log_ring_slot(const FaultLogRing *ring, size_t pos)
 {
-    /* internal procedure, trust the input */
-    fault_counter warn = globals.config[id].policy.conf.countAbs.cntWarning;
-    fault_counter err = globals.config[id].policy.conf.countAbs.cntError;
-    fault_counter e = globals.records[id].errors;
-    fault_status_type s = FAULT_ST_NORMAL;
+    assert(pos < ring->len);
 
-    if (e >= warn){
-        s = FAULT_ST_WARNING;
-        if (err >= warn && e >= err){
-            s = FAULT_ST_ERROR;
+    return fault_ring_wrap(ring->front + pos, ring->cap);
+}/* fault_log_ring_slot */
+
+/* First position in the ring with timestamp >= ms, ring->len if none */
+static
+size_t fault_log_ring_lower(const FaultLogRing *ring, fault_millisecs ms)
+{
+    size_t lo = 0;
+    size_t hi = ring->len;
+
+    while (lo < hi){
+        size_t mid = lo + (hi - lo) / 2;
+        size_t i = ring->offset + fault_log_ring_slot(ring, mid);
+
+        if (globals.logs[i].timestamp < ms){
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
+    }/* while */
+
+    return lo;
+}/* fault_log_ring_lower */
+
+static
+bool fault_log_match(const FaultLogFilter *filter, const FaultLog *log)
+{
+    if ((filter->fields & FAULT_LF_MODULE) && log->module != filter->module){
+        return false;
     }
 
-    return s;
-}/* fault_policy_apply_count_abs */
+    if ((filter->fields & FAULT_LF_CODE) && log->code != filter->code){
+        return false;
+    }
+
+    if ((filter->fields & FAULT_LF_STATUS) && log->status != filter->status){
+        return false;
+    }
+
+    return true;
+}/* fault_log_match */
 
+/* Append to 'out' the spans of the ring matching the filter.
+ * return the new number of spans in 'out'
+ */
 static
-fault_status_type fault_policy_apply_count_reset(fault_id id)
+size_t fault_log_ring_query(const FaultLogRing *ring,
+                            const FaultLogFilter *filter,
+                            FaultLogSpan *out,
+                            size_t n,
+                            size_t max)
 {
-    /* internal procedure, trust the input */
-    fault_counter reset = globals.config[id].policy.conf.countReset.cntReset;
-    fault_counter clear = globals.records[id].clear;
+    size_t lo = 0;
+    size_t hi = ring->len;
+
+    if (filter->fields & FAULT_LF_TIME){
+        if (filter->to < filter->from){
+            return n;
+        }
 
-    if (clear >= reset){
-        fault_reset(id);
+        lo = fault_log_ring_lower(ring, filter->from);
+        hi = lo;
+        if (filter->to < ULONG_MAX){
+            hi = fault_log_ring_lower(ring, filter->to + 1);
+        } else {
+            hi = ring->len;
+        }
+    }
+
+    const FaultLog *first = NULL; /* current span */
+    size_t len = 0;
+
+    for (size_t pos = lo; pos < hi && n < max; pos++){
+        size_t slot = fault_log_ring_slot(ring, pos);
+        const FaultLog *log = &globals.logs[ring->offset + slot];
+
+        if (first != NULL && (slot == 0 || !fault_log_match(filter, log))){
+            /* the span ends on a mismatch or on the wrap around */
+            out[n].logs = first;
+            out[n].len = len;
+            n++;
+            first = NULL;
+        }
+
+        if (first == NULL){
+            if (n < max && fault_log_match(filter, log)){
+                first = log;
+                len = 1;
+            }
+        } else {
+            len++;
+        }
+    }/* for positions */
+
+    if (first != NULL && n < max){
+        out[n].logs = first;
+        out[n].len = len;
+        n++;
     }
 
-    return fault_policy_apply_count_abs(id);
-}/* fault_policy_apply_count_abs */
+    return n;
+}/* fault_log_ring_query */
 
+#if FAULT_LOG_COLD_BLOCKS > 0
 static
-fault_status_type fault_policy_apply_time_reset(fault_id id)
+unsigned long fault_zigzag(unsigned long delta)
 {
-    /* internal procedure, trust the input */
-    fault_millisecs warn = globals.config[id].policy.conf.timeReset.msWarning;
-    fault_millisecs err = globals.config[id].policy.conf.timeReset.msError;
-    fault_millisecs reset = globals.config[id].policy.conf.timeReset.msReset;
+    /* delta is a two's complement difference */
+    return (delta << 1) ^ (0UL - (delta >> (sizeof(delta) * CHAR_BIT - 1)));
+}/* fault_zigzag */
+
+static
+unsigned long fault_unzigzag(unsigned long z)
+{
+    return (z >> 1) ^ (0UL - (z & 1UL));
+}/* fault_unzigzag */
+
+static
+size_t fault_varint_put(unsigned char *buf, unsigned long v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80){
+        buf[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (unsigned char)v;
+
+    return n;
+}/* fault_varint_put */
+
+static
+size_t fault_varint_get(const unsigned char *buf, unsigned long *v)
+{
+    size_t n = 0;
+    unsigned int shift = 0;
+    unsigned long out = 0;
+
+    do {
+        out |= (unsigned long)(buf[n] & 0x7F) << shift;
+        shift += 7;
+    } while (buf[n++] & 0x80);
+
+    *v = out;
+    return n;
+}/* fault_varint_get */
+
+/* Pack the log into 'buf' relative to the last entry of the block.
+ * return the number of bytes written
+ */
+static
+size_t fault_log_cold_encode(const FaultColdBlock *block,
+                             const FaultLog *log,
+                             unsigned char buf[FAULT_COLD_ENTRY_MAX])
+{
+    size_t n = 0;
+    unsigned long modst = ((unsigned long)log->module << 2) |
+                          ((unsigned long)log->status & 3UL);
+
+    n += fault_varint_put(buf + n, fault_zigzag(log->timestamp -
+                                                block->tsLast));
+    n += fault_varint_put(buf + n, fault_zigzag((unsigned long)log->index -
+                                                block->seqLast));
+    n += fault_varint_put(buf + n, modst);
+    n += fault_varint_put(buf + n, log->code);
+    n += fault_varint_put(buf + n, fault_zigzag((unsigned long)log->refValue));
+
+    assert(n <= FAULT_COLD_ENTRY_MAX);
+    return n;
+}/* fault_log_cold_encode */
+
+/* Unpack the entry at position 'pos' of the block, 0 is the oldest */
+static
+FaultLog fault_log_cold_decode(const FaultColdBlock *block, unsigned int pos)
+{
+    FaultLog log = {0};
+    const unsigned char *buf = block->data;
+    fault_millisecs ts = 0;
+    unsigned long seq = 0;
+    unsigned long v = 0;
+
+    assert(pos < block->count);
+
+    for (unsigned int i = 0; i <= pos; i++){
+        buf += fault_varint_get(buf, &v);
+        ts = ts + fault_unzigzag(v);
+        buf += fault_varint_get(buf, &v);
+        seq = seq + fault_unzigzag(v);
+        buf += fault_varint_get(buf, &v);
+        log.module = (fault_module)(v >> 2);
+        log.status = (fault_status_type)(v & 3UL);
+        buf += fault_varint_get(buf, &v);
+        log.code = (fault_code)v;
+        buf += fault_varint_get(buf, &v);
+        log.refValue = (long)fault_unzigzag(v);
+    }/* for entries */
+
+    assert(buf <= block->data + block->used);
+
+    log.saved = true;
+    log.index = (size_t)seq;
+    log.timestamp = ts;
+
+    return log;
+}/* fault_log_cold_decode */
+
+/* Start a new block, dropping the oldest one when full */
+static
+FaultColdBlock *fault_log_cold_open(void)
+{
+    if (globals.coldLen == FAULT_LOG_COLD_BLOCKS){
+        globals.coldCount -= globals.cold[globals.coldFront].count;
+        globals.coldFront = (globals.coldFront + 1) % FAULT_LOG_COLD_BLOCKS;
+        globals.coldLen = globals.coldLen - 1;
+    }
+
+    size_t i = (globals.coldFront + globals.coldLen) % FAULT_LOG_COLD_BLOCKS;
+    globals.coldLen = globals.coldLen + 1;
+
+    FaultColdBlock *block = &globals.cold[i];
+    block->count = 0;
+    block->used = 0;
+    block->tsLast = 0;
+    block->seqLast = 0;
+
+    return block;
+}/* fault_log_cold_open */
+
+/* Move a log removed from a queue into the compressed history */
+static
+void fault_log_cold_push(const FaultLog *log)
+{
+    unsigned char buf[FAULT_COLD_ENTRY_MAX];
+    FaultColdBlock *block = NULL;
+    size_t n = 0;
+
+    if (globals.coldLen > 0){
+        size_t last = (globals.coldFront + globals.coldLen - 1) %
+                      FAULT_LOG_COLD_BLOCKS;
+        block = &globals.cold[last];
+        n = fault_log_cold_encode(block, log, buf);
+    }
+
+    if (block == NULL || block->used + n > FAULT_LOG_COLD_BLOCK_SIZE){
+        block = fault_log_cold_open();
+        n = fault_log_cold_encode(block, log, buf);
+    }
+
+    memcpy(block->data + block->used, buf, n);
+    block->used = block->used + (unsigned int)n;
+    block->count = block->count + 1;
+    block->tsLast = log->timestamp;
+    block->seqLast = log->index;
+    globals.coldCount = globals.coldCount + 1;
+}/* fault_log_cold_push */
+
+/* Entry of the history at position 'rev', 0 is the most recent */
+static
+FaultLog fault_log_cold_at(size_t rev)
+{
+    FaultLog out = {0};
 
-    fault_counter clear = globals.records[id].clear;
-    fault_millisecs last = globals.records[id].msLast;
+    for (size_t b = globals.coldLen; b > 0; b--){
+        size_t i = (globals.coldFront + b - 1) % FAULT_LOG_COLD_BLOCKS;
+        const FaultColdBlock *block = &globals.cold[i];
 
-    fault_millisecs now = fault_now();
+        if (rev < block->count){
+            return fault_log_cold_decode(block,
+                                         block->count - (unsigned int)rev - 1);
+        }
+
+        rev -= block->count;
+    }/* for blocks */
+
+    return out;
+}/* fault_log_cold_at */
+#endif /* FAULT_LOG_COLD_BLOCKS */
+
+static
+void fault_log_enqueue(FaultLog log)
+{
+    FaultLogRing *ring = fault_log_ring(log.module);
+    size_t cap = ring->cap;
+
+    log.saved = true;
+    log.index = globals.logsSeq;
+    globals.logsSeq = globals.logsSeq + 1;
+    FAULT_STAT_ADD(logs, 1);
 
-    if (clear > 0 && ((now - last) >= reset)){
-        fault_reset(id);
+    if (globals.logsHook != NULL){
+        globals.logsHook(&log, globals.logsHookCtx);
+    }
+
+    if (cap == 0){
+        /* the whole pool is reserved to other modules */
+        FAULT_STAT_ADD(logsDropped, 1);
+        return;
+    }
+
+    size_t front = ring->front;
+    size_t len = ring->len;
+    size_t rear = fault_ring_wrap(front + len, cap);
+
+    assert(len <= cap);
+    assert(front + len < 2 * cap);
+    assert(rear < cap);
+    assert(ring->offset + cap <= FAULT_LOG_MAX);
+
+    if (len == cap){
+        /* queue full */
+        FAULT_STAT_ADD(logsEvicted, 1);
+        FAULT_PROBE5(log__evict,
+                     globals.logs[ring->offset + front].module,
+                     globals.logs[ring->offset + front].code,
+                     globals.logs[ring->offset + front].status,
+                     globals.logs[ring->offset + front].refValue,
+                     globals.logs[ring->offset + front].index);
+#if FAULT_LOG_COLD_BLOCKS > 0
+        if (globals.coldEnabled){
+            fault_log_cold_push(&globals.logs[ring->offset + front]);
+        }
+#endif
+        front = fault_ring_wrap(front + 1, cap);
+    } else {
+        /* queue not full */
+        len = (len + 1); /* since len < size, no modulo needed*/
     }
 
-    /* calculate the status on the record (coudl be reset) */
-    last = globals.records[id].msLast;
-    fault_millisecs first = globals.records[id].msFirst;
-    fault_millisecs elaps = (last - first);
+    assert(len <= cap);
+    assert(front + len < 2 * cap);
+
+    globals.logs[ring->offset + rear] = log;
 
+    ring->front = front;
+    ring->len = len;
+}/* fault_log_enqueue */
+
+#if !FAULT_REALTIME
+/* Status of a value (counter or time) with respect to the thresholds */
+static
+fault_status_type fault_policy_threshold(unsigned long value,
+                                         unsigned long warn,
+                                         unsigned long err)
+{
     fault_status_type s = FAULT_ST_NORMAL;
 
-    if (elaps >= warn){
+    if (value >= warn){
         s = FAULT_ST_WARNING;
-        if (err >= warn && elaps >= err){
+        if (err >= warn && value >= err){
             s = FAULT_ST_ERROR;
         }
     }
 
     return s;
-}/* fault_policy_apply_count_reset */
+}/* fault_policy_threshold */
+#endif
+
+/* Time from a record timestamp to 'now' */
+static
+fault_millisecs fault_rec_elapsed(fault_rec_millisecs since, fault_millisecs now)
+{
+    return (fault_rec_millisecs)((fault_rec_millisecs)now - since);
+}/* fault_rec_elapsed */
+
+/* Reference value as stored in the record, saturated */
+static
+fault_rec_ref fault_rec_ref_make(long ref)
+{
+#if FAULT_COMPACT
+    if (ref > INT32_MAX){
+        return INT32_MAX;
+    }
+    if (ref < INT32_MIN){
+        return INT32_MIN;
+    }
+#endif
+    return (fault_rec_ref)ref;
+}/* fault_rec_ref_make */
 
+/* Reset the record when the policy requires it (after the update).
+ * return true if reset
+ */
+static
+bool fault_policy_expire(const FaultPolicy *policy,
+                         FaultCounterRecord *rec,
+                         fault_millisecs now)
+{
+    /* internal procedure, trust the input */
+#if FAULT_REALTIME
+    /* both the conditions, the reset is at the same place */
+    unsigned long reset = policy->conf.countReset.cntReset;
+    bool byCount = (rec->clear >= reset);
+    bool byTime = (rec->clear > 0) &
+                  (fault_rec_elapsed(rec->msLast, now) >= reset);
+    bool expired = ((policy->type == FAULT_POL_COUNT_RESET) & byCount) |
+                   ((policy->type == FAULT_POL_TIME_RESET) & byTime);
+
+    /* all ones to keep the record, zero to reset it */
+    fault_rec_counter keep = (fault_rec_counter)expired - 1;
+    rec->errors &= keep;
+    rec->total &= keep;
+    rec->clear &= keep;
+    rec->msFirst &= (fault_rec_millisecs)keep;
+    rec->msLast &= (fault_rec_millisecs)keep;
+    rec->refValue &= (fault_rec_ref)keep;
+#else
+    bool expired = false;
+
+    switch (policy->type){
+    case FAULT_POL_COUNT_RESET:
+        expired = (rec->clear >= policy->conf.countReset.cntReset);
+        break;
+    case FAULT_POL_TIME_RESET:
+        expired = (rec->clear > 0 &&
+                   fault_rec_elapsed(rec->msLast, now) >=
+                       policy->conf.timeReset.msReset);
+        break;
+    default:
+        /* no reset */
+        break;
+    }
+
+    if (expired){
+        fault_record_reset(rec);
+    }
+#endif
+
+    return expired;
+}/* fault_policy_expire */
+
+/* Status of the record, it does not change the record */
 static
-fault_status_type fault_policy_apply(fault_id id)
+fault_status_type fault_policy_status(const FaultPolicy *policy,
+                                      const FaultCounterRecord *rec)
 {
-    /* private method, the input is trusted */
+    /* internal procedure, trust the input */
+#if FAULT_REALTIME
+    /* the thresholds are at the same place in all the policies,
+     * and err >= warn >= 1 (see fault_policy_make())
+     */
+    unsigned long warn = policy->conf.countAbs.cntWarning;
+    unsigned long err = policy->conf.countAbs.cntError;
+    unsigned long value = (policy->type == FAULT_POL_TIME_RESET)
+                          ? fault_rec_elapsed(rec->msFirst, rec->msLast)
+                          : rec->errors;
+    /* the heartbeats get the status from the silence */
+    unsigned int on = (policy->type != FAULT_POL_NONE) &
+                      (policy->type != FAULT_POL_HEARTBEAT);
+
+    return (fault_status_type)(on * ((unsigned int)(value >= warn) +
+                                     (unsigned int)(value >= err)));
+#else
     fault_status_type s = FAULT_ST_ERROR;
 
-    switch (globals.config[id].policy.type){
+    switch (policy->type){
     case FAULT_POL_NONE:
         s = FAULT_ST_NORMAL;
         break;
     case FAULT_POL_COUNT_ABS:
-        s = fault_policy_apply_count_abs(id);
+        s = fault_policy_threshold(rec->errors,
+                                   policy->conf.countAbs.cntWarning,
+                                   policy->conf.countAbs.cntError);
         break;
     case FAULT_POL_COUNT_RESET:
-        s = fault_policy_apply_count_reset(id);
+        s = fault_policy_threshold(rec->errors,
+                                   policy->conf.countReset.cntWarning,
+                                   policy->conf.countReset.cntError);
         break;
     case FAULT_POL_TIME_RESET:
-        s = fault_policy_apply_time_reset(id);
+        s = fault_policy_threshold(fault_rec_elapsed(rec->msFirst, rec->msLast),
+                                   policy->conf.timeReset.msWarning,
+                                   policy->conf.timeReset.msError);
+        break;
+    case FAULT_POL_HEARTBEAT:
+        /* from the silence, see fault_check_stale() */
+        s = FAULT_ST_NORMAL;
         break;
     default:
         /* in case of undefined/unimplemented policy,
@@ -243,67 +925,469 @@ fault_status_type fault_policy_apply(fault_id id)
     }
 
     return s;
-}/* fault_policy_apply */
-
-/* for internal use only, it does not guarantee the global consistency */
-static
-void fault_modules_reset(void)
+#endif
+}/* fault_policy_status */
+
+bool fault_policy_make(FaultPolicy *policy,
+                       fault_policy_type type,
+                       unsigned long warn,
+                       unsigned long err,
+                       unsigned long reset)
 {
-    assert(FAULT_GENERIC_MODULE == 0);
-    assert(FAULT_MODULE_MAX > 1);
+    memset(policy, 0, sizeof(FaultPolicy));
+    policy->type = FAULT_POL_NONE;
 
-    for (fault_module i=0; i < FAULT_MODULE_MAX; i++){
-        globals.modules[i].module = i;
-        globals.modules[i].numCodes = 1;
-        globals.modules[i].confOffset = 0; /* empty module */
-        globals.modules[i].tolerance = FAULT_NO_FAILURE;
-    }/* for modules */
+    if (type == FAULT_POL_NONE){
+        return true;
+    }
 
-    /* setup the generic module, cannot fail */
-    globals.modules[FAULT_GENERIC_MODULE].module = FAULT_GENERIC_MODULE;
-    globals.modules[FAULT_GENERIC_MODULE].numCodes = FAULT_GENERIC_ALL;
-    /* this is valid just because FAULT_GENERIC_MODULE = 0 */
-    globals.modules[FAULT_GENERIC_MODULE].confOffset = 0;
-    globals.modules[FAULT_GENERIC_MODULE].tolerance = FAULT_NO_FAILURE;
+    if (type != FAULT_POL_COUNT_ABS &&
+        type != FAULT_POL_COUNT_RESET &&
+        type != FAULT_POL_TIME_RESET &&
+        type != FAULT_POL_HEARTBEAT){
+        return false;
+    }
 
-    globals.modulesLen = 1; /* one module configured */
-}/* fault_modules_reset */
+    if (warn < 1){
+        return false;
+    }
 
-/* for internal use only, it does not guarantee the global consistency */
-static
-void fault_config_reset(void)
-{
-    for (fault_id i = 0; i < FAULT_ID_MAX; i++){
-        globals.config[i].id = i;
-        globals.config[i].module = FAULT_GENERIC_MODULE;
-        globals.config[i].code = i;
-        /* cannot fail */
-        fault_policy_none(i);
-    }/* for config */
+    if (err < warn){
+        return false;
+    }
 
-    globals.configLen = FAULT_GENERIC_ALL;
-}/* fault_config_reset */
+    if (type != FAULT_POL_COUNT_ABS && type != FAULT_POL_HEARTBEAT &&
+        reset < 1){
+        return false;
+    }
 
-/* for internal use only, it does not guarantee the global consistency */
-static
-void fault_records_reset(void)
-{
-    for (fault_id i = 0; i < FAULT_ID_MAX; i++){
-        globals.records[i].id = i;
-        fault_reset(i);
-    }/* for config */
-}/* fault_records_reset */
+    if (type == FAULT_POL_HEARTBEAT && err > INT32_MAX){
+        /* the silence is checked in 32 bits */
+        return false;
+    }
 
-void fault_init(void)
-{
-    fault_modules_reset();
-    fault_config_reset();
-    fault_records_reset();
-    fault_logs_reset();
-}/* fault_init () */
+    /* input validated */
 
-fault_module fault_conf_module(fault_counter ncodes, fault_counter tolerance)
-{
+    policy->type = type;
+
+    switch (type){
+    case FAULT_POL_COUNT_ABS:
+        policy->conf.countAbs.cntWarning = warn;
+        policy->conf.countAbs.cntError = err;
+        break;
+    case FAULT_POL_COUNT_RESET:
+        policy->conf.countReset.cntWarning = warn;
+        policy->conf.countReset.cntError = err;
+        policy->conf.countReset.cntReset = reset;
+        break;
+    case FAULT_POL_TIME_RESET:
+        policy->conf.timeReset.msWarning = warn;
+        policy->conf.timeReset.msError = err;
+        policy->conf.timeReset.msReset = reset;
+        break;
+    default: /* FAULT_POL_HEARTBEAT */
+        policy->conf.heartbeat.msWarning = warn;
+        policy->conf.heartbeat.msError = err;
+        break;
+    }
+
+    return true;
+}/* fault_policy_make */
+
+void fault_record_reset(FaultCounterRecord *rec)
+{
+    rec->errors = 0;
+    rec->total = 0;
+    rec->clear = 0;
+    rec->msFirst = 0;
+    rec->msLast = 0;
+    rec->refValue = 0;
+}/* fault_record_reset */
+
+/* Count the event in the record, without computing the status.
+ * return the FAULT_REC_* events occurred, bitwise or
+ */
+static
+unsigned int fault_record_count(const FaultPolicy *policy,
+                                FaultCounterRecord *rec,
+                                fault_millisecs now,
+                                long ref,
+                                bool condition)
+{
+    fault_rec_counter totPrev = rec->total;
+    fault_rec_counter one = 1;
+    fault_rec_counter total = 0;
+    unsigned int events = 0;
+
+    /* rec->total += 1; */
+    if (__builtin_add_overflow(totPrev, one, &total)){
+        /* the other values are less or equal to total */
+        fault_record_reset(rec);
+        total = one;
+        events |= FAULT_REC_OVERFLOW;
+    }
+    rec->total = total;
+
+    if (condition){
+        if (rec->errors == 0){
+            rec->msFirst = (fault_rec_millisecs)now;
+        }
+        rec->errors += 1;
+        rec->msLast = (fault_rec_millisecs)now;
+        rec->refValue = fault_rec_ref_make(ref);
+        rec->clear = 0; /* interupt the series */
+    } else {
+        rec->clear += 1;
+    }
+
+    /* Must be done after updating the record */
+    if (fault_policy_expire(policy, rec, now)){
+        events |= FAULT_REC_EXPIRED;
+    }
+
+    return events;
+}/* fault_record_count */
+
+/* Statistics and probes of the fault_record_count() events */
+static
+void fault_record_events(fault_id fid, unsigned int events)
+{
+    (void)fid; /* only for the probes */
+
+    if (events & FAULT_REC_OVERFLOW){
+        FAULT_STAT_ADD(overflows, 1);
+    }
+    if (events & FAULT_REC_EXPIRED){
+        FAULT_STAT_ADD(policyResets, 1);
+    }
+    if (events != 0){
+        FAULT_PROBE4(record__reset, fid, globals.config[fid].module,
+                     globals.config[fid].code, events);
+    }
+}/* fault_record_events */
+
+/* Number of events that fault_record_count_n() can count at once:
+ * without the overflow of the total and without a reset of the policy.
+ */
+static
+fault_counter fault_record_quiet(const FaultPolicy *policy,
+                                 const FaultCounterRecord *rec,
+                                 fault_millisecs now,
+                                 bool condition)
+{
+    fault_counter m = FAULT_REC_COUNTER_MAX - rec->total;
+
+    if (condition){
+        /* a fault interrupts the series, the policies never reset */
+        return m;
+    }
+
+    switch (policy->type){
+    case FAULT_POL_COUNT_RESET:
+        if ((fault_counter)rec->clear + 1 >= policy->conf.countReset.cntReset){
+            m = 0;
+        } else if (policy->conf.countReset.cntReset - 1 - rec->clear < m){
+            m = policy->conf.countReset.cntReset - 1 - rec->clear;
+        }
+        break;
+    case FAULT_POL_TIME_RESET:
+        /* the time does not change, the reset happens at every event */
+        if (fault_rec_elapsed(rec->msLast, now) >=
+            policy->conf.timeReset.msReset){
+            m = 0;
+        }
+        break;
+    default:
+        /* no reset */
+        break;
+    }
+
+    return m;
+}/* fault_record_quiet */
+
+/* Count 'n' equal events at once, see fault_record_quiet() */
+static
+void fault_record_count_n(FaultCounterRecord *rec,
+                          fault_millisecs now,
+                          long ref,
+                          bool condition,
+                          fault_counter n)
+{
+    assert(n <= FAULT_REC_COUNTER_MAX - rec->total);
+
+    rec->total += (fault_rec_counter)n;
+
+    if (condition){
+        if (rec->errors == 0){
+            rec->msFirst = (fault_rec_millisecs)now;
+        }
+        rec->errors += (fault_rec_counter)n;
+        rec->msLast = (fault_rec_millisecs)now;
+        rec->refValue = fault_rec_ref_make(ref);
+        rec->clear = 0;
+    } else {
+        rec->clear += (fault_rec_counter)n;
+    }
+}/* fault_record_count_n */
+
+/* As 'n' calls to fault_record_count() on the record 'fid',
+ * in constant time.
+ */
+static
+void fault_record_count_bulk(fault_id fid,
+                             fault_millisecs now,
+                             long ref,
+                             bool condition,
+                             fault_counter n)
+{
+    const FaultPolicy *policy = &globals.policies[globals.policyCur][fid];
+    FaultCounterRecord *rec = &globals.records[fid];
+
+    /* At most: a run up to the overflow of the total, the overflow,
+     * a run up to the reset, the reset and the remaining run.
+     */
+    while (n > 0){
+        fault_counter m = fault_record_quiet(policy, rec, now, condition);
+
+        if (m > 0){
+            m = (m < n) ? m : n;
+            fault_record_count_n(rec, now, ref, condition, m);
+            n = n - m;
+            continue;
+        }
+
+        /* the next event overflows or resets */
+        unsigned int events = fault_record_count(policy, rec, now,
+                                                 ref, condition);
+        fault_record_events(fid, events);
+        n = n - 1;
+
+        if (events & FAULT_REC_EXPIRED){
+            /* Reset by the policy, from here the events repeat
+             * the same sequence of records.
+             */
+            if (policy->type == FAULT_POL_COUNT_RESET){
+                fault_counter period = policy->conf.countReset.cntReset;
+                FAULT_STAT_ADD(policyResets, n / period);
+                n = n % period;
+            } else if (policy->type == FAULT_POL_TIME_RESET &&
+                       fault_rec_elapsed(0, now) >=
+                           policy->conf.timeReset.msReset){
+                FAULT_STAT_ADD(policyResets, n);
+                n = 0; /* reset at every event */
+            }
+        } else if ((events & FAULT_REC_OVERFLOW) &&
+                   fault_record_quiet(policy, rec, now, condition) ==
+                       FAULT_REC_COUNTER_MAX - rec->total){
+            /* up to the next overflow, that gives the same record */
+            FAULT_STAT_ADD(overflows, n / FAULT_REC_COUNTER_MAX);
+            n = n % FAULT_REC_COUNTER_MAX;
+        }
+    }/* while */
+}/* fault_record_count_bulk */
+
+fault_status_type fault_record_update(const FaultPolicy *policy,
+                                      FaultCounterRecord *rec,
+                                      fault_millisecs now,
+                                      long ref,
+                                      bool condition)
+{
+    fault_record_count(policy, rec, now, ref, condition);
+
+    return fault_policy_status(policy, rec);
+}/* fault_record_update */
+
+/* for internal use only, it does not guarantee the global consistency */
+static
+void fault_modules_reset(void)
+{
+    assert(FAULT_GENERIC_MODULE == 0);
+    assert(FAULT_MODULE_MAX > 1);
+
+    for (fault_module i=0; i < FAULT_MODULE_MAX; i++){
+        globals.modules[i].module = i;
+        globals.modules[i].numCodes = 1;
+        globals.modules[i].confOffset = 0; /* empty module */
+        globals.modules[i].tolerance = FAULT_NO_FAILURE;
+    }/* for modules */
+
+    /* setup the generic module, cannot fail */
+    globals.modules[FAULT_GENERIC_MODULE].module = FAULT_GENERIC_MODULE;
+    globals.modules[FAULT_GENERIC_MODULE].numCodes = FAULT_GENERIC_ALL;
+    /* this is valid just because FAULT_GENERIC_MODULE = 0 */
+    globals.modules[FAULT_GENERIC_MODULE].confOffset = 0;
+    globals.modules[FAULT_GENERIC_MODULE].tolerance = FAULT_NO_FAILURE;
+
+    globals.modulesLen = 1; /* one module configured */
+}/* fault_modules_reset */
+
+/* for internal use only, it does not guarantee the global consistency */
+static
+void fault_config_reset(void)
+{
+    globals.policyCur = 0;
+    globals.reconfActive = 0;
+    globals.reconfSeen = 0;
+    globals.reconfBuilding = false;
+    memset(globals.reconfChanged, 0, sizeof(globals.reconfChanged));
+
+    FaultPolicy none;
+    fault_policy_make(&none, FAULT_POL_NONE, 0, 0, 0);
+
+    for (fault_id i = 0; i < FAULT_ID_MAX; i++){
+        globals.config[i].id = i;
+        globals.config[i].module = FAULT_GENERIC_MODULE;
+        globals.config[i].code = i;
+        globals.config[i].recover = 0;
+        memset(&globals.config[i].damping, 0, sizeof(FaultDamping));
+        globals.policies[0][i] = none;
+    }/* for config */
+
+    globals.configLen = FAULT_GENERIC_ALL;
+    memset(globals.beatWarn, 0, sizeof(globals.beatWarn));
+    memset(globals.beatErr, 0, sizeof(globals.beatErr));
+
+    globals.inhibitParentsLen = 0;
+    globals.inhibitActive = 0;
+    memset(globals.inhibitSlot, 0, sizeof(globals.inhibitSlot));
+    memset(globals.inhibitBy, 0, sizeof(globals.inhibitBy));
+}/* fault_config_reset */
+
+/* for internal use only, it does not guarantee the global consistency */
+static
+void fault_records_reset(void)
+{
+    globals.lazy = false;
+    memset(globals.dirty, 0, sizeof(globals.dirty));
+
+    /* all the records, the ones of the new modules must be clean */
+    memset(globals.records, 0, sizeof(globals.records));
+    memset(globals.status, FAULT_ST_NORMAL, sizeof(globals.status));
+    memset(globals.flaps, 0, sizeof(globals.flaps));
+    memset(globals.beatLast, 0, sizeof(globals.beatLast));
+    memset(globals.beatLevel, 0, sizeof(globals.beatLevel));
+}/* fault_records_reset */
+
+/* for internal use only, it does not guarantee the global consistency */
+static
+void fault_rings_reset(void)
+{
+    memset(globals.logsModules, 0, sizeof(globals.logsModules));
+    globals.coldEnabled = false;
+    globals.logsHook = NULL;
+    globals.logsHookCtx = NULL;
+    globals.updateHook = NULL;
+    globals.updateHookCtx = NULL;
+    globals.clock = NULL;
+
+    /* all the pool to the shared ring */
+    globals.logsShared.offset = 0;
+    globals.logsShared.cap = FAULT_LOG_MAX;
+    globals.logsShared.front = 0;
+    globals.logsShared.len = 0;
+}/* fault_rings_reset */
+
+/* for internal use only, it does not guarantee the global consistency */
+static
+void fault_history_reset(void)
+{
+#if FAULT_HISTORY_MAX > 0
+    globals.historyUsed = 0;
+    memset(globals.historyRings, 0, sizeof(globals.historyRings));
+#endif
+}/* fault_history_reset */
+
+/* for internal use only, it does not guarantee the global consistency */
+static
+void fault_refstats_reset(void)
+{
+#if FAULT_REFSTATS_MAX > 0
+    globals.refstatsLen = 0;
+    memset(globals.refstatsSlot, 0, sizeof(globals.refstatsSlot));
+#endif
+}/* fault_refstats_reset */
+
+/* for internal use only, it does not guarantee the global consistency */
+static
+void fault_incidents_reset(void)
+{
+#if FAULT_INCIDENT_MAX > 0
+    globals.incidentsCur = 0;
+    globals.incidentsLen = 0;
+    globals.incidentsOpen = false;
+#endif
+}/* fault_incidents_reset */
+
+/* for internal use only, it does not guarantee the global consistency */
+static
+void fault_topk_reset(void)
+{
+#if FAULT_TOPK_MAX > 0
+    globals.topSlotsLen = 0;
+    globals.topMin = FAULT_TOPK_NIL;
+    globals.topMax = FAULT_TOPK_NIL;
+    memset(globals.topSlot, 0, sizeof(globals.topSlot));
+
+    for (unsigned int b = 0; b < FAULT_TOPK_MAX; b++){
+        globals.topBuckets[b].next = b + 1; /* the last is FAULT_TOPK_NIL */
+    }
+    globals.topFree = 0;
+#endif
+}/* fault_topk_reset */
+
+/* for internal use only, it does not guarantee the global consistency */
+static
+void fault_invalid_reset(void)
+{
+#if FAULT_INVALID_WIDTH > 0
+    memset(globals.invalid, 0, sizeof(globals.invalid));
+    globals.invalidTopLen = 0;
+#endif
+}/* fault_invalid_reset */
+
+void fault_init(void)
+{
+#if FAULT_STATS
+    memset(&globals.stats, 0, sizeof(globals.stats));
+#endif
+    fault_modules_reset();
+    fault_config_reset();
+    fault_records_reset();
+    fault_rings_reset();
+    fault_logs_reset();
+    fault_history_reset();
+    fault_refstats_reset();
+    fault_incidents_reset();
+#if FAULT_INCIDENT_MAX > 0
+    globals.incidentsWindow = 0;
+#endif
+    fault_topk_reset();
+    fault_invalid_reset();
+}/* fault_init () */
+
+void fault_stats(FaultStats *out)
+{
+    memset(out, 0, sizeof(FaultStats));
+
+#if FAULT_STATS
+    out->updates = __atomic_load_n(&globals.stats.updates, __ATOMIC_RELAXED);
+    out->unknown = __atomic_load_n(&globals.stats.unknown, __ATOMIC_RELAXED);
+    out->overflows = __atomic_load_n(&globals.stats.overflows,
+                                     __ATOMIC_RELAXED);
+    out->policyResets = __atomic_load_n(&globals.stats.policyResets,
+                                        __ATOMIC_RELAXED);
+    out->logs = __atomic_load_n(&globals.stats.logs, __ATOMIC_RELAXED);
+    out->logsEvicted = __atomic_load_n(&globals.stats.logsEvicted,
+                                       __ATOMIC_RELAXED);
+    out->logsDropped = __atomic_load_n(&globals.stats.logsDropped,
+                                       __ATOMIC_RELAXED);
+    out->logsInhibited = __atomic_load_n(&globals.stats.logsInhibited,
+                                         __ATOMIC_RELAXED);
+#endif
+}/* fault_stats */
+
+fault_module fault_conf_module(fault_counter ncodes, fault_counter tolerance)
+{
     if (globals.modulesLen >= FAULT_MODULE_MAX){
         return FAULT_MODULE_KO;
     }
@@ -323,109 +1407,1378 @@ fault_module fault_conf_module(fault_counter ncodes, fault_counter tolerance)
     globals.modules[module].tolerance = tolerance;
     globals.modulesLen = globals.modulesLen + 1;
 
-    /* Set a NONE policy to all the new codes, as default */
+    /* Set a NONE policy to all the new codes, as default.
+     * Their records are clean since fault_init().
+     */
+    FaultPolicy none;
+    fault_policy_make(&none, FAULT_POL_NONE, 0, 0, 0);
+
     for (fault_id i = 0; i < (fault_id)ncodes; i++){
         fault_id id = globals.configLen + i;
         assert(globals.config[id].id == id);
 
         globals.config[id].module = module;
         globals.config[id].code = i;
+        globals.config[id].recover = 0;
+        memset(&globals.config[id].damping, 0, sizeof(FaultDamping));
+        globals.policies[globals.policyCur][id] = none;
+    }/* for config */
+
+    globals.configLen = globals.configLen + (fault_id)ncodes;
+
+    return module;
+}/* fault_conf_module */
+
+bool fault_conf_module_logs(fault_module mod, size_t capacity)
+{
+    if (mod >= globals.modulesLen){
+        return false;
+    }
+
+    if (capacity < 1){
+        return false;
+    }
+
+    if (globals.logsModules[mod].cap > 0){
+        /* already reserved */
+        return false;
+    }
+
+    if (capacity > globals.logsShared.cap){
+        return false;
+    }
+
+    /* input validated */
+
+    /* take the slots from the head of the shared pool */
+    globals.logsModules[mod].offset = globals.logsShared.offset;
+    globals.logsModules[mod].cap = capacity;
+    globals.logsShared.offset = globals.logsShared.offset + capacity;
+    globals.logsShared.cap = globals.logsShared.cap - capacity;
+
+    /* the geometry is changed, the old entries are meaningless */
+    fault_logs_reset();
+
+    return true;
+}/* fault_conf_module_logs */
+
+void fault_conf_logs_hook(fault_log_hook hook, void *ctx)
+{
+    globals.logsHook = hook;
+    globals.logsHookCtx = ctx;
+}/* fault_conf_logs_hook */
+
+void fault_conf_update_hook(fault_update_hook hook, void *ctx)
+{
+    globals.updateHook = hook;
+    globals.updateHookCtx = ctx;
+}/* fault_conf_update_hook */
+
+void fault_conf_clock(fault_clock clock)
+{
+    globals.clock = clock;
+}/* fault_conf_clock */
+
+void fault_conf_lazy(bool enable)
+{
+    if (!enable){
+        fault_flush();
+    }
+
+    globals.lazy = enable;
+}/* fault_conf_lazy */
+
+bool fault_conf_logs_cold(bool enable)
+{
+#if FAULT_LOG_COLD_BLOCKS > 0 && !FAULT_REALTIME
+    globals.coldEnabled = enable;
+    fault_logs_reset();
+
+    return true;
+#else
+    (void)enable;
+    return false;
+#endif
+}/* fault_conf_logs_cold */
+
+bool fault_policy_none(fault_id id)
+{
+    if (!fault_id_valid(id)){
+        return false;
+    }
+
+    /* cannot fail */
+    fault_policy_make(&globals.policies[globals.policyCur][id],
+                      FAULT_POL_NONE, 0, 0, 0);
+
+    return fault_reset(id);
+}/* fault_policy_none */
+
+fault_module fault_modules_length(void)
+{
+    return globals.modulesLen;
+}/* fault_modules_length */
+
+fault_counter fault_module_codes(fault_module mod)
+{
+    if (mod >= globals.modulesLen){
+        return 0;
+    }
+
+    return globals.modules[mod].numCodes;
+}/* fault_module_codes */
+
+fault_id fault_getid(fault_module mod, fault_code code)
+{
+    if (mod >= globals.modulesLen){
+        return FAULT_GENERIC_UNKNOWN;
+    }
+
+    if (code >= globals.modules[mod].numCodes){
+        return FAULT_GENERIC_UNKNOWN;
+    }
+
+    return (fault_id)(globals.modules[mod].confOffset + code);
+}/* fault_getid */
+
+/* Log the current state of the record */
+static
+void fault_record_log(fault_id fid, fault_millisecs now)
+{
+    FaultLog log = {
+        .saved = false,
+        .index = 0,
+        .timestamp = now,
+        .module = globals.config[fid].module,
+        .code = globals.config[fid].code,
+        .status = (fault_status_type)globals.status[fid],
+        .refValue = globals.records[fid].refValue
+    };
+    fault_log_enqueue(log);
+}/* fault_record_log */
+
+/* Set the status of the record, and of its parent slot */
+static
+void fault_record_status(fault_id fid, fault_status_type s)
+{
+    globals.status[fid] = (unsigned char)s;
+
+    unsigned int slot = globals.inhibitSlot[fid];
+    if (slot > 0){
+        unsigned long bit = 1UL << (slot - 1);
+        if (s == FAULT_ST_ERROR){
+            globals.inhibitActive |= bit;
+        } else {
+            globals.inhibitActive &= ~bit;
+        }
+    }
+}/* fault_record_status */
+
+/* Copy the thresholds of the current policy of the record for
+ * fault_check_stale(), after a change of the policy
+ */
+static
+void fault_record_beat(fault_id fid)
+{
+    const FaultPolicy *policy = &globals.policies[globals.policyCur][fid];
+
+    if (policy->type == FAULT_POL_HEARTBEAT){
+        /* less than 2^31, see fault_policy_make() */
+        globals.beatWarn[fid] = (int32_t)policy->conf.heartbeat.msWarning;
+        globals.beatErr[fid] = (int32_t)policy->conf.heartbeat.msError;
+    } else {
+        globals.beatWarn[fid] = 0;
+        globals.beatErr[fid] = 0;
+        globals.beatLevel[fid] = FAULT_ST_NORMAL;
+    }
+}/* fault_record_beat */
+
+static
+void fault_lazy_eval(fault_id id, fault_millisecs now);
+
+/* Check the parents of the record, evaluated first in lazy mode */
+static
+bool fault_record_inhibited(fault_id fid, fault_millisecs now)
+{
+    unsigned long by = globals.inhibitBy[fid];
+
+    if (globals.lazy){
+        for (unsigned long m = by; m != 0; m &= m - 1){
+            fault_lazy_eval(globals.inhibitParents[__builtin_ctzl(m)], now);
+        }
+    }
+
+    return (by & globals.inhibitActive) != 0;
+}/* fault_record_inhibited */
+
+/* Decay of the damping penalty after 'dt' milliseconds, in fixed point */
+static
+unsigned long fault_damping_decay(unsigned long penalty,
+                                  fault_millisecs dt,
+                                  fault_millisecs halfLife)
+{
+    fault_millisecs halvings = dt / halfLife;
+
+    if (halvings >= sizeof(unsigned long) * CHAR_BIT){
+        return 0;
+    }
+
+    penalty >>= halvings;
+    unsigned long long i = (unsigned long long)(dt % halfLife) * 16 / halfLife;
+
+    return (unsigned long)(((unsigned long long)penalty * dampingDecay[i]) >> 16);
+}/* fault_damping_decay */
+
+/* Apply the damping and the hysteresis to the status computed by the policy.
+ * return the status to set
+ */
+static
+fault_status_type fault_record_flap(fault_id fid,
+                                    fault_status_type s,
+                                    fault_millisecs now)
+{
+    const FaultConfRecord *conf = &globals.config[fid];
+    FaultFlapRecord *flap = &globals.flaps[fid];
+    fault_status_type prev = (fault_status_type)globals.status[fid];
+    fault_status_type raw = s;
+
+    if (conf->damping.penalty > 0){
+        unsigned long p = fault_damping_decay(flap->penalty, now - flap->stamp,
+                                              conf->damping.halfLife);
+        if (raw != flap->raw){
+            p = (p > ULONG_MAX - conf->damping.penalty)
+                ? ULONG_MAX : p + conf->damping.penalty;
+        }
+
+        if (!flap->suppressed && p > conf->damping.suppress){
+            flap->suppressed = true;
+        } else if (flap->suppressed && p < conf->damping.reuse){
+            flap->suppressed = false;
+        }
+
+        flap->penalty = p;
+        flap->stamp = now;
+
+        if (flap->suppressed && s < prev){
+            s = prev; /* held */
+        }
+    }
+    flap->raw = (unsigned char)raw;
+
+    if (conf->recover > 0 && s < prev){
+        flap->pending++;
+        if (flap->pending < conf->recover){
+            return prev;
+        }
+    }
+    flap->pending = 0;
+
+    return s;
+}/* fault_record_flap */
+
+/* Evaluate and log the status of the record */
+static
+void fault_record_eval(fault_id fid, fault_millisecs now)
+{
+    fault_status_type prev = (fault_status_type)globals.status[fid];
+    fault_status_type s =
+        fault_policy_status(&globals.policies[globals.policyCur][fid],
+                            &globals.records[fid]);
+
+    /* the silence of the heartbeats, normal for the other policies */
+    if (globals.beatLevel[fid] > (int32_t)s){
+        s = (fault_status_type)globals.beatLevel[fid];
+    }
+
+    if (globals.config[fid].recover > 0 ||
+        globals.config[fid].damping.penalty > 0){
+        s = fault_record_flap(fid, s, now);
+    }
+
+    if (s != prev){
+        FAULT_PROBE5(status__change, fid, globals.config[fid].module,
+                     globals.config[fid].code, prev, s);
+    }
+
+    fault_record_status(fid, s);
+
+    if (fault_record_inhibited(fid, now)){
+        FAULT_STAT_ADD(logsInhibited, 1);
+    } else {
+        fault_record_log(fid, now);
+    }
+}/* fault_record_eval */
+
+/* Evaluate the status of a record updated in lazy mode */
+static
+void fault_lazy_eval(fault_id id, fault_millisecs now)
+{
+    size_t w = id / FAULT_DIRTY_BITS;
+    unsigned long bit = 1UL << (id % FAULT_DIRTY_BITS);
+
+    if ((globals.dirty[w] & bit) == 0){
+        return;
+    }
+
+    globals.dirty[w] &= ~bit;
+    fault_record_eval(id, now);
+}/* fault_lazy_eval */
+
+bool fault_inhibit(fault_id parent, fault_id child)
+{
+    if (parent >= globals.configLen || child >= globals.configLen){
+        return false;
+    }
+
+    if (parent == child){
+        return false;
+    }
+
+    unsigned int slot = globals.inhibitSlot[parent];
+    if (slot == 0 && globals.inhibitParentsLen >= FAULT_INHIBIT_MAX){
+        return false;
+    }
+
+    /* input validated */
+
+    if (slot == 0){
+        slot = ++globals.inhibitParentsLen;
+        globals.inhibitSlot[parent] = (unsigned char)slot;
+        globals.inhibitParents[slot - 1] = parent;
+        /* the parent can be in error already */
+        fault_record_status(parent, (fault_status_type)globals.status[parent]);
+    }
+
+    globals.inhibitBy[child] |= 1UL << (slot - 1);
+
+    return true;
+}/* fault_inhibit */
+
+bool fault_inhibited(fault_id id)
+{
+    if (id >= globals.configLen){
+        return false;
+    }
+
+    return fault_record_inhibited(id, fault_time());
+}/* fault_inhibited */
+
+bool fault_conf_hysteresis(fault_id id, fault_counter recover)
+{
+    if (id >= globals.configLen){
+        return false;
+    }
+
+    globals.config[id].recover = recover;
+    globals.flaps[id].pending = 0;
+
+    return true;
+}/* fault_conf_hysteresis */
+
+bool fault_conf_damping(fault_id id, const FaultDamping *damping)
+{
+    if (id >= globals.configLen){
+        return false;
+    }
+
+    if (damping != NULL &&
+        (damping->penalty == 0 || damping->halfLife == 0 ||
+         damping->reuse > damping->suppress)){
+        return false;
+    }
+
+    /* input validated */
+
+    if (damping != NULL){
+        globals.config[id].damping = *damping;
+    } else {
+        memset(&globals.config[id].damping, 0, sizeof(FaultDamping));
+    }
+
+    globals.flaps[id].penalty = 0; /* no decay, any stamp */
+    globals.flaps[id].raw = globals.status[id];
+    globals.flaps[id].suppressed = false;
+
+    return true;
+}/* fault_conf_damping */
+
+bool fault_damped(fault_id id)
+{
+    if (id >= globals.configLen){
+        return false;
+    }
+
+    return globals.flaps[id].suppressed;
+}/* fault_damped */
+
+bool fault_conf_history(fault_id id, size_t len)
+{
+#if FAULT_HISTORY_MAX > 0
+    if (!fault_id_valid(id) || len < 1){
+        return false;
+    }
+
+    if (globals.historyRings[id].cap > 0){
+        /* already configured */
+        return false;
+    }
+
+    if (len > FAULT_HISTORY_MAX - globals.historyUsed){
+        return false;
+    }
+
+    /* input validated */
+
+    FaultHistoryRing *ring = &globals.historyRings[id];
+    ring->offset = (unsigned int)globals.historyUsed;
+    ring->cap = (unsigned int)len;
+    ring->next = 0;
+    ring->len = 0;
+    globals.historyUsed = globals.historyUsed + len;
+
+    return true;
+#else
+    (void)id;
+    (void)len;
+    return false;
+#endif
+}/* fault_conf_history */
+
+size_t fault_history(fault_id id, FaultSample *out, size_t max)
+{
+#if FAULT_HISTORY_MAX > 0
+    if (!fault_id_valid(id) || out == NULL){
+        return 0;
+    }
+
+    /* input validated */
+
+    const FaultHistoryRing *ring = &globals.historyRings[id];
+    size_t n = (ring->len < max) ? ring->len : max;
+    if (n == 0){
+        return 0;
+    }
+
+    /* the last n samples, in at most two pieces */
+    size_t first = fault_ring_wrap(ring->next + ring->cap - n, ring->cap);
+    size_t head = ring->cap - first;
+    if (head > n){
+        head = n;
+    }
+
+    const FaultSample *pool = &globals.history[ring->offset];
+    memcpy(out, pool + first, head * sizeof(FaultSample));
+    memcpy(out + head, pool, (n - head) * sizeof(FaultSample));
+
+    return n;
+#else
+    (void)id;
+    (void)out;
+    (void)max;
+    return 0;
+#endif
+}/* fault_history */
+
+bool fault_conf_refstats(fault_id id, unsigned int shift)
+{
+#if FAULT_REFSTATS_MAX > 0
+    if (!fault_id_valid(id) || globals.refstatsSlot[id] > 0){
+        return false;
+    }
+
+    if (globals.refstatsLen >= FAULT_REFSTATS_MAX){
+        return false;
+    }
+
+    if (shift >= sizeof(unsigned long) * CHAR_BIT){
+        return false;
+    }
+
+    /* input validated */
+
+    FaultRefStatsRecord *r = &globals.refstats[globals.refstatsLen];
+    memset(r, 0, sizeof(FaultRefStatsRecord));
+    r->shift = shift;
+    globals.refstatsLen = globals.refstatsLen + 1;
+    globals.refstatsSlot[id] = (unsigned short)globals.refstatsLen;
+
+    return true;
+#else
+    (void)id;
+    (void)shift;
+    return false;
+#endif
+}/* fault_conf_refstats */
+
+bool fault_refstats(fault_id id, FaultRefStats *out)
+{
+#if FAULT_REFSTATS_MAX > 0
+    if (!fault_id_valid(id) || globals.refstatsSlot[id] == 0 || out == NULL){
+        return false;
+    }
+
+    /* input validated */
+
+    unsigned int slot = globals.refstatsSlot[id] - 1U;
+    const FaultRefStatsRecord *r = &globals.refstats[slot];
+
+    out->count = r->count;
+    out->faults = r->faults;
+    out->min = r->min;
+    out->max = r->max;
+    out->mean = r->mean;
+    out->variance = (r->count > 0) ? r->m2 / (double)r->count : 0;
+    memcpy(out->buckets, r->buckets, sizeof(out->buckets));
+
+    return true;
+#else
+    (void)id;
+    (void)out;
+    return false;
+#endif
+}/* fault_refstats */
+
+bool fault_conf_incidents(fault_millisecs window, size_t minIds)
+{
+#if FAULT_INCIDENT_MAX > 0
+    if (minIds < 1){
+        return false;
+    }
+
+    /* input validated */
+
+    fault_incidents_reset();
+    globals.incidentsWindow = window;
+    globals.incidentsMin = minIds;
+
+    return true;
+#else
+    (void)window;
+    (void)minIds;
+    return false;
+#endif
+}/* fault_conf_incidents */
+
+#if FAULT_INCIDENT_MAX > 0
+/* The incident at position 'index', 0 for the most recent.
+ * return NULL if out of range
+ */
+static
+const FaultIncidentRecord *fault_incident_at(size_t index)
+{
+    const FaultIncidentRecord *cur = &globals.incidents[globals.incidentsCur];
+    size_t open = (globals.incidentsOpen &&
+                   cur->ids >= globals.incidentsMin) ? 1 : 0;
+
+    if (index >= open + globals.incidentsLen){
+        return NULL;
+    }
+    if (index < open){
+        return cur;
+    }
+
+    /* the kept ones are the slots before the current */
+    size_t back = index - open + 1;
+    size_t slot = fault_ring_wrap(globals.incidentsCur + FAULT_INCIDENT_MAX + 1 - back,
+                                  FAULT_INCIDENT_MAX + 1);
+
+    return &globals.incidents[slot];
+}/* fault_incident_at */
+
+/* Check if the id is a member of the incident */
+static
+bool fault_incident_member(const FaultIncidentRecord *inc, fault_id id)
+{
+    return (inc->members[id / FAULT_DIRTY_BITS] >> (id % FAULT_DIRTY_BITS)) & 1UL;
+}/* fault_incident_member */
+#endif
+
+size_t fault_incidents(void)
+{
+#if FAULT_INCIDENT_MAX > 0
+    const FaultIncidentRecord *cur = &globals.incidents[globals.incidentsCur];
+    size_t open = (globals.incidentsOpen &&
+                   cur->ids >= globals.incidentsMin) ? 1 : 0;
+
+    return open + globals.incidentsLen;
+#else
+    return 0;
+#endif
+}/* fault_incidents */
+
+bool fault_incident(size_t index, FaultIncident *out)
+{
+#if FAULT_INCIDENT_MAX > 0
+    const FaultIncidentRecord *inc = fault_incident_at(index);
+
+    if (inc == NULL || out == NULL){
+        return false;
+    }
+
+    /* input validated */
+
+    out->start = inc->start;
+    out->end = inc->end;
+    out->count = inc->ids;
+    out->modules = inc->modulesLen;
+    out->open = (inc == &globals.incidents[globals.incidentsCur]);
+
+    return true;
+#else
+    (void)index;
+    (void)out;
+    return false;
+#endif
+}/* fault_incident */
+
+size_t fault_incident_ids(size_t index, fault_id *out, size_t max)
+{
+#if FAULT_INCIDENT_MAX > 0
+    const FaultIncidentRecord *inc = fault_incident_at(index);
+    size_t n = 0;
+
+    if (inc == NULL || out == NULL){
+        return 0;
+    }
+
+    /* input validated */
+
+    for (size_t w = 0; w < FAULT_DIRTY_WORDS && n < max; w++){
+        unsigned long bits = inc->members[w];
+        while (bits != 0 && n < max){
+            unsigned int b = (unsigned int)__builtin_ctzl(bits);
+            out[n] = (fault_id)(w * FAULT_DIRTY_BITS + b);
+            n = n + 1;
+            bits &= bits - 1;
+        }
+    }
+
+    return n;
+#else
+    (void)index;
+    (void)out;
+    (void)max;
+    return 0;
+#endif
+}/* fault_incident_ids */
+
+bool fault_incident_module(size_t index, fault_module module)
+{
+#if FAULT_INCIDENT_MAX > 0
+    const FaultIncidentRecord *inc = fault_incident_at(index);
+
+    if (inc == NULL || module >= FAULT_MODULE_MAX){
+        return false;
+    }
+
+    /* input validated */
+
+    return (inc->modules[module / FAULT_DIRTY_BITS] >>
+            (module % FAULT_DIRTY_BITS)) & 1UL;
+#else
+    (void)index;
+    (void)module;
+    return false;
+#endif
+}/* fault_incident_module */
+
+size_t fault_incidents_common(fault_id a, fault_id b)
+{
+#if FAULT_INCIDENT_MAX > 0
+    size_t n = 0;
+
+    if (!fault_id_valid(a) || !fault_id_valid(b)){
+        return 0;
+    }
+
+    /* input validated */
+
+    size_t len = fault_incidents();
+    for (size_t i = 0; i < len; i++){
+        const FaultIncidentRecord *inc = fault_incident_at(i);
+        if (fault_incident_member(inc, a) && fault_incident_member(inc, b)){
+            n = n + 1;
+        }
+    }
+
+    return n;
+#else
+    (void)a;
+    (void)b;
+    return 0;
+#endif
+}/* fault_incidents_common */
+
+/* Quiescent point of the update thread: switch to the policies
+ * published by fault_reconf_commit().
+ */
+static
+void fault_reconf_sync(fault_millisecs now)
+{
+    unsigned int active = __atomic_load_n(&globals.reconfActive,
+                                          __ATOMIC_ACQUIRE);
+    if (active == globals.policyCur){
+        return;
+    }
+
+    globals.policyCur = active;
+
+    for (size_t w = 0; w < FAULT_DIRTY_WORDS; w++){
+        for (unsigned long m = globals.reconfChanged[w]; m != 0; m &= m - 1){
+            fault_id id = (fault_id)(w * FAULT_DIRTY_BITS +
+                                     (size_t)__builtin_ctzl(m));
+            fault_record_beat(id);
+            if (globals.policies[active][id].type == FAULT_POL_HEARTBEAT){
+                /* a new heartbeat, the silence starts now */
+                globals.beatLast[id] = (uint32_t)now;
+                globals.beatLevel[id] = FAULT_ST_NORMAL;
+            }
+            if (globals.reconfReset){
+                fault_reset(id);
+            } else if (globals.lazy){
+                globals.dirty[w] |= m & -m;
+            } else {
+                fault_record_eval(id, now);
+            }
+        }
+    }/* for words */
+
+    /* the old table is free */
+    __atomic_store_n(&globals.reconfSeen, active, __ATOMIC_RELEASE);
+}/* fault_reconf_sync */
+
+bool fault_reconf_begin(void)
+{
+    if (globals.reconfBuilding){
+        return false;
+    }
+
+    unsigned int active = globals.reconfActive; /* single writer */
+    if (__atomic_load_n(&globals.reconfSeen, __ATOMIC_ACQUIRE) != active){
+        /* the other table can still be in use */
+        return false;
+    }
+
+    /* input validated */
+
+    unsigned int staging = 1 - active;
+    memcpy(globals.policies[staging], globals.policies[active],
+           sizeof(FaultPolicy) * globals.configLen);
+    memset(globals.reconfChanged, 0, sizeof(globals.reconfChanged));
+    globals.reconfBuilding = true;
+
+    return true;
+}/* fault_reconf_begin */
+
+bool fault_reconf_policy(fault_id id,
+                         fault_policy_type type,
+                         unsigned long warn,
+                         unsigned long err,
+                         unsigned long reset)
+{
+    FaultPolicy policy;
+
+    if (!globals.reconfBuilding){
+        return false;
+    }
+
+    if (!fault_id_valid(id)){
+        return false;
+    }
+
+    if (!fault_policy_make(&policy, type, warn, err, reset)){
+        return false;
+    }
+
+    /* input validated */
+
+    globals.policies[1 - globals.reconfActive][id] = policy;
+    globals.reconfChanged[id / FAULT_DIRTY_BITS] |= 1UL << (id % FAULT_DIRTY_BITS);
+
+    return true;
+}/* fault_reconf_policy */
+
+bool fault_reconf_commit(bool keepCounters)
+{
+    if (!globals.reconfBuilding){
+        return false;
+    }
+
+    globals.reconfReset = !keepCounters;
+    globals.reconfBuilding = false;
+    __atomic_store_n(&globals.reconfActive, 1 - globals.reconfActive,
+                     __ATOMIC_RELEASE);
+
+    return true;
+}/* fault_reconf_commit */
+
+void fault_reconf_abort(void)
+{
+    globals.reconfBuilding = false;
+}/* fault_reconf_abort */
+
+size_t fault_flush(void)
+{
+    size_t n = 0;
+    fault_millisecs now = fault_time();
+
+    fault_reconf_sync(now);
+
+    for (size_t w = 0; w < FAULT_DIRTY_WORDS; w++){
+        while (globals.dirty[w] != 0){
+            size_t b = (size_t)__builtin_ctzl(globals.dirty[w]);
+            fault_id id = (fault_id)(w * FAULT_DIRTY_BITS + b);
+
+            assert(id < globals.configLen);
+            fault_lazy_eval(id, now);
+            n++;
+        }
+    }/* for words */
+
+    return n;
+}/* fault_flush */
+
+fault_status_type fault_status(fault_id id)
+{
+    if (id >= globals.configLen){
+        return FAULT_ST_ERROR;
+    }
+
+    if (globals.lazy){
+        fault_lazy_eval(id, fault_time());
+    }
+
+    return (fault_status_type)globals.status[id];
+}/* fault_status_type */
+
+fault_status_type fault_status_unchecked(fault_id id)
+{
+    assert(fault_id_valid(id));
+
+    if (globals.lazy){
+        fault_lazy_eval(id, fault_time());
+    }
+
+    return (fault_status_type)globals.status[id];
+}/* fault_status_unchecked */
+
+fault_status_module_type fault_status_module(fault_module mod)
+{
+    if (mod >= globals.modulesLen){
+        return FAULT_SM_FAILED;
+    }
+
+    assert(globals.modules[mod].module == mod);
+
+    fault_counter n = globals.modules[mod].numCodes;
+    fault_id o = globals.modules[mod].confOffset;
+    fault_counter t = globals.modules[mod].tolerance;
+    fault_id end = (fault_id)(o + n);
+
+    assert(end <= globals.configLen);
+
+    fault_millisecs now = 0;
+    if (globals.lazy){
+        now = fault_time();
+        for (fault_id i = o; i < end; i++){
+            fault_lazy_eval(i, now);
+        }
+    }
+
+    fault_status_module_type s = FAULT_SM_NORMAL;
+    fault_counter e = 0;
+
+    /* NORMAL <= all NORMAL
+     * WARNING <= exists a warning and not exists an error
+     * FAULTED <= (0 < #errors <= tolerance)
+     * FAILED <= (#errors > tolerance)
+     * The inhibited codes are ignored.
+     */
+    for (fault_id i = o; i < end; i++){
+        if (globals.inhibitBy[i] != 0 && fault_record_inhibited(i, now)){
+            continue;
+        }
+
+        switch (globals.status[i]){
+        case FAULT_ST_NORMAL:
+            /* empty */
+            break;
+        case FAULT_ST_WARNING:
+            /* warning has low priority */
+            if (s == FAULT_SM_NORMAL){ /* not warn, not err */
+                s = FAULT_SM_WARNING; /* can change to fault, failed */
+            }
+            break;
+        case FAULT_ST_ERROR:
+            e++;
+            break;
+        default: /* should not happen */
+            s = FAULT_SM_FAILED;
+            break;
+        }/* switch record status */
+    }/* for record */
+
+    if (0 < e && e <= t){
+        s = FAULT_SM_FAULTED;
+    } else if (e > t){
+        s = FAULT_SM_FAILED;
+    } /* else remains NORMAL or WARNING */
+
+    return s;
+}/* fault_status_module_type */
+
+
+#if FAULT_TOPK_MAX > 0
+/* Remove the slot from its bucket, the empty bucket is released */
+static
+void fault_topk_detach(unsigned int e)
+{
+    FaultTopKSlot *slot = &globals.topSlots[e];
+    FaultTopKBucket *b = &globals.topBuckets[slot->bucket];
+
+    if (slot->prev != FAULT_TOPK_NIL){
+        globals.topSlots[slot->prev].next = slot->next;
+    } else {
+        b->first = slot->next;
+    }
+    if (slot->next != FAULT_TOPK_NIL){
+        globals.topSlots[slot->next].prev = slot->prev;
+    }
+
+    if (b->first != FAULT_TOPK_NIL){
+        return;
+    }
+
+    if (b->prev != FAULT_TOPK_NIL){
+        globals.topBuckets[b->prev].next = b->next;
+    } else {
+        globals.topMin = b->next;
+    }
+    if (b->next != FAULT_TOPK_NIL){
+        globals.topBuckets[b->next].prev = b->prev;
+    } else {
+        globals.topMax = b->prev;
+    }
+
+    b->next = globals.topFree;
+    globals.topFree = slot->bucket;
+}/* fault_topk_detach */
+
+/* Insert the slot in the bucket of 'count'.
+ * after: a bucket with a lower count, where the search starts,
+ *        FAULT_TOPK_NIL to search from the lowest one.
+ */
+static
+void fault_topk_attach(unsigned int e, unsigned long count, unsigned int after)
+{
+    unsigned int prev = after;
+    unsigned int b = (after == FAULT_TOPK_NIL) ? globals.topMin
+                                               : globals.topBuckets[after].next;
+
+    while (b != FAULT_TOPK_NIL && globals.topBuckets[b].count < count){
+        prev = b;
+        b = globals.topBuckets[b].next;
+    }
+
+    if (b == FAULT_TOPK_NIL || globals.topBuckets[b].count != count){
+        /* new bucket between prev and b, there is one for each slot */
+        unsigned int nb = globals.topFree;
+        assert(nb != FAULT_TOPK_NIL);
+        globals.topFree = globals.topBuckets[nb].next;
+
+        globals.topBuckets[nb].count = count;
+        globals.topBuckets[nb].first = FAULT_TOPK_NIL;
+        globals.topBuckets[nb].prev = prev;
+        globals.topBuckets[nb].next = b;
+
+        if (prev != FAULT_TOPK_NIL){
+            globals.topBuckets[prev].next = nb;
+        } else {
+            globals.topMin = nb;
+        }
+        if (b != FAULT_TOPK_NIL){
+            globals.topBuckets[b].prev = nb;
+        } else {
+            globals.topMax = nb;
+        }
+        b = nb;
+    }
+
+    FaultTopKSlot *slot = &globals.topSlots[e];
+    slot->bucket = b;
+    slot->prev = FAULT_TOPK_NIL;
+    slot->next = globals.topBuckets[b].first;
+    if (slot->next != FAULT_TOPK_NIL){
+        globals.topSlots[slot->next].prev = e;
+    }
+    globals.topBuckets[b].first = e;
+}/* fault_topk_attach */
+#endif
+
+/* Add a fault to the history of the id, if configured */
+static
+void fault_history_add(fault_id fid, fault_millisecs now, long ref)
+{
+#if FAULT_HISTORY_MAX > 0
+    FaultHistoryRing *ring = &globals.historyRings[fid];
+
+    if (ring->cap == 0){
+        return;
+    }
+
+    FaultSample *sample = &globals.history[ring->offset + ring->next];
+    sample->refValue = ref;
+    sample->timestamp = now;
+
+    ring->next = (unsigned int)fault_ring_wrap(ring->next + 1, ring->cap);
+    ring->len = (ring->len < ring->cap) ? ring->len + 1 : ring->cap;
+#else
+    (void)fid;
+    (void)now;
+    (void)ref;
+#endif
+}/* fault_history_add */
+
+#if FAULT_REFSTATS_MAX > 0
+/* Histogram bucket of the reference value, see FaultRefStats */
+static
+unsigned int fault_refstats_bucket(long ref, unsigned int shift)
+{
+    const unsigned int bits = sizeof(unsigned long) * CHAR_BIT;
+    unsigned long m = (ref < 0) ? 0UL - (unsigned long)ref : (unsigned long)ref;
+    unsigned int half = FAULT_REFSTATS_BUCKETS / 2;
+
+    m >>= shift;
+    unsigned int k = (m == 0) ? 0 : bits - (unsigned int)__builtin_clzl(m);
+
+    if (ref < 0){
+        return half - ((k < half) ? k : half);
+    }
+
+    return half + ((k < half - 1) ? k : half - 1);
+}/* fault_refstats_bucket */
+#endif
+
+/* A series of faults of the id started at 'now',
+ * add it to the current incident or start a new one
+ */
+static
+void fault_incident_add(fault_id fid, fault_millisecs now)
+{
+#if FAULT_INCIDENT_MAX > 0
+    if (globals.incidentsWindow == 0){
+        return;
+    }
+
+    FaultIncidentRecord *inc = &globals.incidents[globals.incidentsCur];
+
+    /* a clock going back starts a new incident too */
+    if (!globals.incidentsOpen || now - inc->start > globals.incidentsWindow){
+        if (globals.incidentsOpen && inc->ids >= globals.incidentsMin){
+            /* keep it, the oldest is overwritten */
+            globals.incidentsCur = (unsigned int)fault_ring_wrap(
+                globals.incidentsCur + 1, FAULT_INCIDENT_MAX + 1);
+            if (globals.incidentsLen < FAULT_INCIDENT_MAX){
+                globals.incidentsLen = globals.incidentsLen + 1;
+            }
+            inc = &globals.incidents[globals.incidentsCur];
+        }
+        memset(inc, 0, sizeof(FaultIncidentRecord));
+        inc->start = now;
+        globals.incidentsOpen = true;
+    }
+
+    inc->end = now;
+
+    unsigned long bit = 1UL << (fid % FAULT_DIRTY_BITS);
+    unsigned long *word = &inc->members[fid / FAULT_DIRTY_BITS];
+    if ((*word & bit) == 0){
+        *word |= bit;
+        inc->ids = inc->ids + 1;
+    }
+
+    fault_module mod = globals.config[fid].module;
+    bit = 1UL << (mod % FAULT_DIRTY_BITS);
+    word = &inc->modules[mod / FAULT_DIRTY_BITS];
+    if ((*word & bit) == 0){
+        *word |= bit;
+        inc->modulesLen = inc->modulesLen + 1;
+    }
+#else
+    (void)fid;
+    (void)now;
+#endif
+}/* fault_incident_add */
+
+/* Add 'n' samples of the reference value to the statistics of the id */
+static
+void fault_refstats_add(fault_id fid, long ref, bool condition, fault_counter n)
+{
+#if FAULT_REFSTATS_MAX > 0
+    unsigned int slot = globals.refstatsSlot[fid];
+
+    if (slot == 0){
+        return;
+    }
+
+    FaultRefStatsRecord *r = &globals.refstats[slot - 1];
+
+    if (r->count == 0 || ref < r->min){
+        r->min = ref;
+    }
+    if (r->count == 0 || ref > r->max){
+        r->max = ref;
+    }
+
+    /* Welford, the n equal samples merged at once */
+    double before = (double)r->count;
+    r->count = r->count + n;
+    double delta = (double)ref - r->mean;
+    double w = (double)n / (double)r->count;
+    r->mean = r->mean + delta * w;
+    r->m2 = r->m2 + delta * delta * before * w;
+
+    if (condition){
+        r->faults = r->faults + n;
+    }
+    r->buckets[fault_refstats_bucket(ref, r->shift)] += n;
+#else
+    (void)fid;
+    (void)ref;
+    (void)condition;
+    (void)n;
+#endif
+}/* fault_refstats_add */
+
+/* Count 'n' faults of the id in the heavy hitters sketch.
+ * Constant time for n = 1, the buckets in between are visited for n > 1.
+ */
+static
+void fault_topk_add(fault_id fid, unsigned long n)
+{
+#if FAULT_TOPK_MAX > 0
+    unsigned int e = globals.topSlot[fid];
+    unsigned long count;
+
+    if (e > 0){
+        e = e - 1;
+        count = globals.topBuckets[globals.topSlots[e].bucket].count + n;
+    } else if (globals.topSlotsLen < FAULT_TOPK_MAX){
+        /* a free slot */
+        e = globals.topSlotsLen++;
+        globals.topSlots[e].id = fid;
+        globals.topSlots[e].error = 0;
+        globals.topSlot[fid] = (unsigned short)(e + 1);
+        fault_topk_attach(e, n, FAULT_TOPK_NIL);
+        return;
+    } else {
+        /* replace an id with the lowest count */
+        e = globals.topBuckets[globals.topMin].first;
+        unsigned long min = globals.topBuckets[globals.topMin].count;
+
+        globals.topSlot[globals.topSlots[e].id] = 0;
+        globals.topSlots[e].id = fid;
+        globals.topSlots[e].error = min;
+        globals.topSlot[fid] = (unsigned short)(e + 1);
+        count = min + n;
+    }
+
+    unsigned int b = globals.topSlots[e].bucket;
+    FaultTopKBucket *bucket = &globals.topBuckets[b];
+    bool alone = (bucket->first == e && globals.topSlots[e].next == FAULT_TOPK_NIL);
+
+    if (alone && (bucket->next == FAULT_TOPK_NIL ||
+                  globals.topBuckets[bucket->next].count > count)){
+        /* still in order */
+        bucket->count = count;
+        return;
+    }
+
+    unsigned int after = alone ? bucket->prev : b;
+    fault_topk_detach(e);
+    fault_topk_attach(e, count, after);
+#else
+    (void)fid;
+    (void)n;
+#endif
+}/* fault_topk_add */
+
+size_t fault_top_k(FaultTopK *out, size_t k)
+{
+    size_t n = 0;
+
+#if FAULT_TOPK_MAX > 0
+    for (unsigned int b = globals.topMax; b != FAULT_TOPK_NIL && n < k;
+         b = globals.topBuckets[b].prev){
+        for (unsigned int e = globals.topBuckets[b].first;
+             e != FAULT_TOPK_NIL && n < k;
+             e = globals.topSlots[e].next){
+            out[n].id = globals.topSlots[e].id;
+            out[n].count = globals.topBuckets[b].count;
+            out[n].error = globals.topSlots[e].error;
+            n++;
+        }
+    }/* for buckets */
+#else
+    (void)out;
+    (void)k;
+#endif
+
+    return n;
+}/* fault_top_k */
+
+#if FAULT_INVALID_WIDTH > 0
+/* Column of the id in a row of the sketch */
+static
+size_t fault_invalid_col(fault_id id, int row)
+{
+    unsigned long long h = ((unsigned long long)id + 1) * invalidSeeds[row];
+
+    return (size_t)((h >> 32) % FAULT_INVALID_WIDTH);
+}/* fault_invalid_col */
+#endif
+
+/* Count 'n' events of the wrong 'id', in constant time */
+static
+void fault_invalid_add(fault_id id, unsigned long n)
+{
+#if FAULT_INVALID_WIDTH > 0
+    unsigned long est = ULONG_MAX;
+
+    for (int r = 0; r < FAULT_INVALID_DEPTH; r++){
+        unsigned long *c = &globals.invalid[r][fault_invalid_col(id, r)];
+        *c = (*c > ULONG_MAX - n) ? ULONG_MAX : *c + n;
+        if (*c < est){
+            est = *c;
+        }
+    }
 
-        /* cannot fail */
-        fault_policy_none(id);
-    }/* for config */
+    /* the ids in the top table are counted exactly */
+    size_t low = 0;
+    for (size_t i = 0; i < globals.invalidTopLen; i++){
+        FaultInvalidId *top = &globals.invalidTop[i];
+        if (top->id == id){
+            top->count = (top->count > ULONG_MAX - n) ? ULONG_MAX : top->count + n;
+            return;
+        }
+        if (top->count < globals.invalidTop[low].count){
+            low = i;
+        }
+    }
 
-    globals.configLen = globals.configLen + (fault_id)ncodes;
+    /* the lowest is replaced, the events before are estimated */
+    if (globals.invalidTopLen < FAULT_INVALID_TOP){
+        low = globals.invalidTopLen++;
+    } else if (globals.invalidTop[low].count >= est){
+        return;
+    }
 
-    return module;
-}/* fault_conf_module */
+    globals.invalidTop[low].id = id;
+    globals.invalidTop[low].count = est;
+    globals.invalidTop[low].error = (est > n) ? est - n : 0;
+#else
+    (void)id;
+    (void)n;
+#endif
+}/* fault_invalid_add */
 
-bool fault_policy_none(fault_id id)
+size_t fault_invalid_ids(FaultInvalidId *out, size_t max)
 {
-    if (!fault_id_valid(id)){
-        return false;
-    }
+    size_t n = 0;
 
-    memset(&globals.config[id].policy, 0, sizeof(FaultPolicy));
-    globals.config[id].policy.type = FAULT_POL_NONE;
+#if FAULT_INVALID_WIDTH > 0
+    /* insertion sort of the best 'max' */
+    for (size_t i = 0; i < globals.invalidTopLen; i++){
+        FaultInvalidId v = globals.invalidTop[i];
+        size_t j = (n < max) ? n++ : n;
 
-    return fault_reset(id);
-}/* fault_policy_none */
+        while (j > 0 && out[j-1].count < v.count){
+            if (j < max){
+                out[j] = out[j-1];
+            }
+            j--;
+        }
+        if (j < max){
+            out[j] = v;
+        }
+    }/* for top */
+#else
+    (void)out;
+    (void)max;
+#endif
 
-fault_id fault_getid(fault_module mod, fault_code code)
-{
-    if (mod >= globals.modulesLen){
-        return FAULT_GENERIC_UNKNOWN;
-    }
+    return n;
+}/* fault_invalid_ids */
 
-    if (code >= globals.modules[mod].numCodes){
-        return FAULT_GENERIC_UNKNOWN;
+unsigned long fault_invalid_count(fault_id id)
+{
+    if (id < globals.configLen){
+        return 0;
     }
 
-    return (fault_id)(globals.modules[mod].confOffset + code);
-}/* fault_getid */
+#if FAULT_INVALID_WIDTH > 0
+    unsigned long est = ULONG_MAX;
 
-fault_status_type fault_status(fault_id id)
-{
-    if (id >= globals.configLen){
-        return FAULT_ST_ERROR;
+    for (int r = 0; r < FAULT_INVALID_DEPTH; r++){
+        unsigned long c = globals.invalid[r][fault_invalid_col(id, r)];
+        if (c < est){
+            est = c;
+        }
     }
 
-    return globals.records[id].status;
-}/* fault_status_type */
+    return est;
+#else
+    return 0;
+#endif
+}/* fault_invalid_count */
 
-fault_status_module_type fault_status_module(fault_module mod)
+/* Body of fault_update().
+ * fid: the record to update, valid.
+ * id: the identifier given by the user.
+ */
+static
+bool fault_update_record(fault_id fid, fault_id id, long ref, bool condition)
 {
-    if (mod >= globals.modulesLen){
-        return FAULT_SM_FAILED;
-    }
+    assert(fault_id_valid(fid));
 
-    assert(globals.modules[mod].module == mod);
+    /* a single timestamp for the whole update */
+    fault_millisecs now = fault_time();
 
-    fault_counter n = globals.modules[mod].numCodes;
-    fault_id o = globals.modules[mod].confOffset;
-    fault_counter t = globals.modules[mod].tolerance;
-    fault_id end = (fault_id)(o + n);
+    FAULT_PROBE3(update__entry, id, ref, condition);
 
-    assert(end <= globals.configLen);
+    if (globals.updateHook != NULL){
+        globals.updateHook(now, id, ref, condition, 1,
+                           globals.updateHookCtx);
+    }
 
-    fault_status_module_type s = FAULT_SM_NORMAL;
-    fault_counter e = 0;
+    fault_reconf_sync(now);
 
-    /* NORMAL <= all NORMAL
-     * WARNING <= exists a warning and not exists an error
-     * FAULTED <= (0 < #errors <= tolerance)
-     * FAILED <= (#errors > tolerance)
-     */
-    for (fault_id i = o; i < end; i++){
-        switch (globals.records[i].status){
-        case FAULT_ST_NORMAL:
-            /* empty */
-            break;
-        case FAULT_ST_WARNING:
-            /* warning has low priority */
-            if (s == FAULT_SM_NORMAL){ /* not warn, not err */
-                s = FAULT_SM_WARNING; /* can change to fault, failed */
-            }
-            break;
-        case FAULT_ST_ERROR:
-            e++;
-            break;
-        default: /* should not happen */
-            s = FAULT_SM_FAILED;
-            break;
-        }/* switch record status */
-    }/* for record */
+    FAULT_STAT_ADD(updates, 1);
+    if (condition && globals.records[fid].errors == 0){
+        fault_incident_add(fid, now);
+    }
+    fault_record_events(fid,
+        fault_record_count(&globals.policies[globals.policyCur][fid],
+                           &globals.records[fid], now, ref, condition));
+    fault_refstats_add(fid, ref, condition, 1);
+    if (condition){
+        fault_topk_add(fid, 1);
+        fault_history_add(fid, now, ref);
+    }
+    globals.beatLast[fid] = (uint32_t)now;
+    globals.beatLevel[fid] = FAULT_ST_NORMAL;
 
-    if (0 < e && e <= t){
-        s = FAULT_SM_FAULTED;
-    } else if (e > t){
-        s = FAULT_SM_FAILED;
-    } /* else remains NORMAL or WARNING */
+    if (globals.lazy){
+        globals.dirty[fid / FAULT_DIRTY_BITS] |= 1UL << (fid % FAULT_DIRTY_BITS);
+    } else {
+        fault_record_eval(fid, now);
+    }
 
-    return s;
-}/* fault_status_module_type */
+    FAULT_PROBE4(update__exit, fid, globals.config[fid].module,
+                 globals.config[fid].code, globals.status[fid]);
 
+    return condition;
+}/* fault_update_record */
 
 bool fault_update(fault_id id, long ref, bool condition)
 {
@@ -433,53 +2786,77 @@ bool fault_update(fault_id id, long ref, bool condition)
 
     if (id >= globals.configLen){
         fid = fault_getid(FAULT_GENERIC_MODULE, FAULT_GENERIC_UNKNOWN);
+        FAULT_STAT_ADD(unknown, 1);
+        fault_invalid_add(id, 1);
     }
 
-    assert(globals.records[fid].id == fid);
-    fault_millisecs now = fault_now();
+    return fault_update_record(fid, id, ref, condition);
+}/* fault_update */
+
+/* Body of fault_update_clear_n() and fault_update_fault_n() */
+static
+bool fault_update_record_n(fault_id id,
+                           long ref,
+                           bool condition,
+                           fault_counter n)
+{
+    fault_id fid = id;
 
-    fault_counter totPrev = globals.records[fid].total;
-    fault_counter one = 1;
-    fault_counter total = 0;
+    if (n == 0){
+        return condition;
+    }
 
-    /* records[fid].total += 1; */
-    if (__builtin_add_overflow(totPrev, one, &total)){
-        /* the other values are less or equal to total */
-        fault_reset(id);
-        globals.records[fid].total += 1;
+    if (id >= globals.configLen){
+        fid = fault_getid(FAULT_GENERIC_MODULE, FAULT_GENERIC_UNKNOWN);
+        FAULT_STAT_ADD(unknown, n);
+        fault_invalid_add(id, n);
     }
 
+    fault_millisecs now = fault_time();
+
+    if (globals.updateHook != NULL){
+        globals.updateHook(now, id, ref, condition, n, globals.updateHookCtx);
+    }
+
+    fault_reconf_sync(now);
+    FAULT_STAT_ADD(updates, n);
+
+    if (condition && globals.records[fid].errors == 0){
+        fault_incident_add(fid, now);
+    }
+    fault_record_count_bulk(fid, now, ref, condition, n);
     if (condition){
-        if (globals.records[fid].errors == 0){
-            globals.records[fid].msFirst = now;
-        }
-        globals.records[fid].errors += 1;
-        globals.records[fid].msLast = now;
-        globals.records[fid].refValue = ref;
-        globals.records[fid].clear = 0; /* interupt the series */
+        /* fault_update_clear_n() has no reference value */
+        fault_refstats_add(fid, ref, condition, n);
+        fault_topk_add(fid, n);
+        fault_history_add(fid, now, ref);
+    }
+    globals.beatLast[fid] = (uint32_t)now;
+    globals.beatLevel[fid] = FAULT_ST_NORMAL;
+
+    if (globals.lazy){
+        globals.dirty[fid / FAULT_DIRTY_BITS] |= 1UL << (fid % FAULT_DIRTY_BITS);
     } else {
-        globals.records[fid].clear += 1;
+        fault_record_eval(fid, now);
     }
 
-    /* Must be done after updating the record.
-     * The policy can also reset the counters.
-     */
-    globals.records[fid].status = fault_policy_apply(fid);
+    return condition;
+}/* fault_update_record_n */
 
-    /* log */
-    FaultLog log = {
-        .saved = false,
-        .index = 0,
-        .timestamp = now,
-        .module = globals.config[fid].module,
-        .code = globals.config[fid].code,
-        .status = globals.records[fid].status,
-        .refValue = globals.records[fid].refValue
-    };
-    fault_log_enqueue(log);
+bool fault_update_clear_n(fault_id id, fault_counter n)
+{
+    return fault_update_record_n(id, 0, false, n);
+}/* fault_update_clear_n */
 
-    return condition;
-}/* fault_update */
+bool fault_update_fault_n(fault_id id, long ref, fault_counter n)
+{
+    return fault_update_record_n(id, ref, true, n);
+}/* fault_update_fault_n */
+
+bool fault_update_unchecked(fault_id id, long ref, bool condition)
+{
+    return fault_update_record(id, id, ref, condition);
+}/* fault_update_unchecked */
 
 fault_counter fault_count_errors(fault_id id)
 {
@@ -490,21 +2867,40 @@ fault_counter fault_count_errors(fault_id id)
     return globals.records[id].errors;
 }/* fault_count_errors */
 
+fault_counter fault_count_errors_unchecked(fault_id id)
+{
+    assert(fault_id_valid(id));
+
+    return globals.records[id].errors;
+}/* fault_count_errors_unchecked */
+
 bool fault_reset(fault_id id)
 {
     if (id >= globals.configLen){
         return false;
     }
 
-    assert(globals.records[id].id == id);
-
-    globals.records[id].errors = 0;
-    globals.records[id].total = 0;
-    globals.records[id].clear = 0;
-    globals.records[id].msFirst = 0;
-    globals.records[id].msLast = 0;
-    globals.records[id].status = FAULT_ST_NORMAL;
-    globals.records[id].refValue = 0;
+    fault_record_reset(&globals.records[id]);
+    fault_record_status(id, FAULT_ST_NORMAL);
+    memset(&globals.flaps[id], 0, sizeof(FaultFlapRecord));
+    globals.dirty[id / FAULT_DIRTY_BITS] &= ~(1UL << (id % FAULT_DIRTY_BITS));
+    /* the policy may be changed, see the fault_policy_*() */
+    fault_record_beat(id);
+    globals.beatLevel[id] = FAULT_ST_NORMAL;
+    globals.beatLast[id] = (uint32_t)fault_time();
+#if FAULT_HISTORY_MAX > 0
+    globals.historyRings[id].next = 0;
+    globals.historyRings[id].len = 0;
+#endif
+#if FAULT_REFSTATS_MAX > 0
+    unsigned int slot = globals.refstatsSlot[id];
+    if (slot > 0){
+        FaultRefStatsRecord *r = &globals.refstats[slot - 1];
+        unsigned int shift = r->shift;
+        memset(r, 0, sizeof(FaultRefStatsRecord));
+        r->shift = shift;
+    }
+#endif
 
     return true;
 }/* fault_reset */
@@ -515,35 +2911,31 @@ long fault_refval(fault_id id)
         return 0;
     }
 
-    assert(globals.records[id].id == id);
-
     return globals.records[id].refValue;
 }/* fault_refval */
 
+long fault_refval_unchecked(fault_id id)
+{
+    assert(fault_id_valid(id));
+
+    return globals.records[id].refValue;
+}/* fault_refval_unchecked */
+
 bool fault_policy_count_abs(fault_id id, fault_counter warn, fault_counter err)
 {
-    if (!fault_id_valid(id)){
-        return false;
-    }
+    FaultPolicy policy;
 
-    if (warn < 1){
+    if (!fault_id_valid(id)){
         return false;
     }
 
-    if (err < warn){
+    if (!fault_policy_make(&policy, FAULT_POL_COUNT_ABS, warn, err, 0)){
         return false;
     }
 
     /* input validated */
 
-    struct FaultPolicyCountAbs conf = {
-        .cntWarning = warn,
-        .cntError = err
-    };
-
-    memset(&globals.config[id].policy, 0, sizeof(FaultPolicy));
-    globals.config[id].policy.type = FAULT_POL_COUNT_ABS;
-    globals.config[id].policy.conf.countAbs = conf;
+    globals.policies[globals.policyCur][id] = policy;
 
     return fault_reset(id);
 }/* fault_policy_count_abs */
@@ -553,33 +2945,19 @@ bool fault_policy_count_reset(fault_id id,
                               fault_counter err,
                               fault_counter reset)
 {
-    if (!fault_id_valid(id)){
-        return false;
-    }
-
-    if (warn < 1){
-        return false;
-    }
+    FaultPolicy policy;
 
-    if (err < warn){
+    if (!fault_id_valid(id)){
         return false;
     }
 
-    if (reset < 1){
+    if (!fault_policy_make(&policy, FAULT_POL_COUNT_RESET, warn, err, reset)){
         return false;
     }
 
     /* input validated */
 
-    struct FaultPolicyCountReset conf = {
-        .cntWarning = warn,
-        .cntError = err,
-        .cntReset = reset
-    };
-
-    memset(&globals.config[id].policy, 0, sizeof(FaultPolicy));
-    globals.config[id].policy.type = FAULT_POL_COUNT_RESET;
-    globals.config[id].policy.conf.countReset = conf;
+    globals.policies[globals.policyCur][id] = policy;
 
     return fault_reset(id);
 }/* fault_policy_count_reset */
@@ -589,62 +2967,330 @@ bool fault_policy_time_reset(fault_id id,
                              fault_millisecs err,
                              fault_millisecs reset)
 {
+    FaultPolicy policy;
+
     if (!fault_id_valid(id)){
         return false;
     }
 
-    if (warn < 1){
+    if (!fault_policy_make(&policy, FAULT_POL_TIME_RESET, warn, err, reset)){
         return false;
     }
 
-    if (err < warn){
+    /* input validated */
+
+    globals.policies[globals.policyCur][id] = policy;
+
+    return fault_reset(id);
+}/* fault_policy_time_reset */
+
+bool fault_policy_heartbeat(fault_id id,
+                            fault_millisecs warn,
+                            fault_millisecs err)
+{
+    FaultPolicy policy;
+
+    if (!fault_id_valid(id)){
         return false;
     }
 
-    if (reset < 1){
+    if (!fault_policy_make(&policy, FAULT_POL_HEARTBEAT, warn, err, 0)){
         return false;
     }
 
     /* input validated */
 
-    struct FaultPolicyTimeReset conf = {
-        .msWarning = warn,
-        .msError = err,
-        .msReset = reset
-    };
-
-    memset(&globals.config[id].policy, 0, sizeof(FaultPolicy));
-    globals.config[id].policy.type = FAULT_POL_TIME_RESET;
-    globals.config[id].policy.conf.timeReset = conf;
+    globals.policies[globals.policyCur][id] = policy;
 
     return fault_reset(id);
-}/* fault_policy_time_reset */
+}/* fault_policy_heartbeat */
+
+size_t fault_check_stale(fault_millisecs now)
+{
+    int32_t level[FAULT_DIRTY_BITS];
+    uint32_t t = (uint32_t)now;
+    size_t changed = 0;
+
+    /* whole blocks, the ids over configLen have no heartbeat */
+    for (size_t base = 0; base < globals.configLen; base += FAULT_DIRTY_BITS){
+        const uint32_t *last = &globals.beatLast[base];
+        const int32_t *warn = &globals.beatWarn[base];
+        const int32_t *err = &globals.beatErr[base];
+        const int32_t *prev = &globals.beatLevel[base];
+        int32_t diff = 0;
+
+        /* without branches, to be vectorized */
+        for (size_t i = 0; i < FAULT_DIRTY_BITS; i++){
+            /* negative before the last update */
+            int32_t silence = (int32_t)(t - last[i]);
+            int32_t l = (int32_t)(silence >= warn[i]) +
+                        (int32_t)(silence >= err[i]);
+            l = (warn[i] > 0) ? l : 0;
+            /* only an update lowers it */
+            l = (l > prev[i]) ? l : prev[i];
+            level[i] = l;
+            diff |= l ^ prev[i];
+        }
+
+        if (diff == 0){
+            continue;
+        }
+
+        for (size_t i = 0; i < FAULT_DIRTY_BITS; i++){
+            if (level[i] == prev[i]){
+                continue;
+            }
+
+            fault_id fid = (fault_id)(base + i);
+            globals.beatLevel[fid] = level[i];
+            changed = changed + 1;
+
+            if (globals.lazy){
+                globals.dirty[fid / FAULT_DIRTY_BITS] |=
+                    1UL << (fid % FAULT_DIRTY_BITS);
+            } else {
+                fault_record_eval(fid, now);
+            }
+        }
+    }/* for blocks */
+
+    return changed;
+}/* fault_check_stale */
+
+bool fault_policy_range(fault_id first, fault_id n, const FaultPolicy *policy)
+{
+    if (first >= globals.configLen || n > globals.configLen - first){
+        return false;
+    }
+
+    /* input validated */
+
+    FaultPolicy *table = globals.policies[globals.policyCur];
+    for (fault_id id = first; id < first + n; id++){
+        table[id] = *policy;
+    }
+
+    /* as fault_record_beat(), once */
+    bool beat = (policy->type == FAULT_POL_HEARTBEAT);
+    int32_t warn = beat ? (int32_t)policy->conf.heartbeat.msWarning : 0;
+    int32_t err = beat ? (int32_t)policy->conf.heartbeat.msError : 0;
+    /* the silence starts now */
+    uint32_t now = beat ? (uint32_t)fault_time() : 0;
+    for (fault_id id = first; id < first + n; id++){
+        globals.beatWarn[id] = warn;
+        globals.beatErr[id] = err;
+        globals.beatLevel[id] = FAULT_ST_NORMAL;
+        globals.beatLast[id] = beat ? now : globals.beatLast[id];
+    }
+
+    return true;
+}/* fault_policy_range */
 
 void fault_logs_reset(void)
 {
     memset(globals.logs, 0, sizeof(globals.logs));
-    globals.logsFront = 0;
-    globals.logsLen = 0;
+    globals.logsSeq = 0;
+    globals.logsCursor.valid = false;
+
+    for (fault_module i = 0; i < FAULT_MODULE_MAX; i++){
+        globals.logsModules[i].front = 0;
+        globals.logsModules[i].len = 0;
+    }/* for rings */
+
+    globals.logsShared.front = 0;
+    globals.logsShared.len = 0;
+
+#if FAULT_LOG_COLD_BLOCKS > 0
+    globals.coldFront = 0;
+    globals.coldLen = 0;
+    globals.coldCount = 0;
+#endif
 }/* fault_logs_reset */
 
+/* Number of entries in the queues */
+static
+size_t fault_logs_hot_length(void)
+{
+    size_t len = globals.logsShared.len;
+
+    for (fault_module i = 0; i < FAULT_MODULE_MAX; i++){
+        len += globals.logsModules[i].len;
+    }/* for rings */
+
+    assert(len <= FAULT_LOG_MAX);
+    return len;
+}/* fault_logs_hot_length */
+
 size_t fault_logs_length(void)
 {
-    assert(globals.logsLen <= FAULT_LOG_MAX);
-    return globals.logsLen;
+    size_t len = fault_logs_hot_length();
+
+#if FAULT_LOG_COLD_BLOCKS > 0
+    len += globals.coldCount;
+#endif
+
+    return len;
 }/* fault_logs_length */
 
+/* The rings not empty, the shared one last.
+ * return the number of rings
+ */
+static
+size_t fault_log_rings(const FaultLogRing *rings[FAULT_MODULE_MAX + 1])
+{
+    size_t n = 0;
+
+    for (fault_module i = 0; i < FAULT_MODULE_MAX; i++){
+        if (globals.logsModules[i].len > 0){
+            rings[n] = &globals.logsModules[i];
+            n++;
+        }
+    }/* for rings */
+
+    if (globals.logsShared.len > 0){
+        rings[n] = &globals.logsShared;
+        n++;
+    }
+
+    return n;
+}/* fault_log_rings */
+
+/* Log in the queues at position 'index', 0 is the most recent */
+static
+FaultLog fault_log_hot(size_t index)
+{
+    FaultLog out = {0};
+    out.saved = false;
+
+    const FaultLogRing *rings[FAULT_MODULE_MAX + 1];
+    size_t n = fault_log_rings(rings);
+
+    if (n == 1){
+        /* single ring, direct access */
+        if (index < rings[0]->len){
+            out = *fault_log_ring_at(rings[0], index);
+            out.index = index;
+        }
+        return out;
+    }
+
+    /* Merge the rings from the most recent entry (higher sequence),
+     * from the position of the previous call when the logs are the same.
+     */
+    FaultLogCursor *cur = &globals.logsCursor;
+    if (!cur->valid || cur->seq != globals.logsSeq){
+        memset(cur->taken, 0, sizeof(cur->taken));
+        cur->index = 0;
+        cur->seq = globals.logsSeq;
+        cur->valid = true;
+    }
+
+    /* back: the last consumed is the oldest of the consumed ones */
+    while (cur->index > index){
+        const FaultLog *log = NULL;
+        size_t best = n;
+
+        for (size_t r = 0; r < n; r++){
+            if (cur->taken[r] == 0){
+                continue;
+            }
+
+            const FaultLog *l = fault_log_ring_at(rings[r], cur->taken[r] - 1);
+            if (log == NULL || l->index < log->index){
+                log = l;
+                best = r;
+            }
+        }/* for rings */
+
+        cur->taken[best]--;
+        cur->index--;
+    }/* while back */
+
+    /* forward: the most recent not consumed is at cur->index */
+    for (;;){
+        const FaultLog *log = NULL;
+        size_t best = n;
+
+        for (size_t r = 0; r < n; r++){
+            if (cur->taken[r] == rings[r]->len){
+                continue;
+            }
+
+            const FaultLog *l = fault_log_ring_at(rings[r], cur->taken[r]);
+            if (log == NULL || l->index > log->index){
+                log = l;
+                best = r;
+            }
+        }/* for rings */
+
+        if (log == NULL){
+            /* index out of range */
+            return out;
+        }
+
+        if (cur->index == index){
+            out = *log;
+            out.index = index;
+            return out;
+        }
+
+        cur->taken[best]++;
+        cur->index++;
+    }/* for forward */
+}/* fault_log_hot */
+
 FaultLog fault_log(size_t index)
 {
+    size_t hot = fault_logs_hot_length();
+
+    if (index < hot){
+        return fault_log_hot(index);
+    }
+
     FaultLog out = {0};
     out.saved = false;
 
-    if (index < globals.logsLen){
-        /* reverse order, 0 is the last inserted log */
-        size_t rev = globals.logsLen - index - 1;
-        size_t i = (globals.logsFront + rev) % FAULT_LOG_MAX;
-        out = globals.logs[i];
+#if FAULT_LOG_COLD_BLOCKS > 0
+    if (index - hot < globals.coldCount){
+        out = fault_log_cold_at(index - hot);
         out.index = index;
     }
+#endif
 
     return out;
 }/* fault_log */
+
+size_t fault_logs_query(const FaultLogFilter *filter,
+                        FaultLogSpan *out,
+                        size_t max)
+{
+    FaultLogFilter all = {0};
+    size_t n = 0;
+
+    if (out == NULL){
+        return 0;
+    }
+
+    if (filter == NULL){
+        filter = &all;
+    }
+
+    if (filter->fields & FAULT_LF_MODULE){
+        /* only the queue of the module */
+        return fault_log_ring_query(fault_log_ring(filter->module),
+                                    filter, out, n, max);
+    }
+
+    for (fault_module i = 0; i < FAULT_MODULE_MAX; i++){
+        if (globals.logsModules[i].len > 0){
+            n = fault_log_ring_query(&globals.logsModules[i],
+                                     filter, out, n, max);
+        }
+    }/* for rings */
+
+    if (globals.logsShared.len > 0){
+        n = fault_log_ring_query(&globals.logsShared, filter, out, n, max);
+    }
+
+    return n;
+}/* fault_logs_query */
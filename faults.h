@@ -3,6 +3,10 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /*
  * Faults Module - An errors collector.
  *
@@ -17,8 +21,51 @@
  *                Default: 128
  * FAULT_MODULE_MAX max number of configurable fault_module.
  *                Default: 16
- * FAULT_LOG_MAX a positive value for the logs queue dimension.
+ * FAULT_LOG_MAX a positive value for the logs pool dimension.
+ *                It is shared among the log queues of the modules.
+ *                Default: 1
+ * FAULT_LOG_COLD_BLOCKS number of blocks for the compressed logs history,
+ *                0 to disable it.
+ *                Default: 0
+ * FAULT_LOG_COLD_BLOCK_SIZE bytes in a block of the compressed history,
+ *                at least 48 (an entry in the worst case).
+ *                Default: 256
+ * FAULT_STATS 0 to remove the statistics counters, see fault_stats().
  *                Default: 1
+ * FAULT_USDT 1 to add the USDT static tracepoints (requires sys/sdt.h),
+ *                provider "faults", see tools/ for the bpftrace scripts.
+ *                Default: 0
+ * FAULT_INHIBIT_MAX max number of parents of the inhibitions,
+ *                see fault_inhibit(), at most 32.
+ *                Default: 16
+ * FAULT_TOPK_MAX number of ids tracked by the heavy hitters sketch,
+ *                0 to disable it, see fault_top_k().
+ *                Default: 0
+ * FAULT_INVALID_WIDTH counters in a row of the count-min sketch of the
+ *                wrong ids, 0 to disable it, see fault_invalid_ids().
+ *                Default: 0
+ * FAULT_INVALID_DEPTH rows of the count-min sketch (hash functions).
+ *                Default: 4
+ * FAULT_INVALID_TOP wrong ids listed by fault_invalid_ids().
+ *                Default: 8
+ * FAULT_HISTORY_MAX samples in the pool of the reference values history,
+ *                0 to disable it, see fault_conf_history().
+ *                Default: 0
+ * FAULT_REFSTATS_MAX ids with the statistics of the reference values,
+ *                0 to disable them, see fault_conf_refstats().
+ *                Default: 0
+ * FAULT_INCIDENT_MAX incidents (bursts of faults) kept,
+ *                0 to disable them, see fault_conf_incidents().
+ *                Default: 0
+ * FAULT_REALTIME 1 for a bounded execution time of the fault_update*():
+ *                the policies are evaluated without branches and the
+ *                compressed history is not available (it encodes a whole
+ *                block at once). See wcet.c to measure the worst case.
+ *                Default: 0
+ * FAULT_COMPACT 1 for smaller counters records (24 bytes): 32 bits counters
+ *                and reference values (saturated), 32 bits timestamps
+ *                (the intervals must be less than 2^32 ms).
+ *                Default: 0
  */
 
 /* COMPILATION FLAGS */
@@ -34,6 +81,62 @@
 #define FAULT_LOG_MAX     1
 #endif
 
+#ifndef FAULT_LOG_COLD_BLOCKS
+#define FAULT_LOG_COLD_BLOCKS 0
+#endif
+
+#ifndef FAULT_LOG_COLD_BLOCK_SIZE
+#define FAULT_LOG_COLD_BLOCK_SIZE 256
+#endif
+
+#ifndef FAULT_COMPACT
+#define FAULT_COMPACT 0
+#endif
+
+#ifndef FAULT_STATS
+#define FAULT_STATS 1
+#endif
+
+#ifndef FAULT_USDT
+#define FAULT_USDT 0
+#endif
+
+#ifndef FAULT_HISTORY_MAX
+#define FAULT_HISTORY_MAX 0
+#endif
+
+#ifndef FAULT_REFSTATS_MAX
+#define FAULT_REFSTATS_MAX 0
+#endif
+
+#ifndef FAULT_INCIDENT_MAX
+#define FAULT_INCIDENT_MAX 0
+#endif
+
+#ifndef FAULT_REALTIME
+#define FAULT_REALTIME 0
+#endif
+
+#ifndef FAULT_INHIBIT_MAX
+#define FAULT_INHIBIT_MAX 16
+#endif
+
+#ifndef FAULT_TOPK_MAX
+#define FAULT_TOPK_MAX 0
+#endif
+
+#ifndef FAULT_INVALID_WIDTH
+#define FAULT_INVALID_WIDTH 0
+#endif
+
+#ifndef FAULT_INVALID_DEPTH
+#define FAULT_INVALID_DEPTH 4
+#endif
+
+#ifndef FAULT_INVALID_TOP
+#define FAULT_INVALID_TOP 8
+#endif
+
 /* DO NOT CHANGE THE FOLLOWING VALUES */
 #define FAULT_MODULE_KO      INT_MAX
 #define FAULT_NO_FAILURE     0
@@ -72,6 +175,11 @@ enum FaultPolicyType {
      * events is stable for more than N milliseconds.
      */
     FAULT_POL_TIME_RESET,
+
+    /* Trigger when the id is not updated (faulty or not) for more than
+     * the milliseconds configured, see fault_check_stale().
+     */
+    FAULT_POL_HEARTBEAT,
     FAULT_POL_ALL  /* placeholder */
 };
 
@@ -108,6 +216,137 @@ struct FaultLog {
 
 typedef struct FaultLog FaultLog;
 
+/* Fields of FaultLogFilter to match, bitwise or */
+enum FaultLogFilterField {
+    FAULT_LF_MODULE = 1,
+    FAULT_LF_CODE = 2,
+    FAULT_LF_STATUS = 4,
+    FAULT_LF_TIME = 8
+};
+
+struct FaultLogFilter {
+    unsigned int fields; /* FaultLogFilterField to match, 0 for all */
+    fault_module module;
+    fault_code code;
+    fault_status_type status;
+    fault_millisecs from; /* inclusive */
+    fault_millisecs to;   /* inclusive */
+};
+
+typedef struct FaultLogFilter FaultLogFilter;
+
+/* Contiguous entries of a logs queue, from the oldest to the most recent.
+ * The 'index' of the entries is the sequence number of the log,
+ * increasing over all the queues.
+ */
+struct FaultLogSpan {
+    const FaultLog *logs;
+    size_t len;
+};
+
+typedef struct FaultLogSpan FaultLogSpan;
+
+/* Counters of the module activity, see fault_stats() */
+struct FaultStats {
+    unsigned long updates; /* events counted (by the fault_update*()) */
+    unsigned long unknown; /* events with a wrong id (FAULT_GENERIC_UNKNOWN) */
+    unsigned long overflows;    /* counters reset by a total overflow */
+    unsigned long policyResets; /* counters reset by the policies */
+    unsigned long logs;         /* log entries produced */
+    unsigned long logsEvicted;  /* oldest entries overwritten in full queues */
+    unsigned long logsDropped;  /* entries without a queue (no slots left) */
+    unsigned long logsInhibited; /* entries not produced, see fault_inhibit() */
+};
+
+typedef struct FaultStats FaultStats;
+
+/* Flap damping of an id, see fault_conf_damping().
+ * Every change of the status computed by the policy adds 'penalty',
+ * that decays exponentially: it halves every 'halfLife' milliseconds.
+ */
+struct FaultDamping {
+    unsigned long penalty;  /* added at every change, >0 */
+    unsigned long suppress; /* hold the status over this value */
+    unsigned long reuse;    /* release the status under this value */
+    fault_millisecs halfLife; /* >0 */
+};
+
+typedef struct FaultDamping FaultDamping;
+
+/* A fault of the history of an id, see fault_history() */
+struct FaultSample {
+    long refValue;
+    fault_millisecs timestamp;
+};
+
+typedef struct FaultSample FaultSample;
+
+/* Buckets of the reference values histogram, see FaultRefStats */
+#define FAULT_REFSTATS_BUCKETS 32
+
+/* Statistics of the reference values of an id, see fault_refstats().
+ * With v = ref / 2^shift (toward zero), the bucket 16 counts v = 0,
+ * the bucket 16 + k the v in [2^(k-1), 2^k) and the bucket 16 - k the v
+ * in (-2^k, -2^(k-1)]. The first and the last buckets have no bound.
+ */
+struct FaultRefStats {
+    unsigned long count;  /* samples, faulty or not */
+    unsigned long faults; /* samples with the condition true */
+    long min;
+    long max;
+    double mean;
+    double variance;      /* of the population */
+    unsigned long buckets[FAULT_REFSTATS_BUCKETS];
+};
+
+typedef struct FaultRefStats FaultRefStats;
+
+/* Faults started close in time, see fault_conf_incidents() */
+struct FaultIncident {
+    fault_millisecs start; /* first fault */
+    fault_millisecs end;   /* last fault */
+    size_t count;          /* ids faulted */
+    size_t modules;        /* modules of the ids */
+    bool open;             /* the current one, it can still grow */
+};
+
+typedef struct FaultIncident FaultIncident;
+
+/* Faults counted for an id, see fault_top_k() */
+struct FaultTopK {
+    fault_id id;
+    unsigned long count; /* faults since fault_init(), maybe overestimated */
+    unsigned long error; /* max overestimation of count */
+};
+
+typedef struct FaultTopK FaultTopK;
+
+/* Events received for a wrong id, see fault_invalid_ids() */
+struct FaultInvalidId {
+    fault_id id;         /* as given to fault_update() */
+    unsigned long count; /* never less than the true count */
+    unsigned long error; /* max overestimation of count, 0 if exact */
+};
+
+typedef struct FaultInvalidId FaultInvalidId;
+
+/* Procedure called for every new log entry, see fault_conf_logs_hook() */
+typedef void (*fault_log_hook)(const FaultLog *log, void *ctx);
+
+/* Procedure called at every fault_update(), see fault_conf_update_hook().
+ * n: identical updates, 1 for fault_update(), the count of the
+ *    fault_update_*_n()
+ */
+typedef void (*fault_update_hook)(fault_millisecs now,
+                                  fault_id id,
+                                  long ref,
+                                  bool condition,
+                                  fault_counter n,
+                                  void *ctx);
+
+/* Time source, see fault_now() */
+typedef fault_millisecs (*fault_clock)(void);
+
 /* External function that must be provided by the user.
  * It must return a monotonicaly increasing value representing
  * the time in milliseconds.
@@ -130,6 +369,224 @@ void fault_init(void);
  */
 fault_module fault_conf_module(fault_counter ncodes, fault_counter tolerance);
 
+/* Reserve a dedicated logs queue of 'capacity' entries to the module 'mod'.
+ * The entries are taken from the FAULT_LOG_MAX pool, the modules without
+ * a dedicated queue share what remains of it (possibly nothing).
+ * In this way a noisy module cannot erase the history of the others.
+ * It must be called at configuration time since it empties the logs.
+ * return false in case of error (wrong module, already reserved,
+ *        not enough space in the pool)
+ */
+bool fault_conf_module_logs(fault_module mod, size_t capacity);
+
+/* Enable the compressed history of the logs (cold tier).
+ * The entries removed from the logs queues are packed into
+ * FAULT_LOG_COLD_BLOCKS blocks, about 5 bytes each instead of
+ * sizeof(FaultLog). When all the blocks are full, the oldest one is dropped.
+ * fault_log() and fault_logs_length() include the cold entries after
+ * the ones in the queues, in the order they left the queues (not in time
+ * order across the modules with a dedicated queue, see fault_log()).
+ * It must be called at configuration time since it empties the logs.
+ * return false when FAULT_LOG_COLD_BLOCKS is 0 or with FAULT_REALTIME
+ */
+bool fault_conf_logs_cold(bool enable);
+
+/* Register a procedure called with every new log entry, before it is
+ * inserted in the logs queue (so even when the queue has no space).
+ * The 'index' of the entry is its sequence number.
+ * It runs inside fault_update(), so it must be fast and never block.
+ * hook: the procedure, NULL to remove it.
+ * ctx: user data passed back to the hook.
+ */
+void fault_conf_logs_hook(fault_log_hook hook, void *ctx);
+
+/* Register a procedure called at every fault_update(), with the input
+ * as given by the caller (even a wrong id) and the timestamp of the event.
+ * A fault_update_*_n() calls it once, with the count.
+ * It runs inside fault_update(), so it must be fast and never block.
+ * hook: the procedure, NULL to remove it.
+ * ctx: user data passed back to the hook.
+ */
+void fault_conf_update_hook(fault_update_hook hook, void *ctx);
+
+/* Replace fault_now() as the time source, for example to replay
+ * recorded events with their original timestamps.
+ * clock: the new source, NULL to use fault_now() again.
+ */
+void fault_conf_clock(fault_clock clock);
+
+/* Enable the lazy evaluation of the status.
+ * In lazy mode fault_update() only counts the event (the counters
+ * and the resets of the policy are updated as usual) and it does not log.
+ * The status of an updated id is evaluated, and logged once with the
+ * current timestamp, by fault_status(), fault_status_module() and
+ * fault_flush(). The resulting status is the same of the eager mode:
+ * for FAULT_POL_TIME_RESET, in both modes, the reset is checked only
+ * at the updates, not when the status is read.
+ * Disabling it flushes the pending ids. fault_init() disables it.
+ */
+void fault_conf_lazy(bool enable);
+
+/* Evaluate the status of all the ids updated in lazy mode,
+ * to be called before reading the logs.
+ * return the number of ids evaluated
+ */
+size_t fault_flush(void);
+
+/* Get a copy of the statistics counters, reset by fault_init().
+ * It can be called by another thread, the counters are read one by one.
+ * With FAULT_STATS=0 they are all zero.
+ */
+void fault_stats(FaultStats *out);
+
+/* Inhibit the faults of 'child' while 'parent' is in FAULT_ST_ERROR,
+ * for the cascaded faults (e.g. the sensors of a failed power supply).
+ * An inhibited child is updated as usual and keeps its status, but it
+ * produces no log entries and fault_status_module() ignores it.
+ * A parent can inhibit many children, a child can have many parents.
+ * The relations are removed by fault_init().
+ * return false in case of error (wrong ids, parent == child,
+ *        more than FAULT_INHIBIT_MAX parents)
+ */
+bool fault_inhibit(fault_id parent, fault_id child);
+
+/* Check if the faults of 'id' are inhibited by a parent in error.
+ * return false for a wrong id
+ */
+bool fault_inhibited(fault_id id);
+
+/* Configure the hysteresis of the recovery: the status becomes less
+ * severe only after 'recover' consecutive evaluations with a lower status,
+ * the more severe ones are immediate.
+ * It is kept by the fault_policy_*(), 0 to disable it (default).
+ * In lazy mode the evaluations are the readings, not the updates.
+ * return false for a wrong id
+ */
+bool fault_conf_hysteresis(fault_id id, fault_counter recover);
+
+/* Configure the flap damping of the id.
+ * When the penalty goes over 'suppress' the status is held: it can become
+ * more severe but not less, until the penalty decays under 'reuse'.
+ * The penalty is computed at the evaluations, so a held status is released
+ * only by the next evaluation.
+ * It is kept by the fault_policy_*(), NULL to disable it (default).
+ * return false in case of error (wrong id, penalty or halfLife 0,
+ *        reuse > suppress)
+ */
+bool fault_conf_damping(fault_id id, const FaultDamping *damping);
+
+/* Check if the status of the id is held by the flap damping.
+ * return false for a wrong id
+ */
+bool fault_damped(fault_id id);
+
+/* Keep the last 'len' faults (reference value and time) of the id,
+ * the samples are taken from the pool of FAULT_HISTORY_MAX.
+ * fault_reset() and the fault_policy_*() empty it, the resets done by
+ * the policies do not.
+ * return false in case of error (wrong id, len 0, already configured,
+ *        pool exhausted)
+ */
+bool fault_conf_history(fault_id id, size_t len);
+
+/* Copy the last 'max' samples of the history of the id in 'out',
+ * from the oldest fault. fault_update_fault_n() adds a single sample.
+ * return the number of samples written, 0 for a wrong id or no history
+ */
+size_t fault_history(fault_id id, FaultSample *out, size_t max);
+
+/* Keep the statistics of the reference values of every fault_update()
+ * of the id, faulty or not, in constant time: minimum, maximum, mean and
+ * variance (Welford) and a histogram with logarithmic buckets.
+ * fault_update_clear_n() has no reference value and adds no samples.
+ * fault_reset() and the fault_policy_*() clear them.
+ * shift: the reference values are divided by 2^shift for the histogram.
+ * return false in case of error (wrong id, already configured, more than
+ *        FAULT_REFSTATS_MAX ids, shift too big)
+ */
+bool fault_conf_refstats(fault_id id, unsigned int shift);
+
+/* Get the statistics of the reference values of the id.
+ * return false for a wrong id or not configured
+ */
+bool fault_refstats(fault_id id, FaultRefStats *out);
+
+/* Group the faults with a common cause in incidents.
+ * A fault starting a series (errors from 0 to 1, the msFirst of the
+ * record) within 'window' ms from the first fault of the current
+ * incident joins it, otherwise it starts a new incident.
+ * Only the incidents of at least 'minIds' ids are kept, the last
+ * FAULT_INCIDENT_MAX, each with the set of its ids and modules.
+ * It empties the incidents, fault_reset() and the fault_policy_*() do
+ * not change them.
+ * window: 0 to disable them (default).
+ * return false in case of error (FAULT_INCIDENT_MAX 0, minIds 0)
+ */
+bool fault_conf_incidents(fault_millisecs window, size_t minIds);
+
+/* Number of incidents kept, with the current one if it has minIds ids */
+size_t fault_incidents(void);
+
+/* Get the incident at position 'index', 0 for the most recent.
+ * return false if out of range
+ */
+bool fault_incident(size_t index, FaultIncident *out);
+
+/* Copy the ids of the incident at position 'index' in 'out',
+ * in increasing order.
+ * return the number of ids written, 0 if out of range
+ */
+size_t fault_incident_ids(size_t index, fault_id *out, size_t max);
+
+/* Check if the module has ids in the incident at position 'index'.
+ * return false if out of range
+ */
+bool fault_incident_module(size_t index, fault_module module);
+
+/* Number of incidents kept with both the ids, how often they co-occur */
+size_t fault_incidents_common(fault_id a, fault_id b);
+
+/* Get the ids with the most faults (condition true) since fault_init(),
+ * the policy resets and fault_reset() do not change them.
+ * The counts come from a space-saving sketch of FAULT_TOPK_MAX ids:
+ * an id counted more than 1/FAULT_TOPK_MAX of all the faults is always
+ * present, the count of an id that entered the sketch replacing another
+ * one is overestimated at most by 'error' (the true count is in
+ * [count - error, count]).
+ * out: the ids, from the highest count.
+ * k: the capacity of 'out'.
+ * return the number of ids written, 0 when FAULT_TOPK_MAX is 0
+ */
+size_t fault_top_k(FaultTopK *out, size_t k);
+
+/* Get the wrong ids received by fault_update*() with the most events,
+ * since fault_init(). The events are counted in FAULT_GENERIC_UNKNOWN
+ * as usual, and by original id in a count-min sketch of
+ * FAULT_INVALID_DEPTH x FAULT_INVALID_WIDTH counters.
+ * A table of the FAULT_INVALID_TOP worst ids counts them exactly since
+ * they entered it: an id enters when its estimate is higher than the
+ * lowest count of the table, with 'error' the estimate of its events
+ * before (0 for the ids that entered at their first event).
+ * The true count is in [count - error, count].
+ * out: the ids, from the highest count.
+ * max: the capacity of 'out'.
+ * return the number of ids written, 0 when FAULT_INVALID_WIDTH is 0
+ */
+size_t fault_invalid_ids(FaultInvalidId *out, size_t max);
+
+/* Get the estimated number of events received for the wrong 'id'.
+ * return 0 for a valid id or when FAULT_INVALID_WIDTH is 0
+ */
+unsigned long fault_invalid_count(fault_id id);
+
+/* Get the number of modules configured, the generic module included.
+ * The modules are numbered from 0 (FAULT_GENERIC_MODULE).
+ */
+fault_module fault_modules_length(void);
+
+/* Get the number of codes of the module, 0 for a wrong 'mod' */
+fault_counter fault_module_codes(fault_module mod);
+
 /* Convert the pair (module, code) into a fault identifier.
  * 'mod' must be the identifier created with fault_conf_module.
  * 'code' must be in the range set on configuration.
@@ -211,6 +668,71 @@ bool fault_policy_time_reset(fault_id id,
                              fault_millisecs err,
                              fault_millisecs reset);
 
+/* Configure the fault policy to FAULT_POL_HEARTBEAT.
+ * The id must be updated periodically, the condition is counted but it
+ * does not change the status: fault_check_stale() sets it to
+ * FAULT_ST_WARNING after 'warn' milliseconds without updates and to
+ * FAULT_ST_ERROR after 'err', the next update sets FAULT_ST_NORMAL.
+ *
+ * id: from fault_getid()
+ * warn: silence for the FAULT_ST_WARNING, must be positive >0
+ * err: silence for the FAULT_ST_ERROR, err >= warn, less than 2^31
+ * return false in case of error
+ */
+bool fault_policy_heartbeat(fault_id id,
+                            fault_millisecs warn,
+                            fault_millisecs err);
+
+/* Check the ids with FAULT_POL_HEARTBEAT not updated for too long,
+ * to be called periodically. The status changes are logged as in the
+ * fault_update(), in lazy mode the ids are only marked to be evaluated.
+ * A sweep of all the ids without branches: thousands of ids in a
+ * microsecond. The silences are in 32 bits, the checks must be less
+ * than 2^31 ms apart.
+ * now: the time, from the same source of the updates (see fault_now()
+ *      and fault_conf_clock())
+ * return the number of ids that changed the status
+ */
+size_t fault_check_stale(fault_millisecs now);
+
+/* Live reconfiguration of the policies, while another thread is doing
+ * the fault_update*(). The new policies are written in a copy of the table,
+ * published by fault_reconf_commit() with an atomic swap: the update thread
+ * switches to it at its next fault_update*() or fault_flush()
+ * (a quiescent point), without locks.
+ * The reconfiguration procedures must be called by a single thread, the
+ * fault_policy_*() must not be used while a reconfiguration is open.
+ * The modules, the hysteresis and the damping cannot be changed in this way.
+ *
+ * Open a reconfiguration, with a copy of the current policies.
+ * return false when one is already open, or when the update thread is
+ *        still using the table of the previous commit (retry later)
+ */
+bool fault_reconf_begin(void);
+
+/* Change the policy of an id in the open reconfiguration,
+ * the arguments are the ones of the fault_policy_*() for the 'type'
+ * (reset is ignored by FAULT_POL_COUNT_ABS and FAULT_POL_HEARTBEAT,
+ * all by FAULT_POL_NONE).
+ * return false in case of error (no reconfiguration open, wrong id,
+ *        wrong thresholds)
+ */
+bool fault_reconf_policy(fault_id id,
+                         fault_policy_type type,
+                         unsigned long warn,
+                         unsigned long err,
+                         unsigned long reset);
+
+/* Publish the open reconfiguration.
+ * keepCounters: true to evaluate the status of the changed ids with their
+ *               current counters, false to reset them as fault_policy_*().
+ * return false when no reconfiguration is open
+ */
+bool fault_reconf_commit(bool keepCounters);
+
+/* Discard the open reconfiguration */
+void fault_reconf_abort(void);
+
 /* Update the internal database of faults.
  * id: the fault reference from fault_getid()
  * ref: a reference value for future inspections
@@ -221,6 +743,37 @@ bool fault_policy_time_reset(fault_id id,
  */
 bool fault_update(fault_id id, long ref, bool condition);
 
+/* As 'n' calls to fault_update(id, 0, false), in constant time.
+ * The counters, the resets of the policy and the status are the same,
+ * but a single log entry is produced (with the final status) and there
+ * is no reference value for fault_conf_refstats().
+ * The update hook is called once, with 'n'.
+ * return false
+ */
+bool fault_update_clear_n(fault_id id, fault_counter n);
+
+/* As 'n' calls to fault_update(id, ref, true), in constant time.
+ * See fault_update_clear_n().
+ * return true
+ */
+bool fault_update_fault_n(fault_id id, long ref, fault_counter n);
+
+/* As fault_update(), but 'id' must be valid: returned by fault_getid()
+ * for a configured module and code. The range is only asserted.
+ * It is meant for wrappers that validate the ids once at configuration time
+ * (see faults.hpp).
+ */
+bool fault_update_unchecked(fault_id id, long ref, bool condition);
+
+/* As fault_status(), 'id' must be valid */
+fault_status_type fault_status_unchecked(fault_id id);
+
+/* As fault_count_errors(), 'id' must be valid */
+fault_counter fault_count_errors_unchecked(fault_id id);
+
+/* As fault_refval(), 'id' must be valid */
+long fault_refval_unchecked(fault_id id);
+
 /* Get the number of fault registered in the database.
  * The number depends on the policy, since it can reset it.
  * id: the fault reference from fault_getid()
@@ -248,18 +801,49 @@ long fault_refval(fault_id id);
 /* Empty the logs queue */
 void fault_logs_reset(void);
 
-/* Get the number of logs stored in the logs queue.
- * return a value less or equals to FAULT_LOG_MAX
+/* Get the number of logs stored in all the logs queues and, with
+ * fault_conf_logs_cold(), in the cold tier.
+ * return a value less or equals to FAULT_LOG_MAX for the queues plus
+ *        the cold entries, as many as fit in FAULT_LOG_COLD_BLOCKS blocks
  */
 size_t fault_logs_length(void);
 
 /* Get the log in the queue (history) at position 'index'.
+ * The queues of all the modules are merged in time order, the position
+ * of the merge is kept: a walk by consecutive indexes, in any direction,
+ * costs a step for each entry.
+ * The cold entries (fault_conf_logs_cold()) follow the queues, from the
+ * last one that left a queue: the order is not chronological across the
+ * two tiers and, with fault_conf_module_logs(), across the modules (an
+ * entry of a busy module can leave its queue before an older one of
+ * another module).
  * index: the relative position of the log to retrieve.
- *        0 is the most recent,
- *        fault_logs_length()-1 is the oldest.
+ *        0 is the most recent in the queues,
+ *        fault_logs_length()-1 is the oldest in the cold tier.
  *
  * return: a copy of the log entry with the attribute 'saved' at true
  *         or a invalid structure with 'saved' at false when the index
  *         is out of range.
  */
 FaultLog fault_log(size_t index);
+
+/* Search the logs queues for the entries matching 'filter'.
+ * filter: the fields to match, NULL for all the entries.
+ * out: the spans found, pointing directly into the queues.
+ * max: the capacity of 'out'.
+ * return: the number of spans written in 'out'
+ *
+ * The time range is searched by bisection, since the queues are ordered
+ * by timestamp. The spans of a queue are from the oldest to the most recent,
+ * the spans of different queues are not merged: use the 'index' field to
+ * order them.
+ * The spans are valid until the next fault_update() or fault_logs_reset().
+ * The compressed history is not searched.
+ */
+size_t fault_logs_query(const FaultLogFilter *filter,
+                        FaultLogSpan *out,
+                        size_t max);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,215 @@
+#pragma once
+#include "faults.h"
+#include <concepts>
+#include <optional>
+#include <type_traits>
+
+/*
+ * Faults Module - C++20 interface.
+ *
+ * Header only, it shares the state of faults.c.
+ * The identifiers are validated once, when they are created by a Module,
+ * then the calls go to the *_unchecked() procedures without range checks.
+ * The identifiers are valid until the next fault_init().
+ *
+ * The codes of a module are an enumeration with the number of codes
+ * in the enumerator ALL (as the FaultGenericCode), or with a
+ * specialization of faults::CodeCount.
+ *
+ *     enum class Sensor { Pressure, Temperature, ALL };
+ *
+ *     auto sensors = faults::Module<Sensor>::configure(0);
+ *     faults::Id pres = sensors->id<Sensor::Pressure>();
+ *     pres.policy(faults::CountAbs{1, 2});
+ *     pres.update(pressure, pressure <= 0);
+ */
+
+namespace faults {
+
+enum class Status {
+    Normal = FAULT_ST_NORMAL,
+    Warning = FAULT_ST_WARNING,
+    Error = FAULT_ST_ERROR
+};
+
+enum class ModuleStatus {
+    Normal = FAULT_SM_NORMAL,
+    Warning = FAULT_SM_WARNING,
+    Faulted = FAULT_SM_FAULTED,
+    Failed = FAULT_SM_FAILED
+};
+
+/* Policies, see the fault_policy_*() */
+struct None {};
+
+struct CountAbs {
+    fault_counter warn;
+    fault_counter err;
+};
+
+struct CountReset {
+    fault_counter warn;
+    fault_counter err;
+    fault_counter reset;
+};
+
+struct TimeReset {
+    fault_millisecs warn;
+    fault_millisecs err;
+    fault_millisecs reset;
+};
+
+struct Heartbeat {
+    fault_millisecs warn;
+    fault_millisecs err;
+};
+
+/* Number of codes in the enumeration */
+template <typename EnumT>
+struct CodeCount {
+    static constexpr fault_counter value =
+        static_cast<fault_counter>(EnumT::ALL);
+};
+
+template <typename EnumT>
+concept CodeEnum = std::is_enum_v<EnumT> && requires {
+    { CodeCount<EnumT>::value } -> std::convertible_to<fault_counter>;
+};
+
+template <CodeEnum EnumT>
+class Module;
+
+/* A validated fault identifier */
+class Id {
+public:
+    fault_id raw() const noexcept { return id; }
+
+    bool update(long ref, bool condition) const noexcept
+    {
+        return fault_update_unchecked(id, ref, condition);
+    }
+
+    Status status() const noexcept
+    {
+        return static_cast<Status>(fault_status_unchecked(id));
+    }
+
+    fault_counter errors() const noexcept
+    {
+        return fault_count_errors_unchecked(id);
+    }
+
+    long refval() const noexcept
+    {
+        return fault_refval_unchecked(id);
+    }
+
+    void reset() const noexcept
+    {
+        fault_reset(id);
+    }
+
+    /* See fault_inhibit(), this is the parent */
+    bool inhibit(Id child) const noexcept
+    {
+        return fault_inhibit(id, child.id);
+    }
+
+    bool inhibited() const noexcept
+    {
+        return fault_inhibited(id);
+    }
+
+    bool policy(None) const noexcept
+    {
+        return fault_policy_none(id);
+    }
+
+    bool policy(const CountAbs &p) const noexcept
+    {
+        return fault_policy_count_abs(id, p.warn, p.err);
+    }
+
+    bool policy(const CountReset &p) const noexcept
+    {
+        return fault_policy_count_reset(id, p.warn, p.err, p.reset);
+    }
+
+    bool policy(const TimeReset &p) const noexcept
+    {
+        return fault_policy_time_reset(id, p.warn, p.err, p.reset);
+    }
+
+    bool policy(const Heartbeat &p) const noexcept
+    {
+        return fault_policy_heartbeat(id, p.warn, p.err);
+    }
+
+    friend bool operator==(Id a, Id b) noexcept = default;
+
+private:
+    template <CodeEnum EnumT>
+    friend class Module;
+
+    constexpr explicit Id(fault_id v) noexcept : id(v) {}
+
+    fault_id id;
+};
+
+/* A configured module, whose codes are the values of EnumT */
+template <CodeEnum EnumT>
+class Module {
+public:
+    static constexpr fault_counter codes = CodeCount<EnumT>::value;
+
+    /* Register the module, see fault_conf_module().
+     * return nothing in case of error
+     */
+    static std::optional<Module> configure(fault_counter tolerance) noexcept
+    {
+        fault_module m = fault_conf_module(codes, tolerance);
+        if (m == FAULT_MODULE_KO){
+            return std::nullopt;
+        }
+        return Module(m);
+    }
+
+    fault_module raw() const noexcept { return mod; }
+
+    /* The identifier of a code known at compile time */
+    template <EnumT code>
+    Id id() const noexcept
+    {
+        static_assert(static_cast<fault_counter>(code) < codes,
+                      "code out of the module range");
+        return Id(fault_getid(mod, static_cast<fault_code>(code)));
+    }
+
+    /* The identifier of a code, the range is checked once here */
+    std::optional<Id> id(EnumT code) const noexcept
+    {
+        auto c = static_cast<fault_counter>(code);
+        if (c >= codes){
+            return std::nullopt;
+        }
+        return Id(fault_getid(mod, static_cast<fault_code>(c)));
+    }
+
+    ModuleStatus status() const noexcept
+    {
+        return static_cast<ModuleStatus>(fault_status_module(mod));
+    }
+
+    /* See fault_conf_module_logs() */
+    bool logs(size_t capacity) const noexcept
+    {
+        return fault_conf_module_logs(mod, capacity);
+    }
+
+private:
+    constexpr explicit Module(fault_module m) noexcept : mod(m) {}
+
+    fault_module mod;
+};
+
+} /* namespace faults */
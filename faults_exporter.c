@@ -0,0 +1,641 @@
+/* Faults Exporter
+ *
+ * Two snapshots: the producer (the thread calling fault_update()) fills
+ * the one not published, the server renders the published one.
+ * The producer skips the publication when the server is still reading
+ * the snapshot it would overwrite.
+ *
+ * Author: Omar Rampado <omar@ognibit.it>
+ * Version: 1.0.x
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "faults_exporter.h"
+#include <assert.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* metrics without labels */
+#define FAULT_EXPORTER_VALUES 10
+/* width of the values: sign and digits of a long */
+#define FAULT_EXPORTER_WIDTH  20
+/* space before the body for the HTTP header */
+#define FAULT_EXPORTER_HEADER 128
+/* longest metric line with labels */
+#define FAULT_EXPORTER_LINE   96
+#define FAULT_EXPORTER_POLL_MS 100
+#define FAULT_EXPORTER_REQUEST 1024
+
+/* Values of a fault_id */
+struct FaultExporterRecord {
+    fault_status_type status;
+    fault_counter errors;
+    long refValue;
+};
+
+typedef struct FaultExporterRecord FaultExporterRecord;
+
+struct FaultExporterSnapshot {
+    fault_module modules;
+    fault_counter codes[FAULT_MODULE_MAX]; /* by module */
+    fault_status_module_type moduleStatus[FAULT_MODULE_MAX];
+    fault_id ids;
+    FaultExporterRecord records[FAULT_ID_MAX];
+    unsigned long values[FAULT_EXPORTER_VALUES];
+};
+
+typedef struct FaultExporterSnapshot FaultExporterSnapshot;
+
+/* The rendered text is kept between the scrapes, the values have a fixed
+ * width (blanks before them) so they are overwritten in place and only
+ * when they change. It is rebuilt when the modules change.
+ */
+struct FaultExporter {
+    FaultExporterSnapshot snap[2];
+    int published; /* snapshot to render, -1 for none */
+    int reading;   /* snapshot being rendered, -1 for none */
+    unsigned long snapshots;
+
+    /* response: header (right aligned) and body */
+    char buffer[FAULT_EXPORTER_HEADER + FAULT_EXPORTER_BUFFER];
+    size_t bodyLen; /* 0 for not rendered */
+
+    /* modules and codes of the rendered text */
+    fault_module modules;
+    fault_counter codes[FAULT_MODULE_MAX];
+    fault_id ids;
+
+    /* position of the values in the body */
+    uint32_t moduleAt[FAULT_MODULE_MAX];
+    uint32_t statusAt[FAULT_ID_MAX];
+    uint32_t errorsAt[FAULT_ID_MAX];
+    uint32_t refAt[FAULT_ID_MAX];
+    uint32_t valuesAt[FAULT_EXPORTER_VALUES];
+
+    /* values in the body */
+    FaultExporterRecord shown[FAULT_ID_MAX];
+
+    /* server thread */
+    pthread_t thread;
+    bool started;
+    bool running;
+    int fd;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+};
+
+static struct FaultExporter exporter = {
+    .published = -1,
+    .reading = -1,
+    .fd = -1
+};
+
+/* Metrics without labels, snapshot.values[] */
+enum FaultExporterValue {
+    FAULT_EXPORTER_LOGS,
+    FAULT_EXPORTER_UPDATES,
+    FAULT_EXPORTER_UNKNOWN,
+    FAULT_EXPORTER_OVERFLOWS,
+    FAULT_EXPORTER_POLICY_RESETS,
+    FAULT_EXPORTER_LOGS_TOTAL,
+    FAULT_EXPORTER_LOGS_EVICTED,
+    FAULT_EXPORTER_LOGS_DROPPED,
+    FAULT_EXPORTER_LOGS_INHIBITED,
+    FAULT_EXPORTER_SNAPSHOTS
+};
+
+static const char *const valueNames[FAULT_EXPORTER_VALUES][3] = {
+    {"faults_logs", "gauge", "Log entries stored"},
+    {"faults_updates_total", "counter", "Events counted"},
+    {"faults_unknown_total", "counter", "Events with a wrong id"},
+    {"faults_overflows_total", "counter", "Counters reset by overflow"},
+    {"faults_policy_resets_total", "counter", "Counters reset by the policies"},
+    {"faults_logs_total", "counter", "Log entries produced"},
+    {"faults_logs_evicted_total", "counter", "Log entries overwritten"},
+    {"faults_logs_dropped_total", "counter", "Log entries without a queue"},
+    {"faults_logs_inhibited_total", "counter", "Log entries inhibited"},
+    {"faults_exporter_snapshots_total", "counter", "Snapshots published"}
+};
+
+static const char digits2[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* PROCEDURES */
+
+/* Write the decimal digits of v, return the end */
+static
+char *fault_exporter_ulong(char *p, unsigned long v)
+{
+    char tmp[24];
+    char *t = tmp + sizeof(tmp);
+
+    while (v >= 100){
+        unsigned int i = (unsigned int)(v % 100) * 2;
+        v = v / 100;
+        *--t = digits2[i + 1];
+        *--t = digits2[i];
+    }
+
+    if (v >= 10){
+        unsigned int i = (unsigned int)v * 2;
+        *--t = digits2[i + 1];
+        *--t = digits2[i];
+    } else {
+        *--t = (char)('0' + v);
+    }
+
+    size_t n = (size_t)(tmp + sizeof(tmp) - t);
+    memcpy(p, t, n);
+
+    return p + n;
+}/* fault_exporter_ulong */
+
+static
+char *fault_exporter_long(char *p, long v)
+{
+    if (v < 0){
+        *p++ = '-';
+        return fault_exporter_ulong(p, 0UL - (unsigned long)v);
+    }
+
+    return fault_exporter_ulong(p, (unsigned long)v);
+}/* fault_exporter_long */
+
+static
+char *fault_exporter_text(char *p, const char *text)
+{
+    size_t n = strlen(text);
+    memcpy(p, text, n);
+
+    return p + n;
+}/* fault_exporter_text */
+
+/* Write the characters of 'text' up to 'end' right aligned in
+ * FAULT_EXPORTER_WIDTH: the blanks are between the labels and the value,
+ * a trailing text would be read as a timestamp.
+ */
+static
+void fault_exporter_pad(char *field, const char *text, const char *end)
+{
+    size_t n = (size_t)(end - text);
+
+    assert(n <= FAULT_EXPORTER_WIDTH);
+    memset(field, ' ', FAULT_EXPORTER_WIDTH - n);
+    memcpy(field + FAULT_EXPORTER_WIDTH - n, text, n);
+}/* fault_exporter_pad */
+
+static
+void fault_exporter_set_ulong(uint32_t at, unsigned long v)
+{
+    char tmp[FAULT_EXPORTER_WIDTH];
+    char *field = exporter.buffer + FAULT_EXPORTER_HEADER + at;
+    fault_exporter_pad(field, tmp, fault_exporter_ulong(tmp, v));
+}/* fault_exporter_set_ulong */
+
+static
+void fault_exporter_set_long(uint32_t at, long v)
+{
+    char tmp[FAULT_EXPORTER_WIDTH];
+    char *field = exporter.buffer + FAULT_EXPORTER_HEADER + at;
+    fault_exporter_pad(field, tmp, fault_exporter_long(tmp, v));
+}/* fault_exporter_set_long */
+
+/* A status is a single digit */
+static
+void fault_exporter_set_status(uint32_t at, int status)
+{
+    exporter.buffer[FAULT_EXPORTER_HEADER + at] = (char)('0' + status);
+}/* fault_exporter_set_status */
+
+/* Header of a metric family */
+static
+char *fault_exporter_family(char *p,
+                            const char *name,
+                            const char *type,
+                            const char *help)
+{
+    p = fault_exporter_text(p, "# HELP ");
+    p = fault_exporter_text(p, name);
+    *p++ = ' ';
+    p = fault_exporter_text(p, help);
+    p = fault_exporter_text(p, "\n# TYPE ");
+    p = fault_exporter_text(p, name);
+    *p++ = ' ';
+    p = fault_exporter_text(p, type);
+    *p++ = '\n';
+
+    return p;
+}/* fault_exporter_family */
+
+/* Lines of a family with the labels of the ids.
+ * at[id]: position of the value, written with 'width' blanks.
+ * return NULL if the buffer is too small
+ */
+static
+char *fault_exporter_lines(char *p,
+                           const char *end,
+                           const FaultExporterSnapshot *s,
+                           const char *name,
+                           uint32_t *at,
+                           size_t width)
+{
+    const char *body = exporter.buffer + FAULT_EXPORTER_HEADER;
+    fault_id id = 0;
+
+    for (fault_module m = 0; m < s->modules; m++){
+        for (fault_code c = 0; c < s->codes[m]; c++){
+            if (end - p < FAULT_EXPORTER_LINE){
+                return NULL;
+            }
+
+            p = fault_exporter_text(p, name);
+            p = fault_exporter_text(p, "{module=\"");
+            p = fault_exporter_ulong(p, m);
+            p = fault_exporter_text(p, "\",code=\"");
+            p = fault_exporter_ulong(p, c);
+            p = fault_exporter_text(p, "\"} ");
+            at[id] = (uint32_t)(p - body);
+            memset(p, ' ', width);
+            p += width;
+            *p++ = '\n';
+            id++;
+        }
+    }/* for modules */
+
+    assert(id == s->ids);
+
+    return p;
+}/* fault_exporter_lines */
+
+/* Write the text for the modules of the snapshot, with blank values.
+ * return false if the buffer is too small
+ */
+static
+bool fault_exporter_layout(const FaultExporterSnapshot *s)
+{
+    char *body = exporter.buffer + FAULT_EXPORTER_HEADER;
+    char *p = body;
+    const char *end = body + FAULT_EXPORTER_BUFFER;
+
+    exporter.bodyLen = 0;
+
+    /* families headers, modules and the values without labels */
+    size_t fixed = (size_t)(s->modules + FAULT_EXPORTER_VALUES + 8) *
+                   (FAULT_EXPORTER_LINE + 128);
+    if (FAULT_EXPORTER_BUFFER < fixed){
+        return false;
+    }
+    end -= fixed;
+
+    p = fault_exporter_family(p, "faults_module_status", "gauge",
+                              "0 normal, 1 warning, 2 faulted, 3 failed");
+    for (fault_module m = 0; m < s->modules; m++){
+        p = fault_exporter_text(p, "faults_module_status{module=\"");
+        p = fault_exporter_ulong(p, m);
+        p = fault_exporter_text(p, "\"} ");
+        exporter.moduleAt[m] = (uint32_t)(p - body);
+        *p++ = ' ';
+        *p++ = '\n';
+    }
+
+    p = fault_exporter_family(p, "faults_status", "gauge",
+                              "0 normal, 1 warning, 2 error");
+    p = fault_exporter_lines(p, end, s, "faults_status", exporter.statusAt, 1);
+    if (p == NULL){
+        return false;
+    }
+
+    p = fault_exporter_family(p, "faults_errors", "gauge",
+                              "Errors counted by the policy");
+    p = fault_exporter_lines(p, end, s, "faults_errors", exporter.errorsAt,
+                             FAULT_EXPORTER_WIDTH);
+    if (p == NULL){
+        return false;
+    }
+
+    p = fault_exporter_family(p, "faults_refvalue", "gauge",
+                              "Reference value of the last error");
+    p = fault_exporter_lines(p, end, s, "faults_refvalue", exporter.refAt,
+                             FAULT_EXPORTER_WIDTH);
+    if (p == NULL){
+        return false;
+    }
+
+    for (int v = 0; v < FAULT_EXPORTER_VALUES; v++){
+        p = fault_exporter_family(p, valueNames[v][0], valueNames[v][1],
+                                  valueNames[v][2]);
+        p = fault_exporter_text(p, valueNames[v][0]);
+        *p++ = ' ';
+        exporter.valuesAt[v] = (uint32_t)(p - body);
+        memset(p, ' ', FAULT_EXPORTER_WIDTH);
+        p += FAULT_EXPORTER_WIDTH;
+        *p++ = '\n';
+    }
+
+    /* the values of the ids, the others are written at every render */
+    for (fault_id i = 0; i < s->ids; i++){
+        exporter.shown[i] = s->records[i];
+        fault_exporter_set_status(exporter.statusAt[i], s->records[i].status);
+        fault_exporter_set_ulong(exporter.errorsAt[i], s->records[i].errors);
+        fault_exporter_set_long(exporter.refAt[i], s->records[i].refValue);
+    }
+
+    exporter.modules = s->modules;
+    memcpy(exporter.codes, s->codes, sizeof(exporter.codes));
+    exporter.ids = s->ids;
+    exporter.bodyLen = (size_t)(p - body);
+
+    return true;
+}/* fault_exporter_layout */
+
+/* Render the snapshot in the body, return false on error */
+static
+bool fault_exporter_body(const FaultExporterSnapshot *s)
+{
+    if (exporter.bodyLen == 0 ||
+        exporter.modules != s->modules ||
+        memcmp(exporter.codes, s->codes, sizeof(exporter.codes)) != 0){
+        if (!fault_exporter_layout(s)){
+            return false;
+        }
+    } else {
+        assert(exporter.ids == s->ids);
+
+        /* only the changed values */
+        for (fault_id i = 0; i < s->ids; i++){
+            const FaultExporterRecord *rec = &s->records[i];
+            FaultExporterRecord *shown = &exporter.shown[i];
+
+            if (rec->status != shown->status){
+                fault_exporter_set_status(exporter.statusAt[i], rec->status);
+            }
+            if (rec->errors != shown->errors){
+                fault_exporter_set_ulong(exporter.errorsAt[i], rec->errors);
+            }
+            if (rec->refValue != shown->refValue){
+                fault_exporter_set_long(exporter.refAt[i], rec->refValue);
+            }
+            *shown = *rec;
+        }/* for records */
+    }
+
+    for (fault_module m = 0; m < s->modules; m++){
+        fault_exporter_set_status(exporter.moduleAt[m], s->moduleStatus[m]);
+    }
+
+    for (int v = 0; v < FAULT_EXPORTER_VALUES; v++){
+        fault_exporter_set_ulong(exporter.valuesAt[v], s->values[v]);
+    }
+
+    return true;
+}/* fault_exporter_body */
+
+/* Take the published snapshot for reading, -1 if none */
+static
+int fault_exporter_acquire(void)
+{
+    for (;;){
+        int p = __atomic_load_n(&exporter.published, __ATOMIC_SEQ_CST);
+        if (p < 0){
+            return -1;
+        }
+
+        __atomic_store_n(&exporter.reading, p, __ATOMIC_SEQ_CST);
+
+        /* still the published one, the producer will not overwrite it */
+        if (__atomic_load_n(&exporter.published, __ATOMIC_SEQ_CST) == p){
+            return p;
+        }
+    }/* for ever */
+}/* fault_exporter_acquire */
+
+static
+void fault_exporter_release(void)
+{
+    __atomic_store_n(&exporter.reading, -1, __ATOMIC_SEQ_CST);
+}/* fault_exporter_release */
+
+bool fault_exporter_publish(void)
+{
+    int pub = __atomic_load_n(&exporter.published, __ATOMIC_SEQ_CST);
+    int target = (pub == 0) ? 1 : 0;
+
+    if (__atomic_load_n(&exporter.reading, __ATOMIC_SEQ_CST) == target){
+        return false;
+    }
+
+    /* input validated */
+
+    FaultExporterSnapshot *s = &exporter.snap[target];
+    FaultStats stats;
+    fault_module nmod = fault_modules_length();
+    fault_id n = 0;
+
+    assert(nmod <= FAULT_MODULE_MAX);
+
+    memset(s->codes, 0, sizeof(s->codes));
+
+    for (fault_module m = 0; m < nmod; m++){
+        s->codes[m] = fault_module_codes(m);
+        s->moduleStatus[m] = fault_status_module(m);
+        n = n + (fault_id)s->codes[m];
+    }/* for modules */
+
+    /* the ids are the codes of the modules in sequence */
+    for (fault_id i = 0; i < n; i++){
+        FaultExporterRecord *rec = &s->records[i];
+        rec->status = fault_status_unchecked(i);
+        rec->errors = fault_count_errors_unchecked(i);
+        rec->refValue = fault_refval_unchecked(i);
+    }
+
+    s->modules = nmod;
+    s->ids = n;
+
+    fault_stats(&stats);
+    exporter.snapshots = exporter.snapshots + 1;
+
+    s->values[FAULT_EXPORTER_LOGS] = fault_logs_length();
+    s->values[FAULT_EXPORTER_UPDATES] = stats.updates;
+    s->values[FAULT_EXPORTER_UNKNOWN] = stats.unknown;
+    s->values[FAULT_EXPORTER_OVERFLOWS] = stats.overflows;
+    s->values[FAULT_EXPORTER_POLICY_RESETS] = stats.policyResets;
+    s->values[FAULT_EXPORTER_LOGS_TOTAL] = stats.logs;
+    s->values[FAULT_EXPORTER_LOGS_EVICTED] = stats.logsEvicted;
+    s->values[FAULT_EXPORTER_LOGS_DROPPED] = stats.logsDropped;
+    s->values[FAULT_EXPORTER_LOGS_INHIBITED] = stats.logsInhibited;
+    s->values[FAULT_EXPORTER_SNAPSHOTS] = exporter.snapshots;
+
+    __atomic_store_n(&exporter.published, target, __ATOMIC_SEQ_CST);
+
+    return true;
+}/* fault_exporter_publish */
+
+const char *fault_exporter_render(size_t *len)
+{
+    int p = fault_exporter_acquire();
+    bool ok = false;
+
+    *len = 0;
+
+    if (p >= 0){
+        ok = fault_exporter_body(&exporter.snap[p]);
+        fault_exporter_release();
+    }
+
+    if (!ok){
+        return NULL;
+    }
+
+    *len = exporter.bodyLen;
+
+    return exporter.buffer + FAULT_EXPORTER_HEADER;
+}/* fault_exporter_render */
+
+/* Write all the bytes, return false on error */
+static
+bool fault_exporter_send(int fd, const char *buf, size_t len)
+{
+    while (len > 0){
+        ssize_t w = send(fd, buf, len, MSG_NOSIGNAL);
+        if (w <= 0){
+            return false;
+        }
+        buf += w;
+        len -= (size_t)w;
+    }
+
+    return true;
+}/* fault_exporter_send */
+
+/* Answer a client, the request is not inspected */
+static
+void fault_exporter_serve(int fd)
+{
+    char request[FAULT_EXPORTER_REQUEST];
+    struct pollfd pfd = {fd, POLLIN, 0};
+
+    if (poll(&pfd, 1, 1000) > 0){
+        ssize_t r = read(fd, request, sizeof(request));
+        (void)r;
+    }
+
+    size_t len = 0;
+    const char *body = fault_exporter_render(&len);
+
+    char header[FAULT_EXPORTER_HEADER];
+    int hlen;
+
+    if (body != NULL){
+        hlen = snprintf(header, sizeof(header),
+                        "HTTP/1.0 200 OK\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: %zu\r\n\r\n", len);
+    } else {
+        hlen = snprintf(header, sizeof(header),
+                        "HTTP/1.0 503 Service Unavailable\r\n"
+                        "Content-Length: 0\r\n\r\n");
+    }
+
+    assert(hlen > 0 && hlen < FAULT_EXPORTER_HEADER);
+
+    /* header just before the body, a single send */
+    char *start = exporter.buffer + FAULT_EXPORTER_HEADER - hlen;
+    memcpy(start, header, (size_t)hlen);
+    fault_exporter_send(fd, start, (size_t)hlen + len);
+}/* fault_exporter_serve */
+
+static
+void *fault_exporter_main(void *arg)
+{
+    (void)arg;
+
+    while (__atomic_load_n(&exporter.running, __ATOMIC_ACQUIRE)){
+        struct pollfd pfd = {exporter.fd, POLLIN, 0};
+
+        if (poll(&pfd, 1, FAULT_EXPORTER_POLL_MS) <= 0){
+            continue;
+        }
+
+        int client = accept(exporter.fd, NULL, NULL);
+        if (client < 0){
+            continue;
+        }
+
+        fault_exporter_serve(client);
+        close(client);
+    }/* while running */
+
+    return NULL;
+}/* fault_exporter_main */
+
+bool fault_exporter_start(const char *path)
+{
+    struct sockaddr_un addr;
+
+    if (exporter.started){
+        return false;
+    }
+
+    if (path == NULL || strlen(path) >= sizeof(addr.sun_path)){
+        return false;
+    }
+
+    /* input validated */
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    strcpy(exporter.path, path);
+
+    exporter.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (exporter.fd < 0){
+        return false;
+    }
+
+    unlink(path);
+
+    if (bind(exporter.fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(exporter.fd, 8) != 0){
+        close(exporter.fd);
+        exporter.fd = -1;
+        return false;
+    }
+
+    exporter.running = true;
+    if (pthread_create(&exporter.thread, NULL, fault_exporter_main, NULL) != 0){
+        exporter.running = false;
+        close(exporter.fd);
+        exporter.fd = -1;
+        unlink(path);
+        return false;
+    }
+
+    exporter.started = true;
+
+    return true;
+}/* fault_exporter_start */
+
+void fault_exporter_stop(void)
+{
+    if (!exporter.started){
+        return;
+    }
+
+    __atomic_store_n(&exporter.running, false, __ATOMIC_RELEASE);
+    pthread_join(exporter.thread, NULL);
+
+    close(exporter.fd);
+    exporter.fd = -1;
+    unlink(exporter.path);
+    exporter.started = false;
+}/* fault_exporter_stop */
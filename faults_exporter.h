@@ -0,0 +1,69 @@
+#pragma once
+#include "faults.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Faults Exporter - Metrics in the Prometheus text format.
+ *
+ * The thread doing fault_update() calls fault_exporter_publish() from time
+ * to time: it copies the state into a preallocated snapshot, without
+ * locks. A background thread serves the last snapshot on a Unix socket,
+ * as an HTTP/1.0 response:
+ *
+ *     curl --unix-socket /run/faults.sock http://localhost/metrics
+ *
+ * Requires POSIX threads.
+ *
+ * Metrics:
+ *   faults_module_status{module}       fault_status_module()
+ *   faults_status{module,code}         fault_status()
+ *   faults_errors{module,code}         fault_count_errors()
+ *   faults_refvalue{module,code}       fault_refval()
+ *   faults_logs                        fault_logs_length()
+ *   faults_*_total                     fault_stats()
+ *   faults_exporter_snapshots_total    fault_exporter_publish() done
+ *
+ * Compilation Flags:
+ *
+ * FAULT_EXPORTER_BUFFER bytes of the rendering buffer.
+ *                Default: enough for FAULT_ID_MAX and FAULT_MODULE_MAX
+ */
+
+#ifndef FAULT_EXPORTER_BUFFER
+#define FAULT_EXPORTER_BUFFER \
+    (((size_t)FAULT_ID_MAX * 3 + FAULT_MODULE_MAX) * 96 + 4096)
+#endif
+
+/* Start the server thread listening on the Unix socket 'path'.
+ * An existing file at 'path' is replaced.
+ * return false in case of error (already started, socket errors)
+ */
+bool fault_exporter_start(const char *path);
+
+/* Stop the server thread and remove the socket */
+void fault_exporter_stop(void);
+
+/* Copy the current state for the server.
+ * It must be called by the thread doing fault_update(), it never blocks.
+ * In lazy mode it evaluates the pending statuses (see fault_conf_lazy()).
+ * return false when skipped, the server is reading the other snapshot
+ */
+bool fault_exporter_publish(void);
+
+/* Render the last published snapshot.
+ * It is the body served by the thread, for other transports:
+ * it must not be called while the server is running.
+ * The values are right aligned to a fixed width (blanks after the labels),
+ * so only the changed ones are written again at the next call.
+ * len: the number of bytes of the text
+ * return the text, valid up to the next call, or NULL when nothing is
+ *        published or FAULT_EXPORTER_BUFFER is too small
+ */
+const char *fault_exporter_render(size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,491 @@
+/* Faults Journal
+ *
+ * Single producer (the thread calling fault_update()),
+ * single consumer (the writer thread).
+ *
+ * Author: Omar Rampado <omar@ognibit.it>
+ * Version: 1.0.x
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "faults_journal.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if (FAULT_JOURNAL_QUEUE & (FAULT_JOURNAL_QUEUE - 1)) != 0
+#error "FAULT_JOURNAL_QUEUE must be a power of two"
+#endif
+
+#define FAULT_JOURNAL_MAGIC  "FLTJ"
+#define FAULT_JOURNAL_BATCH_MAGIC 0x424A4C46UL /* "FLJB" */
+#define FAULT_JOURNAL_HEADER_SIZE 8
+#define FAULT_JOURNAL_BATCH_HEADER_SIZE 12
+#define FAULT_JOURNAL_BATCH  1024 /* records in a write() */
+#define FAULT_JOURNAL_PATH_MAX 4096
+
+struct FaultJournal {
+    /* queue, 'tail' written by the producer, 'head' by the consumer */
+    FaultLog queue[FAULT_JOURNAL_QUEUE];
+    size_t head;
+    size_t tail;
+
+    /* configuration */
+    FaultJournalConf conf;
+    char path[FAULT_JOURNAL_PATH_MAX];
+
+    /* writer thread */
+    pthread_t thread;
+    bool started;
+    bool running;
+
+    /* current file */
+    int fd;
+    size_t fileBytes;
+    time_t fileOpened;
+
+    /* counters, see FaultJournalStats */
+    unsigned long written;
+    unsigned long dropped;
+    unsigned long batches;
+    unsigned long rotations;
+    unsigned long errors;
+    size_t backlog;
+
+    /* batch being written, owned by the writer thread */
+    unsigned char batch[FAULT_JOURNAL_BATCH_HEADER_SIZE +
+                        FAULT_JOURNAL_BATCH * FAULT_JOURNAL_RECORD_SIZE];
+};
+
+static struct FaultJournal journal;
+
+static unsigned long crcTable[256];
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+/* counters written by a single thread, read by any */
+#define JOURNAL_INC(field) \
+    __atomic_store_n(&journal.field, \
+                     __atomic_load_n(&journal.field, __ATOMIC_RELAXED) + 1, \
+                     __ATOMIC_RELAXED)
+
+/* PROCEDURES */
+
+static
+void fault_journal_crc_init(void)
+{
+    for (unsigned long i = 0; i < 256; i++){
+        unsigned long c = i;
+        for (int k = 0; k < 8; k++){
+            c = (c & 1) ? (0xEDB88320UL ^ (c >> 1)) : (c >> 1);
+        }
+        crcTable[i] = c;
+    }
+}/* fault_journal_crc_init */
+
+static
+unsigned long fault_journal_crc(const unsigned char *buf, size_t len)
+{
+    unsigned long c = 0xFFFFFFFFUL;
+
+    for (size_t i = 0; i < len; i++){
+        c = crcTable[(c ^ buf[i]) & 0xFF] ^ (c >> 8);
+    }
+
+    return c ^ 0xFFFFFFFFUL;
+}/* fault_journal_crc */
+
+static
+void fault_journal_put(unsigned char *buf, unsigned long long v, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++){
+        buf[i] = (unsigned char)(v >> (8 * i));
+    }
+}/* fault_journal_put */
+
+static
+unsigned long long fault_journal_get(const unsigned char *buf, size_t bytes)
+{
+    unsigned long long v = 0;
+
+    for (size_t i = 0; i < bytes; i++){
+        v |= (unsigned long long)buf[i] << (8 * i);
+    }
+
+    return v;
+}/* fault_journal_get */
+
+static
+void fault_journal_encode(unsigned char *rec, const FaultLog *log)
+{
+    fault_journal_put(rec, log->index, 8);
+    fault_journal_put(rec + 8, log->timestamp, 8);
+    fault_journal_put(rec + 16, log->module, 4);
+    fault_journal_put(rec + 20, log->code, 4);
+    fault_journal_put(rec + 24, (unsigned long long)log->status, 1);
+    fault_journal_put(rec + 25, (unsigned long long)log->refValue, 8);
+}/* fault_journal_encode */
+
+static
+bool fault_journal_decode_record(const unsigned char *rec, FaultLog *log)
+{
+    log->saved = true;
+    log->index = (size_t)fault_journal_get(rec, 8);
+    log->timestamp = (fault_millisecs)fault_journal_get(rec + 8, 8);
+    log->module = (fault_module)fault_journal_get(rec + 16, 4);
+    log->code = (fault_code)fault_journal_get(rec + 20, 4);
+    log->status = (fault_status_type)fault_journal_get(rec + 24, 1);
+    log->refValue = (long)fault_journal_get(rec + 25, 8);
+
+    return (log->status < FAULT_ST_ALL);
+}/* fault_journal_decode_record */
+
+static
+time_t fault_journal_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}/* fault_journal_secs */
+
+static
+bool fault_journal_write(const unsigned char *buf, size_t len)
+{
+    while (len > 0){
+        ssize_t n = write(journal.fd, buf, len);
+        if (n < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            JOURNAL_INC(errors);
+            return false;
+        }
+        buf += n;
+        len -= (size_t)n;
+        journal.fileBytes += (size_t)n;
+    }/* while */
+
+    return true;
+}/* fault_journal_write */
+
+static
+bool fault_journal_open(void)
+{
+    journal.fd = open(journal.path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (journal.fd < 0){
+        return false;
+    }
+
+    off_t size = lseek(journal.fd, 0, SEEK_END);
+    journal.fileBytes = (size > 0) ? (size_t)size : 0;
+    journal.fileOpened = fault_journal_secs();
+
+    if (journal.fileBytes == 0){
+        unsigned char header[FAULT_JOURNAL_HEADER_SIZE];
+        memcpy(header, FAULT_JOURNAL_MAGIC, 4);
+        fault_journal_put(header + 4, FAULT_JOURNAL_VERSION, 4);
+        return fault_journal_write(header, sizeof(header));
+    }
+
+    return true;
+}/* fault_journal_open */
+
+static
+void fault_journal_rotate(void)
+{
+    char from[FAULT_JOURNAL_PATH_MAX + 16];
+    char to[FAULT_JOURNAL_PATH_MAX + 16];
+
+    close(journal.fd);
+    journal.fd = -1;
+
+    if (journal.conf.rotateKeep == 0){
+        unlink(journal.path);
+    } else {
+        /* path.(k-1) -> path.k, the oldest is overwritten */
+        for (unsigned int k = journal.conf.rotateKeep; k > 1; k--){
+            snprintf(from, sizeof(from), "%s.%u", journal.path, k - 1);
+            snprintf(to, sizeof(to), "%s.%u", journal.path, k);
+            rename(from, to);
+        }
+        snprintf(to, sizeof(to), "%s.1", journal.path);
+        rename(journal.path, to);
+    }
+
+    JOURNAL_INC(rotations);
+
+    if (!fault_journal_open()){
+        JOURNAL_INC(errors);
+    }
+}/* fault_journal_rotate */
+
+static
+void fault_journal_flush(size_t count)
+{
+    size_t len = FAULT_JOURNAL_BATCH_HEADER_SIZE +
+                 count * FAULT_JOURNAL_RECORD_SIZE;
+    const unsigned char *records = journal.batch +
+                                   FAULT_JOURNAL_BATCH_HEADER_SIZE;
+
+    fault_journal_put(journal.batch, FAULT_JOURNAL_BATCH_MAGIC, 4);
+    fault_journal_put(journal.batch + 4, count, 4);
+    fault_journal_put(journal.batch + 8,
+                      fault_journal_crc(records, len -
+                                        FAULT_JOURNAL_BATCH_HEADER_SIZE), 4);
+
+    bool full = (journal.conf.rotateBytes > 0 &&
+                 journal.fileBytes > FAULT_JOURNAL_HEADER_SIZE &&
+                 journal.fileBytes + len > journal.conf.rotateBytes);
+    bool old = (journal.conf.rotateSecs > 0 &&
+                (unsigned long)(fault_journal_secs() - journal.fileOpened) >=
+                journal.conf.rotateSecs);
+
+    if (journal.fd < 0){
+        /* retry after a failure */
+        if (!fault_journal_open()){
+            JOURNAL_INC(errors);
+            return;
+        }
+    } else if (full || old){
+        fault_journal_rotate();
+        if (journal.fd < 0){
+            return;
+        }
+    }
+
+    if (fault_journal_write(journal.batch, len)){
+        JOURNAL_INC(batches);
+        __atomic_store_n(&journal.written,
+                         journal.written + count, __ATOMIC_RELAXED);
+    }
+}/* fault_journal_flush */
+
+/* Write all the entries in the queue.
+ * return the number of entries taken
+ */
+static
+size_t fault_journal_drain(void)
+{
+    size_t head = journal.head;
+    size_t tail = __atomic_load_n(&journal.tail, __ATOMIC_ACQUIRE);
+    size_t taken = tail - head;
+
+    while (head != tail){
+        size_t count = 0;
+        unsigned char *rec = journal.batch + FAULT_JOURNAL_BATCH_HEADER_SIZE;
+
+        while (head != tail && count < FAULT_JOURNAL_BATCH){
+            const FaultLog *log = &journal.queue[head &
+                                                 (FAULT_JOURNAL_QUEUE - 1)];
+            fault_journal_encode(rec, log);
+            rec += FAULT_JOURNAL_RECORD_SIZE;
+            head++;
+            count++;
+        }
+
+        /* the slots are free for the producer */
+        __atomic_store_n(&journal.head, head, __ATOMIC_RELEASE);
+
+        fault_journal_flush(count);
+    }/* while */
+
+    return taken;
+}/* fault_journal_drain */
+
+static
+void *fault_journal_main(void *arg)
+{
+    (void)arg;
+
+    struct timespec pause;
+    pause.tv_sec = (time_t)(journal.conf.flushMs / 1000);
+    pause.tv_nsec = (long)(journal.conf.flushMs % 1000) * 1000000L;
+
+    while (true){
+        bool run = __atomic_load_n(&journal.running, __ATOMIC_ACQUIRE);
+
+        if (fault_journal_drain() == 0){
+            if (!run){
+                /* everything pushed before the stop is written */
+                break;
+            }
+            nanosleep(&pause, NULL);
+        }
+    }/* while */
+
+    return NULL;
+}/* fault_journal_main */
+
+/* fault_log_hook, in the producer thread */
+static
+void fault_journal_push(const FaultLog *log, void *ctx)
+{
+    (void)ctx;
+
+    size_t tail = journal.tail;
+    size_t head = __atomic_load_n(&journal.head, __ATOMIC_ACQUIRE);
+    size_t used = tail - head;
+
+    assert(used <= FAULT_JOURNAL_QUEUE);
+
+    if (used == FAULT_JOURNAL_QUEUE){
+        /* never block the producer */
+        JOURNAL_INC(dropped);
+        return;
+    }
+
+    journal.queue[tail & (FAULT_JOURNAL_QUEUE - 1)] = *log;
+    __atomic_store_n(&journal.tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (used + 1 > journal.backlog){
+        __atomic_store_n(&journal.backlog, used + 1, __ATOMIC_RELAXED);
+    }
+}/* fault_journal_push */
+
+bool fault_journal_start(const FaultJournalConf *conf)
+{
+    if (journal.started || conf == NULL || conf->path == NULL){
+        return false;
+    }
+
+    if (conf->flushMs < 1){
+        return false;
+    }
+
+    if (strlen(conf->path) >= FAULT_JOURNAL_PATH_MAX){
+        return false;
+    }
+
+    /* input validated */
+
+    memset(&journal, 0, sizeof(journal));
+    journal.conf = *conf;
+    strcpy(journal.path, conf->path);
+    journal.conf.path = journal.path;
+
+    pthread_once(&crcOnce, fault_journal_crc_init);
+
+    if (!fault_journal_open()){
+        return false;
+    }
+
+    journal.running = true;
+    if (pthread_create(&journal.thread, NULL, fault_journal_main, NULL) != 0){
+        close(journal.fd);
+        return false;
+    }
+
+    journal.started = true;
+    fault_conf_logs_hook(fault_journal_push, NULL);
+
+    return true;
+}/* fault_journal_start */
+
+void fault_journal_stop(void)
+{
+    if (!journal.started){
+        return;
+    }
+
+    fault_conf_logs_hook(NULL, NULL);
+
+    __atomic_store_n(&journal.running, false, __ATOMIC_RELEASE);
+    pthread_join(journal.thread, NULL);
+
+    if (journal.fd >= 0){
+        fsync(journal.fd);
+        close(journal.fd);
+        journal.fd = -1;
+    }
+
+    journal.started = false;
+}/* fault_journal_stop */
+
+void fault_journal_stats(FaultJournalStats *out)
+{
+    if (out == NULL){
+        return;
+    }
+
+    out->written = __atomic_load_n(&journal.written, __ATOMIC_RELAXED);
+    out->dropped = __atomic_load_n(&journal.dropped, __ATOMIC_RELAXED);
+    out->batches = __atomic_load_n(&journal.batches, __ATOMIC_RELAXED);
+    out->rotations = __atomic_load_n(&journal.rotations, __ATOMIC_RELAXED);
+    out->errors = __atomic_load_n(&journal.errors, __ATOMIC_RELAXED);
+    out->backlog = __atomic_load_n(&journal.backlog, __ATOMIC_RELAXED);
+}/* fault_journal_stats */
+
+long fault_journal_decode(const char *path,
+                          fault_journal_visitor visit,
+                          void *ctx)
+{
+    /* on the stack, reentrant (about 37 KB) */
+    unsigned char records[FAULT_JOURNAL_BATCH * FAULT_JOURNAL_RECORD_SIZE];
+    unsigned char header[FAULT_JOURNAL_BATCH_HEADER_SIZE];
+    long n = 0;
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL){
+        return -1;
+    }
+
+    pthread_once(&crcOnce, fault_journal_crc_init);
+
+    if (fread(header, 1, FAULT_JOURNAL_HEADER_SIZE, f) !=
+        FAULT_JOURNAL_HEADER_SIZE ||
+        memcmp(header, FAULT_JOURNAL_MAGIC, 4) != 0 ||
+        fault_journal_get(header + 4, 4) != FAULT_JOURNAL_VERSION){
+        fclose(f);
+        return -1;
+    }
+
+    while (fread(header, 1, sizeof(header), f) == sizeof(header)){
+        unsigned long long magic = fault_journal_get(header, 4);
+        size_t count = (size_t)fault_journal_get(header + 4, 4);
+        unsigned long crc = (unsigned long)fault_journal_get(header + 8, 4);
+
+        if (magic != FAULT_JOURNAL_BATCH_MAGIC ||
+            count > FAULT_JOURNAL_BATCH){
+            n = -1;
+            break;
+        }
+
+        size_t len = count * FAULT_JOURNAL_RECORD_SIZE;
+        if (fread(records, 1, len, f) != len){
+            /* truncated by a crash, not an error */
+            break;
+        }
+
+        if (fault_journal_crc(records, len) != crc){
+            n = -1;
+            break;
+        }
+
+        bool more = true;
+        for (size_t i = 0; i < count && more; i++){
+            FaultLog log = {0};
+            if (!fault_journal_decode_record(
+                    records + i * FAULT_JOURNAL_RECORD_SIZE, &log)){
+                n = -1;
+                more = false;
+                break;
+            }
+            n++;
+            if (visit != NULL){
+                more = visit(&log, ctx);
+            }
+        }
+
+        if (!more){
+            break;
+        }
+    }/* while batches */
+
+    fclose(f);
+
+    return n;
+}/* fault_journal_decode */
@@ -0,0 +1,91 @@
+#pragma once
+#include "faults.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Faults Journal - Asynchronous binary journal of the fault logs.
+ *
+ * Every log entry produced by fault_update() is pushed into a lock-free
+ * queue, a background thread drains it and appends the entries to a file
+ * in large sequential writes. When the queue is full the entries are
+ * dropped and counted, the producer never blocks.
+ *
+ * Requires POSIX threads.
+ *
+ * File format (little endian):
+ *   header: "FLTJ" u32 version
+ *   batches: u32 magic "FLJB", u32 count, u32 crc32 of the records,
+ *            count records of FAULT_JOURNAL_RECORD_SIZE bytes:
+ *            u64 sequence, u64 timestamp, u32 module, u32 code,
+ *            u8 status, i64 refValue
+ *
+ * Compilation Flags:
+ *
+ * FAULT_JOURNAL_QUEUE entries in the queue, a power of two.
+ *                Default: 4096
+ */
+
+#ifndef FAULT_JOURNAL_QUEUE
+#define FAULT_JOURNAL_QUEUE 4096
+#endif
+
+#define FAULT_JOURNAL_VERSION     1
+#define FAULT_JOURNAL_RECORD_SIZE 37
+
+struct FaultJournalConf {
+    const char *path;  /* the rotated files get the suffix .1, .2, ... */
+    size_t rotateBytes;   /* rotate when bigger, 0 to disable */
+    unsigned long rotateSecs; /* rotate when older, 0 to disable */
+    unsigned int rotateKeep;  /* number of rotated files kept */
+    unsigned long flushMs;    /* max delay before writing, >0 */
+};
+
+typedef struct FaultJournalConf FaultJournalConf;
+
+struct FaultJournalStats {
+    unsigned long written; /* entries written to the file */
+    unsigned long dropped; /* entries lost because the queue was full */
+    unsigned long batches; /* write() calls */
+    unsigned long rotations;
+    unsigned long errors;  /* failed file operations */
+    size_t backlog;        /* max number of entries seen in the queue */
+};
+
+typedef struct FaultJournalStats FaultJournalStats;
+
+/* Open the journal and start the writer thread.
+ * It registers itself with fault_conf_logs_hook(), so it must be
+ * called after fault_init().
+ * return false in case of error (already started, cannot open the file)
+ */
+bool fault_journal_start(const FaultJournalConf *conf);
+
+/* Write all the pending entries, stop the thread and close the file.
+ * It must be called from the thread doing fault_update().
+ */
+void fault_journal_stop(void);
+
+/* Get a copy of the journal counters */
+void fault_journal_stats(FaultJournalStats *out);
+
+/* Procedure called for every entry read by fault_journal_decode().
+ * return false to stop the decoding.
+ */
+typedef bool (*fault_journal_visitor)(const FaultLog *log, void *ctx);
+
+/* Read a journal file.
+ * The 'index' of the entries is the sequence number.
+ * return the number of entries read or -1 when the file cannot be read
+ *        or it is corrupted (a partial batch at the end is not an error).
+ * It is reentrant, the buffer of a batch is on the stack (about 37 KB).
+ */
+long fault_journal_decode(const char *path,
+                          fault_journal_visitor visit,
+                          void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,725 @@
+/* Faults Loader
+ *
+ * The configuration is parsed twice: the first pass validates all of it,
+ * the second one configures the tables (or writes the binary format).
+ *
+ * Author: Omar Rampado <omar@ognibit.it>
+ * Version: 1.0.x
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "faults_loader.h"
+#include "faults_private.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FAULT_LOADER_MAGIC  "FLTC"
+#define FAULT_LOADER_HEADER 16
+#define FAULT_LOADER_MODULE 8
+#define FAULT_LOADER_POLICY 40
+
+/* A directive of the configuration */
+struct FaultLoaderItem {
+    bool module; /* module or policy */
+
+    /* module */
+    fault_counter codes;
+    fault_counter tolerance;
+
+    /* policy */
+    unsigned long mod;     /* module index in the configuration, from 0 */
+    fault_counter modCodes; /* codes of that module */
+    fault_counter first;
+    fault_counter last;
+    fault_policy_type type;
+    unsigned long warn;
+    unsigned long err;
+    unsigned long reset;
+    FaultPolicy policy; /* validated */
+
+    /* position, for the errors */
+    size_t line;
+    size_t column;
+};
+
+typedef struct FaultLoaderItem FaultLoaderItem;
+
+/* Consumer of the directives.
+ * return false on error, with 'err' set
+ */
+typedef bool (*fault_loader_sink)(const FaultLoaderItem *item,
+                                  void *ctx,
+                                  FaultLoaderError *err);
+
+/* Validation of the directives */
+struct FaultLoaderCheck {
+    bool limits; /* check FAULT_MODULE_MAX and FAULT_ID_MAX */
+    fault_module modules; /* configured, the loaded ones included */
+    fault_id ids;
+    unsigned long fileModules;
+    unsigned long filePolicies;
+};
+
+typedef struct FaultLoaderCheck FaultLoaderCheck;
+
+/* Output of fault_load_compile() */
+struct FaultLoaderWriter {
+    unsigned char *out;
+    size_t modulesAt; /* next module record */
+    size_t policiesAt; /* next policy record */
+};
+
+typedef struct FaultLoaderWriter FaultLoaderWriter;
+
+/* Names of the policies, by fault_policy_type */
+static const char *const policyNames[FAULT_POL_ALL] = {
+    "none", "count_abs", "count_reset", "time_reset", "heartbeat"
+};
+
+/* Thresholds of the policies, by fault_policy_type */
+static const int policyArgs[FAULT_POL_ALL] = {0, 2, 3, 3, 2};
+
+/* PROCEDURES */
+
+static
+bool fault_loader_error(FaultLoaderError *err,
+                        size_t line,
+                        size_t column,
+                        const char *message)
+{
+    err->line = line;
+    err->column = column;
+    err->message = message;
+
+    return false;
+}/* fault_loader_error */
+
+static
+void fault_loader_put(unsigned char *buf, unsigned long long v, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++){
+        buf[i] = (unsigned char)(v >> (8 * i));
+    }
+}/* fault_loader_put */
+
+static
+unsigned long fault_loader_get32(const unsigned char *buf)
+{
+    return (unsigned long)buf[0] | (unsigned long)buf[1] << 8 |
+           (unsigned long)buf[2] << 16 | (unsigned long)buf[3] << 24;
+}/* fault_loader_get32 */
+
+static
+unsigned long long fault_loader_get64(const unsigned char *buf)
+{
+    return (unsigned long long)fault_loader_get32(buf) |
+           (unsigned long long)fault_loader_get32(buf + 4) << 32;
+}/* fault_loader_get64 */
+
+/* Current number of ids, the generic module included */
+static
+fault_id fault_loader_ids(void)
+{
+    fault_id ids = 0;
+
+    for (fault_module m = 0; m < fault_modules_length(); m++){
+        ids = ids + (fault_id)fault_module_codes(m);
+    }
+
+    return ids;
+}/* fault_loader_ids */
+
+static
+bool fault_loader_check(const FaultLoaderItem *item,
+                        void *ctx,
+                        FaultLoaderError *err)
+{
+    FaultLoaderCheck *check = ctx;
+
+    if (!item->module){
+        check->filePolicies++;
+        return true;
+    }
+
+    if (item->codes == 0){
+        return fault_loader_error(err, item->line, item->column,
+                                  "a module needs at least one code");
+    }
+
+    if (check->limits){
+        if (check->modules >= FAULT_MODULE_MAX){
+            return fault_loader_error(err, item->line, item->column,
+                                      "too many modules (FAULT_MODULE_MAX)");
+        }
+        if (item->codes > (fault_counter)(FAULT_ID_MAX - check->ids)){
+            return fault_loader_error(err, item->line, item->column,
+                                      "too many codes (FAULT_ID_MAX)");
+        }
+    }
+
+    check->modules++;
+    check->ids = check->ids + (fault_id)item->codes;
+    check->fileModules++;
+
+    return true;
+}/* fault_loader_check */
+
+static
+bool fault_loader_apply(const FaultLoaderItem *item,
+                        void *ctx,
+                        FaultLoaderError *err)
+{
+    fault_module base = *(const fault_module *)ctx;
+
+    if (item->module){
+        if (fault_conf_module(item->codes, item->tolerance) == FAULT_MODULE_KO){
+            /* validated */
+            return fault_loader_error(err, item->line, item->column,
+                                      "cannot configure the module");
+        }
+        return true;
+    }
+
+    fault_id first = fault_getid(base + (fault_module)item->mod,
+                                 (fault_code)item->first);
+
+    if (!fault_policy_range(first, (fault_id)(item->last - item->first + 1),
+                            &item->policy)){
+        /* validated */
+        return fault_loader_error(err, item->line, item->column,
+                                  "cannot configure the policy");
+    }
+
+    return true;
+}/* fault_loader_apply */
+
+static
+bool fault_loader_write(const FaultLoaderItem *item,
+                        void *ctx,
+                        FaultLoaderError *err)
+{
+    FaultLoaderWriter *w = ctx;
+    (void)err;
+
+    if (item->module){
+        unsigned char *rec = w->out + w->modulesAt;
+        fault_loader_put(rec, item->codes, 4);
+        fault_loader_put(rec + 4, item->tolerance, 4);
+        w->modulesAt += FAULT_LOADER_MODULE;
+    } else {
+        unsigned char *rec = w->out + w->policiesAt;
+        fault_loader_put(rec, item->mod, 4);
+        fault_loader_put(rec + 4, item->first, 4);
+        fault_loader_put(rec + 8, item->last, 4);
+        fault_loader_put(rec + 12, (unsigned long long)item->type, 4);
+        fault_loader_put(rec + 16, item->warn, 8);
+        fault_loader_put(rec + 24, item->err, 8);
+        fault_loader_put(rec + 32, item->reset, 8);
+        w->policiesAt += FAULT_LOADER_POLICY;
+    }
+
+    return true;
+}/* fault_loader_write */
+
+/* Validate the thresholds of a policy item */
+static
+bool fault_loader_policy(FaultLoaderItem *item, FaultLoaderError *err)
+{
+    if (item->first > item->last){
+        return fault_loader_error(err, item->line, item->column,
+                                  "wrong range of codes");
+    }
+
+    if (item->last >= item->modCodes){
+        return fault_loader_error(err, item->line, item->column,
+                                  "code out of the module");
+    }
+
+    if (!fault_policy_make(&item->policy, item->type,
+                           item->warn, item->err, item->reset)){
+        return fault_loader_error(err, item->line, item->column,
+                                  "wrong thresholds of the policy");
+    }
+
+    return true;
+}/* fault_loader_policy */
+
+/* TEXT FORMAT */
+
+/* Position in the text */
+struct FaultLoaderText {
+    const char *p;
+    const char *end;
+    const char *lineStart;
+    size_t line;
+};
+
+typedef struct FaultLoaderText FaultLoaderText;
+
+static
+bool fault_loader_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}/* fault_loader_blank */
+
+/* Move to the next token of the line.
+ * return its length, 0 at the end of the line
+ */
+static
+size_t fault_loader_token(FaultLoaderText *t)
+{
+    while (t->p < t->end && fault_loader_blank(*t->p)){
+        t->p++;
+    }
+
+    if (t->p < t->end && *t->p == '#'){
+        while (t->p < t->end && *t->p != '\n'){
+            t->p++;
+        }
+    }
+
+    const char *q = t->p;
+    while (q < t->end && *q != '\n' && *q != '#' && !fault_loader_blank(*q)){
+        q++;
+    }
+
+    return (size_t)(q - t->p);
+}/* fault_loader_token */
+
+static
+size_t fault_loader_column(const FaultLoaderText *t)
+{
+    return (size_t)(t->p - t->lineStart) + 1;
+}/* fault_loader_column */
+
+static
+bool fault_loader_is(const FaultLoaderText *t, size_t len, const char *word)
+{
+    return strlen(word) == len && memcmp(t->p, word, len) == 0;
+}/* fault_loader_is */
+
+/* Parse a decimal number of 'len' chars from the current position */
+static
+bool fault_loader_number(const char *p, size_t len, unsigned long *v)
+{
+    unsigned long n = 0;
+
+    if (len == 0){
+        return false;
+    }
+
+    for (size_t i = 0; i < len; i++){
+        unsigned int d = (unsigned int)(p[i] - '0');
+        if (d > 9 || n > (ULONG_MAX - d) / 10){
+            return false;
+        }
+        n = n * 10 + d;
+    }
+
+    *v = n;
+    return true;
+}/* fault_loader_number */
+
+/* Read the next token as a number, 'max' included */
+static
+bool fault_loader_arg(FaultLoaderText *t,
+                      unsigned long max,
+                      unsigned long *v,
+                      FaultLoaderError *err)
+{
+    size_t len = fault_loader_token(t);
+
+    if (len == 0){
+        return fault_loader_error(err, t->line, fault_loader_column(t),
+                                  "expected a number");
+    }
+
+    if (!fault_loader_number(t->p, len, v) || *v > max){
+        return fault_loader_error(err, t->line, fault_loader_column(t),
+                                  "wrong number");
+    }
+
+    t->p += len;
+    return true;
+}/* fault_loader_arg */
+
+/* Read the codes of a policy: 'code', 'first-last' or '*' */
+static
+bool fault_loader_codes(FaultLoaderText *t,
+                        FaultLoaderItem *item,
+                        FaultLoaderError *err)
+{
+    size_t len = fault_loader_token(t);
+    const char *dash = memchr(t->p, '-', len);
+
+    if (len == 1 && *t->p == '*'){
+        item->first = 0;
+        item->last = item->modCodes - 1;
+    } else if (dash != NULL){
+        size_t n = (size_t)(dash - t->p);
+        if (!fault_loader_number(t->p, n, &item->first) ||
+            !fault_loader_number(dash + 1, len - n - 1, &item->last)){
+            return fault_loader_error(err, t->line, fault_loader_column(t),
+                                      "expected a range of codes");
+        }
+    } else if (fault_loader_number(t->p, len, &item->first)){
+        item->last = item->first;
+    } else {
+        return fault_loader_error(err, t->line, fault_loader_column(t),
+                                  "expected the codes");
+    }
+
+    t->p += len;
+    return true;
+}/* fault_loader_codes */
+
+/* Parse a line from the current position, up to the newline */
+static
+bool fault_loader_line(FaultLoaderText *t,
+                       FaultLoaderItem *item,
+                       bool *empty,
+                       FaultLoaderError *err)
+{
+    size_t len = fault_loader_token(t);
+
+    *empty = (len == 0);
+    if (*empty){
+        return true;
+    }
+
+    item->line = t->line;
+    item->column = fault_loader_column(t);
+
+    if (fault_loader_is(t, len, "module")){
+        t->p += len;
+        item->module = true;
+        if (!fault_loader_arg(t, UINT_MAX, &item->codes, err) ||
+            !fault_loader_arg(t, UINT32_MAX, &item->tolerance, err)){
+            return false;
+        }
+    } else if (fault_loader_is(t, len, "policy")){
+        if (item->codes == 0){
+            return fault_loader_error(err, item->line, item->column,
+                                      "policy before any module");
+        }
+        t->p += len;
+        item->module = false;
+        item->modCodes = item->codes;
+        if (!fault_loader_codes(t, item, err)){
+            return false;
+        }
+
+        len = fault_loader_token(t);
+        int type = 0;
+        while (type < FAULT_POL_ALL &&
+               !fault_loader_is(t, len, policyNames[type])){
+            type++;
+        }
+        if (type == FAULT_POL_ALL){
+            return fault_loader_error(err, t->line, fault_loader_column(t),
+                                      "unknown policy");
+        }
+        t->p += len;
+
+        item->type = (fault_policy_type)type;
+        unsigned long *args[3] = {&item->warn, &item->err, &item->reset};
+        item->warn = item->err = item->reset = 0;
+        for (int i = 0; i < policyArgs[type]; i++){
+            if (!fault_loader_arg(t, ULONG_MAX, args[i], err)){
+                return false;
+            }
+        }
+
+        if (!fault_loader_policy(item, err)){
+            return false;
+        }
+    } else {
+        return fault_loader_error(err, item->line, item->column,
+                                  "unknown directive");
+    }
+
+    if (fault_loader_token(t) != 0){
+        return fault_loader_error(err, t->line, fault_loader_column(t),
+                                  "unexpected text");
+    }
+
+    return true;
+}/* fault_loader_line */
+
+/* Pass all the directives of the text to 'sink' */
+static
+bool fault_loader_text(const char *text,
+                       size_t len,
+                       fault_loader_sink sink,
+                       void *ctx,
+                       FaultLoaderError *err)
+{
+    FaultLoaderText t = {text, text + len, text, 1};
+    FaultLoaderItem item; /* 'codes' and 'mod' of the last module */
+    unsigned long modules = 0;
+
+    memset(&item, 0, sizeof(item));
+
+    while (t.p < t.end){
+        bool empty;
+
+        if (!fault_loader_line(&t, &item, &empty, err)){
+            return false;
+        }
+
+        if (!empty){
+            if (item.module){
+                item.mod = modules++;
+            }
+            if (!sink(&item, ctx, err)){
+                return false;
+            }
+        }
+
+        /* next line */
+        while (t.p < t.end && *t.p != '\n'){
+            t.p++;
+        }
+        if (t.p < t.end){
+            t.p++;
+            t.line++;
+            t.lineStart = t.p;
+        }
+    }/* while lines */
+
+    return true;
+}/* fault_loader_text */
+
+/* BINARY FORMAT */
+
+/* Pass all the directives of the binary configuration to 'sink' */
+static
+bool fault_loader_binary(const unsigned char *data,
+                         size_t len,
+                         fault_loader_sink sink,
+                         void *ctx,
+                         FaultLoaderError *err)
+{
+    if (len < FAULT_LOADER_HEADER ||
+        memcmp(data, FAULT_LOADER_MAGIC, 4) != 0){
+        return fault_loader_error(err, 0, 0, "not a binary configuration");
+    }
+
+    if (fault_loader_get32(data + 4) != FAULT_LOADER_VERSION){
+        return fault_loader_error(err, 0, 4, "wrong version");
+    }
+
+    unsigned long modules = fault_loader_get32(data + 8);
+    unsigned long policies = fault_loader_get32(data + 12);
+
+    if (len != FAULT_LOADER_HEADER +
+               (unsigned long long)modules * FAULT_LOADER_MODULE +
+               (unsigned long long)policies * FAULT_LOADER_POLICY){
+        return fault_loader_error(err, 0, 8, "wrong size");
+    }
+
+    FaultLoaderItem item;
+    const unsigned char *rec = data + FAULT_LOADER_HEADER;
+    const unsigned char *table = rec;
+
+    memset(&item, 0, sizeof(item));
+
+    for (unsigned long m = 0; m < modules; m++){
+        item.module = true;
+        item.codes = (fault_counter)fault_loader_get32(rec);
+        item.tolerance = (fault_counter)fault_loader_get32(rec + 4);
+        item.mod = m;
+        item.column = (size_t)(rec - data);
+
+        if (!sink(&item, ctx, err)){
+            return false;
+        }
+        rec += FAULT_LOADER_MODULE;
+    }/* for modules */
+
+    const unsigned char *end = rec + policies * FAULT_LOADER_POLICY;
+
+    while (rec < end){
+        unsigned long long warn = fault_loader_get64(rec + 16);
+        unsigned long long e = fault_loader_get64(rec + 24);
+        unsigned long long reset = fault_loader_get64(rec + 32);
+
+        item.module = false;
+        item.mod = fault_loader_get32(rec);
+        item.first = (fault_counter)fault_loader_get32(rec + 4);
+        item.last = (fault_counter)fault_loader_get32(rec + 8);
+        item.column = (size_t)(rec - data);
+
+        if (item.mod >= modules){
+            return fault_loader_error(err, 0, item.column,
+                                      "module out of the configuration");
+        }
+        item.modCodes = (fault_counter)fault_loader_get32(
+            table + item.mod * FAULT_LOADER_MODULE);
+
+        unsigned long type = fault_loader_get32(rec + 12);
+        if (type >= FAULT_POL_ALL){
+            return fault_loader_error(err, 0, item.column, "unknown policy");
+        }
+        if (warn > ULONG_MAX || e > ULONG_MAX || reset > ULONG_MAX){
+            return fault_loader_error(err, 0, item.column, "wrong number");
+        }
+        item.type = (fault_policy_type)type;
+        item.warn = (unsigned long)warn;
+        item.err = (unsigned long)e;
+        item.reset = (unsigned long)reset;
+
+        /* a single range for the next records of the same policy
+         * on the following codes (e.g. one record for each code)
+         */
+        const unsigned char *next = rec + FAULT_LOADER_POLICY;
+        while (next < end && item.first <= item.last &&
+               fault_loader_get32(next) == item.mod &&
+               fault_loader_get32(next + 4) == item.last + 1 &&
+               fault_loader_get32(next + 8) >= item.last + 1 &&
+               memcmp(next + 12, rec + 12, FAULT_LOADER_POLICY - 12) == 0){
+            item.last = (fault_counter)fault_loader_get32(next + 8);
+            next += FAULT_LOADER_POLICY;
+        }
+
+        if (!fault_loader_policy(&item, err) || !sink(&item, ctx, err)){
+            return false;
+        }
+        rec = next;
+    }/* while policies */
+
+    return true;
+}/* fault_loader_binary */
+
+bool fault_load_text(const char *text, size_t len, FaultLoaderError *err)
+{
+    FaultLoaderError dummy;
+    FaultLoaderCheck check = {true, fault_modules_length(),
+                              fault_loader_ids(), 0, 0};
+    fault_module base = fault_modules_length();
+
+    if (err == NULL){
+        err = &dummy;
+    }
+
+    if (!fault_loader_text(text, len, fault_loader_check, &check, err)){
+        return false;
+    }
+
+    /* input validated */
+
+    return fault_loader_text(text, len, fault_loader_apply, &base, err);
+}/* fault_load_text */
+
+bool fault_load_binary(const void *data, size_t len, FaultLoaderError *err)
+{
+    FaultLoaderError dummy;
+    FaultLoaderCheck check = {true, fault_modules_length(),
+                              fault_loader_ids(), 0, 0};
+    fault_module base = fault_modules_length();
+
+    if (err == NULL){
+        err = &dummy;
+    }
+
+    if (!fault_loader_binary(data, len, fault_loader_check, &check, err)){
+        return false;
+    }
+
+    /* input validated */
+
+    return fault_loader_binary(data, len, fault_loader_apply, &base, err);
+}/* fault_load_binary */
+
+bool fault_load_file(const char *path, FaultLoaderError *err)
+{
+    FaultLoaderError dummy;
+    struct stat st;
+    bool ok;
+
+    if (err == NULL){
+        err = &dummy;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0){
+        return fault_loader_error(err, 0, 0, "cannot open the file");
+    }
+
+    if (fstat(fd, &st) != 0){
+        close(fd);
+        return fault_loader_error(err, 0, 0, "cannot read the file");
+    }
+
+    size_t len = (size_t)st.st_size;
+    if (len == 0){
+        /* nothing to map */
+        close(fd);
+        return fault_load_text("", 0, err);
+    }
+
+    void *data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED){
+        return fault_loader_error(err, 0, 0, "cannot read the file");
+    }
+
+    if (len >= 4 && memcmp(data, FAULT_LOADER_MAGIC, 4) == 0){
+        ok = fault_load_binary(data, len, err);
+    } else {
+        ok = fault_load_text(data, len, err);
+    }
+
+    munmap(data, len);
+
+    return ok;
+}/* fault_load_file */
+
+size_t fault_load_compile(const char *text,
+                          size_t len,
+                          void *out,
+                          size_t size,
+                          FaultLoaderError *err)
+{
+    FaultLoaderError dummy;
+    FaultLoaderCheck check = {false, 0, 0, 0, 0};
+
+    if (err == NULL){
+        err = &dummy;
+    }
+
+    if (!fault_loader_text(text, len, fault_loader_check, &check, err)){
+        return 0;
+    }
+
+    if (check.fileModules > UINT32_MAX || check.filePolicies > UINT32_MAX){
+        fault_loader_error(err, 0, 0, "too many directives");
+        return 0;
+    }
+
+    size_t total = FAULT_LOADER_HEADER +
+                   check.fileModules * FAULT_LOADER_MODULE +
+                   check.filePolicies * FAULT_LOADER_POLICY;
+
+    if (out == NULL || size < total){
+        return total;
+    }
+
+    FaultLoaderWriter w = {out, FAULT_LOADER_HEADER,
+                           FAULT_LOADER_HEADER +
+                           check.fileModules * FAULT_LOADER_MODULE};
+
+    memcpy(w.out, FAULT_LOADER_MAGIC, 4);
+    fault_loader_put(w.out + 4, FAULT_LOADER_VERSION, 4);
+    fault_loader_put(w.out + 8, check.fileModules, 4);
+    fault_loader_put(w.out + 12, check.filePolicies, 4);
+
+    /* cannot fail, validated */
+    fault_loader_text(text, len, fault_loader_write, &w, err);
+
+    return total;
+}/* fault_load_compile */
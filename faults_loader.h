@@ -0,0 +1,80 @@
+#pragma once
+#include "faults.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Faults Loader - Modules and policies from a configuration file.
+ *
+ * The whole configuration is validated before changing the tables:
+ * in case of error nothing is configured. The modules are added after
+ * the ones already configured, so it is usually called after fault_init().
+ *
+ * Text format, one directive per line, '#' starts a comment:
+ *
+ *     module <codes> <tolerance>
+ *     policy <codes> none
+ *     policy <codes> count_abs <warn> <err>
+ *     policy <codes> count_reset <warn> <err> <reset>
+ *     policy <codes> time_reset <warn> <err> <reset>
+ *     policy <codes> heartbeat <warn> <err>
+ *
+ * The policies refer to the last module, <codes> is a code, a range
+ * of codes 'first-last' or '*' for all of them. Example:
+ *
+ *     module 16 2            # module 1
+ *     policy * count_abs 1 3
+ *     policy 4-7 time_reset 100 500 1000
+ *
+ * Binary format (little endian), from fault_load_compile():
+ *   header: "FLTC" u32 version, u32 modules, u32 policies
+ *   modules: u32 codes, u32 tolerance
+ *   policies: u32 module (0 for the first of the file), u32 first code,
+ *             u32 last code, u32 fault_policy_type,
+ *             u64 warn, u64 err, u64 reset
+ */
+
+#define FAULT_LOADER_VERSION 1
+
+/* Where the configuration is wrong */
+struct FaultLoaderError {
+    size_t line;   /* from 1, 0 for the binary format */
+    size_t column; /* from 1, the byte offset for the binary format */
+    const char *message;
+};
+
+typedef struct FaultLoaderError FaultLoaderError;
+
+/* Configure the modules and the policies of a text configuration.
+ * err: where the first error is, can be NULL.
+ * return false in case of error, the tables are not changed
+ */
+bool fault_load_text(const char *text, size_t len, FaultLoaderError *err);
+
+/* Configure the modules and the policies of a binary configuration.
+ * See fault_load_text().
+ */
+bool fault_load_binary(const void *data, size_t len, FaultLoaderError *err);
+
+/* Load a configuration file, text or binary (mapped in memory).
+ * See fault_load_text().
+ */
+bool fault_load_file(const char *path, FaultLoaderError *err);
+
+/* Convert a text configuration into the binary format.
+ * The text is validated as by fault_load_text(), except for the
+ * FAULT_MODULE_MAX and FAULT_ID_MAX limits checked when it is loaded.
+ * out: the binary configuration, written only if 'size' is enough.
+ * return the bytes of the binary configuration, 0 in case of error
+ */
+size_t fault_load_compile(const char *text,
+                          size_t len,
+                          void *out,
+                          size_t size,
+                          FaultLoaderError *err);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,755 @@
+/* Faults Merge
+ *
+ * A delta is a header, the records of the changed ids and the new logs.
+ * The producer keeps a copy of the values sent, to find the changes.
+ * The collector keeps for every source the values of the ids with the
+ * sequence of the delta that wrote them: an older delta cannot overwrite
+ * a newer one, so the order of the datagrams does not matter.
+ *
+ * Author: Omar Rampado <omar@ognibit.it>
+ * Version: 1.0.x
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "faults_merge.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FAULT_MERGE_MAGIC 0x44544c46U /* "FLTD" */
+/* flags of the header */
+#define FAULT_MERGE_FULL  1U
+/* datagrams merged by a fault_merge_poll() */
+#define FAULT_MERGE_POLL_MAX 4096
+/* status of an id not yet sent */
+#define FAULT_MERGE_UNSENT 0xffffffffU
+/* spans of the logs queues, each ring can wrap */
+#define FAULT_MERGE_SPANS (2 * (FAULT_MODULE_MAX + 1))
+
+/* Delta layout, fixed sizes */
+struct FaultMergeHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t source;
+    uint16_t records;
+    uint16_t logs;
+    uint64_t epoch; /* start of the producer, orders its restarts */
+    uint64_t seq;   /* from 1, by epoch */
+    uint64_t now;   /* fault_now() of the producer */
+};
+
+struct FaultMergeWireRecord {
+    uint32_t id;
+    uint32_t status;
+    uint64_t errors;
+    int64_t refValue;
+};
+
+struct FaultMergeWireLog {
+    uint64_t index;
+    uint64_t timestamp;
+    int64_t refValue;
+    uint32_t module;
+    uint32_t code;
+    uint32_t status;
+    uint32_t pad;
+};
+
+typedef struct FaultMergeHeader FaultMergeHeader;
+typedef struct FaultMergeWireRecord FaultMergeWireRecord;
+typedef struct FaultMergeWireLog FaultMergeWireLog;
+
+struct FaultMergeProducer {
+    uint64_t epoch; /* 0 before the first delta */
+    uint64_t seq;
+    bool full;      /* the next delta starts a full state */
+    bool more;      /* changes left by the last delta */
+    fault_id ids;    /* configured at the previous delta */
+    fault_id cursor; /* where the scan of the ids continues */
+    size_t logsNext; /* index of the next log to send */
+    FaultMergeWireRecord sent[FAULT_ID_MAX];
+    unsigned char buffer[FAULT_MERGE_DATAGRAM];
+};
+
+/* Values of an id of a source, seq 0 for never received */
+struct FaultMergeEntry {
+    uint64_t seq;
+    fault_counter errors;
+    long refValue;
+    fault_millisecs timestamp;
+    fault_status_type status;
+};
+
+typedef struct FaultMergeEntry FaultMergeEntry;
+
+struct FaultMergeSource {
+    uint32_t source;
+    uint64_t epoch;
+    fault_id ids; /* entries written, from 0 */
+    FaultMergeEntry entries[FAULT_ID_MAX];
+    /* tail of the logs, ring ordered by index */
+    FaultMergeLog logs[FAULT_MERGE_LOGS];
+    size_t logsFront;
+    size_t logsLen;
+    uint64_t logsNext; /* index after the newest log received */
+};
+
+typedef struct FaultMergeSource FaultMergeSource;
+
+struct FaultMergeCollector {
+    size_t len;
+    size_t last; /* source of the previous delta */
+    FaultMergeSource sources[FAULT_MERGE_SOURCES];
+    int fd;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    unsigned char buffer[FAULT_MERGE_DATAGRAM];
+};
+
+static struct FaultMergeProducer producer;
+static struct FaultMergeCollector collector = {.fd = -1};
+
+/* PROCEDURES */
+
+/* PRODUCER */
+
+static
+uint64_t fault_merge_epoch(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    uint64_t epoch = (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+
+    return (epoch == 0) ? 1 : epoch;
+}/* fault_merge_epoch */
+
+/* Number of configured ids, the codes of the modules in sequence */
+static
+fault_id fault_merge_ids(void)
+{
+    fault_module nmod = fault_modules_length();
+    fault_id n = 0;
+
+    for (fault_module m = 0; m < nmod; m++){
+        n = n + (fault_id)fault_module_codes(m);
+    }
+
+    assert(n <= FAULT_ID_MAX);
+
+    return n;
+}/* fault_merge_ids */
+
+void fault_merge_resync(void)
+{
+    producer.full = true;
+
+    for (fault_id i = 0; i < FAULT_ID_MAX; i++){
+        producer.sent[i].status = FAULT_MERGE_UNSENT;
+    }
+}/* fault_merge_resync */
+
+size_t fault_merge_delta(uint32_t source, void *buf, size_t size)
+{
+    if (buf == NULL || size < sizeof(FaultMergeHeader)){
+        return 0;
+    }
+
+    /* input validated */
+
+    /* the hot logs, in spans ordered by sequence (the 'index') */
+    FaultLogSpan spans[FAULT_MERGE_SPANS];
+    size_t at[FAULT_MERGE_SPANS];
+    size_t nspans = fault_logs_query(NULL, spans, FAULT_MERGE_SPANS);
+    bool logs = false;
+    size_t newest = 0;
+
+    for (size_t s = 0; s < nspans; s++){
+        size_t last = spans[s].logs[spans[s].len - 1].index;
+        if (!logs || last > newest){
+            newest = last;
+        }
+        logs = true;
+    }
+
+    /* a new epoch when the state is not a continuation of the sent one:
+     * first delta, modules configured again, logs reset
+     */
+    fault_id n = fault_merge_ids();
+    bool rewind = logs ? newest + 1 < producer.logsNext
+                       : producer.logsNext > 0;
+
+    if (producer.epoch == 0 || n != producer.ids || rewind){
+        producer.epoch = fault_merge_epoch();
+        producer.seq = 0;
+        producer.ids = n;
+        producer.cursor = 0;
+        producer.logsNext = 0;
+        fault_merge_resync();
+    }
+
+    /* first log not sent of every span */
+    for (size_t s = 0; s < nspans; s++){
+        size_t lo = 0;
+        size_t hi = spans[s].len;
+        while (lo < hi){
+            size_t mid = lo + (hi - lo) / 2;
+            if (spans[s].logs[mid].index < producer.logsNext){
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        at[s] = lo;
+    }/* for spans */
+
+    unsigned char *out = buf;
+    size_t room = size;
+    if (room > UINT16_MAX * sizeof(FaultMergeWireRecord)){
+        room = UINT16_MAX * sizeof(FaultMergeWireRecord);
+    }
+    room = room - sizeof(FaultMergeHeader);
+
+    FaultMergeHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = FAULT_MERGE_MAGIC;
+    h.version = FAULT_MERGE_VERSION;
+    h.flags = producer.full ? FAULT_MERGE_FULL : 0;
+    h.source = source;
+    h.epoch = producer.epoch;
+    producer.seq = producer.seq + 1;
+    h.seq = producer.seq;
+    h.now = fault_now();
+
+    producer.full = false;
+    producer.more = false;
+
+    /* records, scanning once all the ids from the cursor */
+    unsigned char *p = out + sizeof(FaultMergeHeader);
+    fault_id i = (producer.cursor < n) ? producer.cursor : 0;
+
+    for (fault_id k = 0; k < n; k++){
+        FaultMergeWireRecord *sent = &producer.sent[i];
+        FaultMergeWireRecord rec;
+        rec.id = i;
+        rec.status = (uint32_t)fault_status_unchecked(i);
+        rec.errors = fault_count_errors_unchecked(i);
+        rec.refValue = fault_refval_unchecked(i);
+
+        if (rec.status != sent->status ||
+            rec.errors != sent->errors ||
+            rec.refValue != sent->refValue){
+            if (room < sizeof(rec)){
+                producer.more = true;
+                break;
+            }
+            memcpy(p, &rec, sizeof(rec));
+            p += sizeof(rec);
+            room -= sizeof(rec);
+            h.records = h.records + 1;
+            *sent = rec;
+        }
+
+        i = (i + 1 < n) ? i + 1 : 0;
+    }/* for ids */
+
+    producer.cursor = i;
+
+    /* logs produced since the previous delta, the oldest first */
+    for (;;){
+        const FaultLog *log = NULL;
+        size_t from = 0;
+
+        for (size_t s = 0; s < nspans; s++){
+            if (at[s] < spans[s].len &&
+                (log == NULL || spans[s].logs[at[s]].index < log->index)){
+                log = &spans[s].logs[at[s]];
+                from = s;
+            }
+        }
+
+        if (log == NULL){
+            break;
+        }
+
+        if (room < sizeof(FaultMergeWireLog)){
+            producer.more = true;
+            break;
+        }
+
+        FaultMergeWireLog w;
+        memset(&w, 0, sizeof(w));
+        w.index = log->index;
+        w.timestamp = log->timestamp;
+        w.refValue = log->refValue;
+        w.module = log->module;
+        w.code = log->code;
+        w.status = (uint32_t)log->status;
+
+        memcpy(p, &w, sizeof(w));
+        p += sizeof(w);
+        room -= sizeof(w);
+        h.logs = h.logs + 1;
+        producer.logsNext = log->index + 1;
+        at[from]++;
+    }/* for logs */
+
+    memcpy(out, &h, sizeof(h));
+
+    return (size_t)(p - out);
+}/* fault_merge_delta */
+
+int fault_merge_connect(const char *path)
+{
+    struct sockaddr_un addr;
+
+    if (path == NULL || strlen(path) >= sizeof(addr.sun_path)){
+        return -1;
+    }
+
+    /* input validated */
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0){
+        return -1;
+    }
+
+    /* the producer never waits for the collector */
+    int fl = fcntl(fd, F_GETFL, 0);
+    if (fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) != 0 ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}/* fault_merge_connect */
+
+int fault_merge_send(int fd, uint32_t source)
+{
+    if (fd < 0){
+        return -1;
+    }
+
+    /* input validated */
+
+    int sent = 0;
+
+    do {
+        size_t len = fault_merge_delta(source, producer.buffer,
+                                       sizeof(producer.buffer));
+        assert(len > 0);
+
+        if (send(fd, producer.buffer, len, MSG_NOSIGNAL) != (ssize_t)len){
+            fault_merge_resync();
+            return -1;
+        }
+        sent++;
+    } while (producer.more);
+
+    return sent;
+}/* fault_merge_send */
+
+/* COLLECTOR */
+
+/* Forget the values of the source, for a new epoch */
+static
+void fault_merge_source_clear(FaultMergeSource *src, uint64_t epoch)
+{
+    memset(src->entries, 0, sizeof(FaultMergeEntry) * src->ids);
+    src->ids = 0;
+    src->epoch = epoch;
+    src->logsFront = 0;
+    src->logsLen = 0;
+    src->logsNext = 0;
+}/* fault_merge_source_clear */
+
+void fault_merge_reset(void)
+{
+    /* the sources not in use are always clear */
+    for (size_t i = 0; i < collector.len; i++){
+        fault_merge_source_clear(&collector.sources[i], 0);
+    }
+
+    collector.len = 0;
+    collector.last = 0;
+}/* fault_merge_reset */
+
+/* The source of a delta, added if new. return NULL if full */
+static
+FaultMergeSource *fault_merge_find(uint32_t source)
+{
+    if (collector.last < collector.len &&
+        collector.sources[collector.last].source == source){
+        return &collector.sources[collector.last];
+    }
+
+    for (size_t i = 0; i < collector.len; i++){
+        if (collector.sources[i].source == source){
+            collector.last = i;
+            return &collector.sources[i];
+        }
+    }
+
+    if (collector.len == FAULT_MERGE_SOURCES){
+        return NULL;
+    }
+
+    FaultMergeSource *src = &collector.sources[collector.len];
+    assert(src->ids == 0 && src->epoch == 0);
+    src->source = source;
+    collector.last = collector.len;
+    collector.len = collector.len + 1;
+
+    return src;
+}/* fault_merge_find */
+
+static
+void fault_merge_log_add(FaultMergeSource *src,
+                         uint32_t source,
+                         const FaultMergeWireLog *w)
+{
+    /* position in the tail, ordered by index: at the end unless the
+     * deltas arrived out of order */
+    size_t pos = src->logsLen;
+    if (w->index < src->logsNext){
+        while (pos > 0){
+            size_t prev = (src->logsFront + pos - 1) % FAULT_MERGE_LOGS;
+            if (src->logs[prev].log.index == w->index){
+                return; /* repeated */
+            }
+            if (src->logs[prev].log.index < w->index){
+                break;
+            }
+            pos--;
+        }
+    } else {
+        src->logsNext = w->index + 1;
+    }
+
+    if (src->logsLen == FAULT_MERGE_LOGS){
+        if (pos == 0){
+            return; /* older than the tail kept */
+        }
+        src->logsFront = (src->logsFront + 1) % FAULT_MERGE_LOGS;
+        src->logsLen = src->logsLen - 1;
+        pos--;
+    }
+
+    /* the newer ones move forward */
+    for (size_t k = src->logsLen; k > pos; k--){
+        src->logs[(src->logsFront + k) % FAULT_MERGE_LOGS] =
+            src->logs[(src->logsFront + k - 1) % FAULT_MERGE_LOGS];
+    }
+    src->logsLen = src->logsLen + 1;
+
+    FaultMergeLog *ml = &src->logs[(src->logsFront + pos) % FAULT_MERGE_LOGS];
+    ml->source = source;
+    ml->log.saved = true;
+    ml->log.index = (size_t)w->index;
+    ml->log.timestamp = (fault_millisecs)w->timestamp;
+    ml->log.module = w->module;
+    ml->log.code = w->code;
+    ml->log.status = (fault_status_type)w->status;
+    ml->log.refValue = (long)w->refValue;
+}/* fault_merge_log_add */
+
+bool fault_merge_apply(const void *delta, size_t len)
+{
+    const unsigned char *in = delta;
+    FaultMergeHeader h;
+
+    if (in == NULL || len < sizeof(h)){
+        return false;
+    }
+
+    memcpy(&h, in, sizeof(h));
+
+    if (h.magic != FAULT_MERGE_MAGIC || h.version != FAULT_MERGE_VERSION ||
+        h.seq == 0 ||
+        len != sizeof(h) + h.records * sizeof(FaultMergeWireRecord) +
+               h.logs * sizeof(FaultMergeWireLog)){
+        return false;
+    }
+
+    const unsigned char *recs = in + sizeof(h);
+    const unsigned char *logs = recs + h.records * sizeof(FaultMergeWireRecord);
+
+    for (uint16_t r = 0; r < h.records; r++){
+        FaultMergeWireRecord rec;
+        memcpy(&rec, recs + r * sizeof(rec), sizeof(rec));
+        if (rec.id >= FAULT_ID_MAX || rec.status > FAULT_ST_ERROR){
+            return false;
+        }
+    }
+
+    for (uint16_t l = 0; l < h.logs; l++){
+        FaultMergeWireLog w;
+        memcpy(&w, logs + l * sizeof(w), sizeof(w));
+        if (w.status > FAULT_ST_ERROR){
+            return false;
+        }
+    }
+
+    FaultMergeSource *src = fault_merge_find(h.source);
+    if (src == NULL){
+        return false;
+    }
+
+    /* input validated */
+
+    if (h.epoch < src->epoch){
+        /* from before a restart of the producer */
+        return true;
+    }
+
+    if (h.epoch > src->epoch){
+        fault_merge_source_clear(src, h.epoch);
+    }
+
+    for (uint16_t r = 0; r < h.records; r++){
+        FaultMergeWireRecord rec;
+        memcpy(&rec, recs + r * sizeof(rec), sizeof(rec));
+
+        FaultMergeEntry *e = &src->entries[rec.id];
+        if (e->seq < h.seq){
+            e->seq = h.seq;
+            e->status = (fault_status_type)rec.status;
+            e->errors = (fault_counter)rec.errors;
+            e->refValue = (long)rec.refValue;
+            e->timestamp = (fault_millisecs)h.now;
+        }
+
+        if (rec.id >= src->ids){
+            src->ids = rec.id + 1;
+        }
+    }/* for records */
+
+    for (uint16_t l = 0; l < h.logs; l++){
+        FaultMergeWireLog w;
+        memcpy(&w, logs + l * sizeof(w), sizeof(w));
+        fault_merge_log_add(src, h.source, &w);
+    }
+
+    return true;
+}/* fault_merge_apply */
+
+bool fault_merge_listen(const char *path)
+{
+    struct sockaddr_un addr;
+
+    if (collector.fd >= 0){
+        return false;
+    }
+
+    if (path == NULL || strlen(path) >= sizeof(addr.sun_path)){
+        return false;
+    }
+
+    /* input validated */
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0){
+        return false;
+    }
+
+    unlink(path);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+        close(fd);
+        return false;
+    }
+
+    strcpy(collector.path, path);
+    collector.fd = fd;
+
+    return true;
+}/* fault_merge_listen */
+
+size_t fault_merge_poll(int timeout)
+{
+    if (collector.fd < 0){
+        return 0;
+    }
+
+    /* input validated */
+
+    struct pollfd pfd = {collector.fd, POLLIN, 0};
+    if (poll(&pfd, 1, timeout) <= 0){
+        return 0;
+    }
+
+    size_t merged = 0;
+
+    for (size_t i = 0; i < FAULT_MERGE_POLL_MAX; i++){
+        ssize_t r = recv(collector.fd, collector.buffer,
+                         sizeof(collector.buffer), MSG_DONTWAIT);
+        if (r < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            break; /* EAGAIN, nothing else queued */
+        }
+
+        if (fault_merge_apply(collector.buffer, (size_t)r)){
+            merged++;
+        }
+    }/* for datagrams */
+
+    return merged;
+}/* fault_merge_poll */
+
+void fault_merge_close(void)
+{
+    if (collector.fd < 0){
+        return;
+    }
+
+    close(collector.fd);
+    collector.fd = -1;
+    unlink(collector.path);
+}/* fault_merge_close */
+
+size_t fault_merge_sources(void)
+{
+    return collector.len;
+}/* fault_merge_sources */
+
+bool fault_merge_source(size_t index, uint32_t *source)
+{
+    if (index >= collector.len || source == NULL){
+        return false;
+    }
+
+    /* input validated */
+
+    *source = collector.sources[index].source;
+
+    return true;
+}/* fault_merge_source */
+
+static
+void fault_merge_copy(FaultMergeRecord *out, const FaultMergeEntry *e)
+{
+    out->status = e->status;
+    out->errors = e->errors;
+    out->refValue = e->refValue;
+    out->timestamp = e->timestamp;
+}/* fault_merge_copy */
+
+bool fault_merge_record(uint32_t source, fault_id id, FaultMergeRecord *out)
+{
+    if (id >= FAULT_ID_MAX || out == NULL){
+        return false;
+    }
+
+    /* input validated */
+
+    for (size_t i = 0; i < collector.len; i++){
+        const FaultMergeSource *src = &collector.sources[i];
+        if (src->source == source){
+            if (id >= src->ids || src->entries[id].seq == 0){
+                return false;
+            }
+            fault_merge_copy(out, &src->entries[id]);
+            return true;
+        }
+    }
+
+    return false;
+}/* fault_merge_record */
+
+bool fault_merge_total(fault_id id, FaultMergeRecord *out)
+{
+    if (id >= FAULT_ID_MAX || out == NULL){
+        return false;
+    }
+
+    /* input validated */
+
+    bool found = false;
+
+    for (size_t i = 0; i < collector.len; i++){
+        const FaultMergeSource *src = &collector.sources[i];
+        if (id >= src->ids || src->entries[id].seq == 0){
+            continue;
+        }
+
+        const FaultMergeEntry *e = &src->entries[id];
+        if (!found){
+            fault_merge_copy(out, e);
+            found = true;
+            continue;
+        }
+
+        out->errors = out->errors + e->errors;
+        if (e->status > out->status){
+            out->status = e->status;
+        }
+        /* the reference value of the latest */
+        if (e->timestamp > out->timestamp){
+            out->timestamp = e->timestamp;
+            out->refValue = e->refValue;
+        }
+    }/* for sources */
+
+    return found;
+}/* fault_merge_total */
+
+size_t fault_merge_logs(FaultMergeLog *out, size_t max)
+{
+    if (out == NULL){
+        return 0;
+    }
+
+    /* input validated */
+
+    /* logs still to take of each source, the most recent at the end */
+    size_t left[FAULT_MERGE_SOURCES];
+    for (size_t i = 0; i < collector.len; i++){
+        left[i] = collector.sources[i].logsLen;
+    }
+
+    size_t n = 0;
+    while (n < max){
+        const FaultMergeLog *best = NULL;
+        size_t from = 0;
+
+        for (size_t i = 0; i < collector.len; i++){
+            const FaultMergeSource *src = &collector.sources[i];
+            if (left[i] == 0){
+                continue;
+            }
+            size_t at = (src->logsFront + left[i] - 1) % FAULT_MERGE_LOGS;
+            if (best == NULL ||
+                src->logs[at].log.timestamp > best->log.timestamp){
+                best = &src->logs[at];
+                from = i;
+            }
+        }/* for sources */
+
+        if (best == NULL){
+            break;
+        }
+
+        out[n] = *best;
+        left[from]--;
+        n++;
+    }/* while room */
+
+    return n;
+}/* fault_merge_logs */
@@ -0,0 +1,158 @@
+#pragma once
+#include "faults.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Faults Merge - Fleet view of the faults of many processes.
+ *
+ * Every producer (a process using faults.c) sends deltas of its state:
+ * the ids changed since the previous delta and the new logs.
+ * A collector merges the deltas of all the sources:
+ *
+ *     producer                          collector
+ *     int fd = fault_merge_connect(p);  fault_merge_listen(p);
+ *     fault_merge_send(fd, source);     fault_merge_poll(100);
+ *                                       fault_merge_total(id, &rec);
+ *
+ * The merge is idempotent and commutative: the values of an id are the
+ * ones of the most recent delta of the source (last writer wins by the
+ * sequence of the producer), duplicated or late deltas change nothing.
+ * So the collectors can forward the datagrams unchanged to upper
+ * collectors (host, line, ...).
+ * Across sources the errors are summed, the statuses and the timestamps
+ * take the maximum, the logs are the union of the tails of the sources
+ * (the last FAULT_MERGE_LOGS by index, also when the deltas arrive out
+ * of order).
+ * The timestamps are the fault_now() of each producer: the comparisons
+ * across sources (the reference value of the total, the order of the
+ * logs) are meaningful only when all the producers share the clock,
+ * e.g. CLOCK_MONOTONIC on the same host or a synchronized wall clock.
+ *
+ * A producer restarted (new epoch) replaces all the values of its source.
+ * The datagrams are in native byte order, for Unix sockets.
+ *
+ * Compilation Flags:
+ *
+ * FAULT_MERGE_SOURCES max number of sources in the collector.
+ *                Default: 8
+ * FAULT_MERGE_LOGS logs kept for each source in the collector.
+ *                Default: 16
+ * FAULT_MERGE_DATAGRAM max bytes of a delta datagram.
+ *                Default: 4096
+ */
+
+#ifndef FAULT_MERGE_SOURCES
+#define FAULT_MERGE_SOURCES 8
+#endif
+
+#ifndef FAULT_MERGE_LOGS
+#define FAULT_MERGE_LOGS 16
+#endif
+
+#ifndef FAULT_MERGE_DATAGRAM
+#define FAULT_MERGE_DATAGRAM 4096
+#endif
+
+#define FAULT_MERGE_VERSION 1
+
+/* Merged values of an id */
+struct FaultMergeRecord {
+    fault_status_type status;
+    fault_counter errors;
+    long refValue;
+    fault_millisecs timestamp; /* clock of the producer at the delta */
+};
+
+typedef struct FaultMergeRecord FaultMergeRecord;
+
+/* A log of a source */
+struct FaultMergeLog {
+    uint32_t source;
+    FaultLog log; /* 'index' is the position in the source history */
+};
+
+typedef struct FaultMergeLog FaultMergeLog;
+
+/* PRODUCER */
+
+/* Write a delta with the changes since the previous one.
+ * The first delta (and the first after fault_merge_resync()) has all the
+ * configured ids. When 'size' is not enough for all the changes, the
+ * others go in the next deltas.
+ * source: identifier of the producer, unique in the fleet.
+ * return the bytes of the delta, 0 if 'size' is too small
+ */
+size_t fault_merge_delta(uint32_t source, void *buf, size_t size);
+
+/* The next delta has the full state, e.g. after a delta is lost */
+void fault_merge_resync(void);
+
+/* Open a datagram socket toward the collector on the Unix socket 'path'.
+ * return the file descriptor, -1 on error
+ */
+int fault_merge_connect(const char *path);
+
+/* Send the deltas on 'fd' until all the changes are sent.
+ * On error the next delta has the full state.
+ * return the number of datagrams sent, -1 on error
+ */
+int fault_merge_send(int fd, uint32_t source);
+
+/* COLLECTOR */
+
+/* Forget all the sources */
+void fault_merge_reset(void);
+
+/* Merge a delta.
+ * return false if malformed or there is no room for a new source
+ */
+bool fault_merge_apply(const void *delta, size_t len);
+
+/* Receive the deltas on the Unix socket 'path'.
+ * An existing file at 'path' is replaced.
+ * return false in case of error (already listening, socket errors)
+ */
+bool fault_merge_listen(const char *path);
+
+/* Merge the deltas received, waiting up to 'timeout' milliseconds
+ * (-1 for ever) for the first one.
+ * return the number of deltas merged
+ */
+size_t fault_merge_poll(int timeout);
+
+/* Close the socket of fault_merge_listen() and remove it */
+void fault_merge_close(void);
+
+/* Number of sources merged */
+size_t fault_merge_sources(void);
+
+/* The source at position 'index', from 0 to fault_merge_sources()-1.
+ * return false if out of range
+ */
+bool fault_merge_source(size_t index, uint32_t *source);
+
+/* The values of the id of a source.
+ * return false for a source not merged or an id never received
+ */
+bool fault_merge_record(uint32_t source, fault_id id, FaultMergeRecord *out);
+
+/* The values of the id merged across all the sources.
+ * The reference value is the one of the latest timestamp, the producers
+ * must share the clock (see above).
+ * return false for an id never received
+ */
+bool fault_merge_total(fault_id id, FaultMergeRecord *out);
+
+/* The logs of all the sources, the most recent first (by timestamp,
+ * the producers must share the clock; by index within a source).
+ * return the number of logs written in 'out'
+ */
+size_t fault_merge_logs(FaultMergeLog *out, size_t max);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,114 @@
+#pragma once
+#include "faults.h"
+#include <stdint.h>
+
+/*
+ * Faults Module - Internal structures.
+ *
+ * Shared with the extensions that reuse the policies logic
+ * (e.g. faults_whatif.c). NOT part of the public interface.
+ */
+
+/* Configuration for FAULT_POL_COUNT_ABS */
+struct FaultPolicyCountAbs {
+    fault_counter cntWarning;
+    fault_counter cntError;
+};
+
+/* Configuration for FAULT_POL_COUNT_RESET */
+struct FaultPolicyCountReset {
+    fault_counter cntWarning;
+    fault_counter cntError;
+    fault_counter cntReset;
+};
+
+/* Configuration for FAULT_POL_TIME_RESET */
+struct FaultPolicyTimeReset {
+    fault_millisecs msWarning;
+    fault_millisecs msError;
+    fault_millisecs msReset;
+};
+
+/* Configuration for FAULT_POL_HEARTBEAT */
+struct FaultPolicyHeartbeat {
+    fault_millisecs msWarning;
+    fault_millisecs msError;
+};
+
+struct FaultPolicy {
+    fault_policy_type type;
+    union { /* 'conf' based on 'type' */
+        /* FAULT_POL_NONE has no configuration */
+        /* FAULT_POL_COUNT_ABS */
+        struct FaultPolicyCountAbs countAbs;
+        /* FAULT_POL_COUNT_RESET */
+        struct FaultPolicyCountReset countReset;
+        /* FAULT_POL_TIME_RESET */
+        struct FaultPolicyTimeReset timeReset;
+        /* FAULT_POL_HEARTBEAT */
+        struct FaultPolicyHeartbeat heartbeat;
+    } conf;
+};
+
+typedef struct FaultPolicy FaultPolicy;
+
+/* Types of the counters record, see FAULT_COMPACT.
+ * The record timestamps are compared only by difference,
+ * so they can be truncated.
+ */
+#if FAULT_COMPACT
+typedef uint32_t fault_rec_counter;
+typedef uint32_t fault_rec_millisecs;
+typedef int32_t fault_rec_ref;
+#define FAULT_REC_COUNTER_MAX UINT32_MAX
+#else
+typedef fault_counter fault_rec_counter;
+typedef fault_millisecs fault_rec_millisecs;
+typedef long fault_rec_ref;
+#define FAULT_REC_COUNTER_MAX ULONG_MAX
+#endif
+
+/* Register for a single fault, the row index is the fault_id.
+ * It is updated during the validations and the policies applications.
+ * The status is kept apart, so the record stays small.
+ */
+struct FaultCounterRecord {
+    fault_rec_counter errors; /* fault counter */
+    fault_rec_counter total;  /* all (faults + not faults) counter */
+    fault_rec_counter clear;   /* number of consecutive not faults */
+    fault_rec_millisecs msFirst; /* timestamp of the first fault */
+    fault_rec_millisecs msLast;  /* timestamp of the last fault */
+    fault_rec_ref refValue; /* a user reference value to add information */
+};
+
+typedef struct FaultCounterRecord FaultCounterRecord;
+
+/* Build a policy, with the same validation of the fault_policy_*().
+ * warn, err, reset: as in the fault_policy_*(), unused values are ignored.
+ * return false in case of wrong parameters
+ */
+bool fault_policy_make(FaultPolicy *policy,
+                       fault_policy_type type,
+                       unsigned long warn,
+                       unsigned long err,
+                       unsigned long reset);
+
+/* Set the policy to the ids [first, first + n), validated once.
+ * Unlike the fault_policy_*() the counters are not reset: it is meant for
+ * the ids of the modules just configured, that are clean.
+ * return false for a wrong range
+ */
+bool fault_policy_range(fault_id first, fault_id n, const FaultPolicy *policy);
+
+/* Erase the counters of the record */
+void fault_record_reset(FaultCounterRecord *rec);
+
+/* Count the event in the record and apply the policy.
+ * It is the core of fault_update(), without the logs.
+ * return the new status
+ */
+fault_status_type fault_record_update(const FaultPolicy *policy,
+                                      FaultCounterRecord *rec,
+                                      fault_millisecs now,
+                                      long ref,
+                                      bool condition);
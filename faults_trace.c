@@ -0,0 +1,321 @@
+/* Faults Trace
+ *
+ * Author: Omar Rampado <omar@ognibit.it>
+ * Version: 1.0.x
+ */
+
+#include "faults_trace.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FAULT_TRACE_MAGIC "FLTR"
+/* worst case size of an event, 4 varints */
+#define FAULT_TRACE_EVENT_MAX 40
+
+/* the trace being recorded */
+static FaultTrace *recording = NULL;
+
+/* virtual time during the replay */
+static fault_millisecs replayNow = 0;
+
+/* PROCEDURES */
+
+static
+unsigned long fault_trace_zigzag(unsigned long delta)
+{
+    /* delta is a two's complement difference */
+    return (delta << 1) ^ (0UL - (delta >> (sizeof(delta) * CHAR_BIT - 1)));
+}/* fault_trace_zigzag */
+
+static
+unsigned long fault_trace_unzigzag(unsigned long z)
+{
+    return (z >> 1) ^ (0UL - (z & 1UL));
+}/* fault_trace_unzigzag */
+
+static
+size_t fault_trace_put(unsigned char *buf, unsigned long v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80){
+        buf[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (unsigned char)v;
+
+    return n;
+}/* fault_trace_put */
+
+/* Read a varint, not beyond 'end'.
+ * return the pointer after the varint, NULL if truncated
+ */
+static
+const unsigned char *fault_trace_get(const unsigned char *buf,
+                                     const unsigned char *end,
+                                     unsigned long *v)
+{
+    unsigned long out = 0;
+    unsigned int shift = 0;
+
+    while (buf < end && shift < sizeof(out) * CHAR_BIT){
+        unsigned char b = *buf++;
+        out |= (unsigned long)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0){
+            *v = out;
+            return buf;
+        }
+        shift += 7;
+    }/* while */
+
+    return NULL;
+}/* fault_trace_get */
+
+/* fault_update_hook */
+static
+void fault_trace_record(fault_millisecs now,
+                        fault_id id,
+                        long ref,
+                        bool condition,
+                        fault_counter count,
+                        void *ctx)
+{
+    FaultTrace *trace = (FaultTrace*)ctx;
+
+    if (trace->size - trace->used < FAULT_TRACE_EVENT_MAX){
+        trace->dropped = trace->dropped + 1;
+        return;
+    }
+
+    unsigned char *buf = trace->data + trace->used;
+    unsigned long bulk = (count != 1) ? 2UL : 0UL;
+    size_t n = 0;
+
+    n += fault_trace_put(buf + n, fault_trace_zigzag(now - trace->tsLast));
+    n += fault_trace_put(buf + n, ((unsigned long)id << 2) | bulk |
+                                  (condition ? 1UL : 0UL));
+    n += fault_trace_put(buf + n, fault_trace_zigzag((unsigned long)ref));
+    if (bulk != 0){
+        n += fault_trace_put(buf + n, (unsigned long)count);
+    }
+
+    assert(n <= FAULT_TRACE_EVENT_MAX);
+
+    trace->used = trace->used + n;
+    trace->events = trace->events + 1;
+    trace->tsLast = now;
+}/* fault_trace_record */
+
+static
+fault_millisecs fault_trace_clock(void)
+{
+    return replayNow;
+}/* fault_trace_clock */
+
+bool fault_trace_start(FaultTrace *trace, void *buf, size_t size)
+{
+    if (recording != NULL || trace == NULL || buf == NULL){
+        return false;
+    }
+
+    if (size < FAULT_TRACE_HEADER_SIZE + FAULT_TRACE_EVENT_MAX){
+        return false;
+    }
+
+    /* input validated */
+
+    memset(trace, 0, sizeof(FaultTrace));
+    trace->data = (unsigned char*)buf;
+    trace->size = size;
+
+    memcpy(trace->data, FAULT_TRACE_MAGIC, 4);
+    trace->data[4] = FAULT_TRACE_VERSION;
+    trace->data[5] = 0;
+    trace->data[6] = 0;
+    trace->data[7] = 0;
+    trace->used = FAULT_TRACE_HEADER_SIZE;
+
+    recording = trace;
+    fault_conf_update_hook(fault_trace_record, trace);
+
+    return true;
+}/* fault_trace_start */
+
+void fault_trace_stop(void)
+{
+    if (recording == NULL){
+        return;
+    }
+
+    fault_conf_update_hook(NULL, NULL);
+    recording = NULL;
+}/* fault_trace_stop */
+
+/* Verify the header of the trace */
+static
+bool fault_trace_valid(const unsigned char *data, size_t used)
+{
+    return (data != NULL &&
+            used >= FAULT_TRACE_HEADER_SIZE &&
+            memcmp(data, FAULT_TRACE_MAGIC, 4) == 0 &&
+            data[4] == FAULT_TRACE_VERSION &&
+            data[5] == 0 && data[6] == 0 && data[7] == 0);
+}/* fault_trace_valid */
+
+/* Check the framing of all the events.
+ * return the number of events, -1 for a truncated event
+ */
+static
+long fault_trace_count(const unsigned char *p, const unsigned char *end)
+{
+    long n = 0;
+
+    while (p < end){
+        unsigned long v = 0;
+        unsigned long idc = 0;
+
+        p = fault_trace_get(p, end, &v);
+        if (p != NULL){
+            p = fault_trace_get(p, end, &idc);
+        }
+        if (p != NULL){
+            p = fault_trace_get(p, end, &v);
+        }
+        if (p != NULL && (idc & 2UL) != 0){
+            p = fault_trace_get(p, end, &v);
+        }
+        if (p == NULL){
+            return -1;
+        }
+        n++;
+    }
+
+    return n;
+}/* fault_trace_count */
+
+long fault_trace_decode(const void *data,
+                        size_t used,
+                        fault_update_hook visit,
+                        void *ctx)
+{
+    const unsigned char *buf = (const unsigned char*)data;
+
+    if (!fault_trace_valid(buf, used)){
+        return -1;
+    }
+
+    const unsigned char *end = buf + used;
+    const unsigned char *p = buf + FAULT_TRACE_HEADER_SIZE;
+
+    /* nothing is visited of a truncated trace */
+    long n = fault_trace_count(p, end);
+    if (n < 0 || visit == NULL){
+        return n;
+    }
+
+    /* input validated */
+
+    fault_millisecs ts = 0;
+
+    while (p < end){
+        unsigned long dts = 0;
+        unsigned long idc = 0;
+        unsigned long ref = 0;
+        unsigned long count = 1;
+
+        p = fault_trace_get(p, end, &dts);
+        p = fault_trace_get(p, end, &idc);
+        p = fault_trace_get(p, end, &ref);
+        if ((idc & 2UL) != 0){
+            p = fault_trace_get(p, end, &count);
+        }
+
+        ts = ts + fault_trace_unzigzag(dts);
+
+        visit(ts,
+              (fault_id)(idc >> 2),
+              (long)fault_trace_unzigzag(ref),
+              (idc & 1UL) != 0,
+              (fault_counter)count,
+              ctx);
+    }/* while */
+
+    return n;
+}/* fault_trace_decode */
+
+/* fault_update_hook for the replay */
+static
+void fault_trace_feed(fault_millisecs now,
+                      fault_id id,
+                      long ref,
+                      bool condition,
+                      fault_counter n,
+                      void *ctx)
+{
+    (void)ctx;
+
+    replayNow = now;
+    if (n == 1){
+        fault_update(id, ref, condition);
+    } else if (condition){
+        fault_update_fault_n(id, ref, n);
+    } else {
+        fault_update_clear_n(id, n);
+    }
+}/* fault_trace_feed */
+
+long fault_trace_replay(const void *data, size_t used)
+{
+    fault_conf_clock(fault_trace_clock);
+
+    long n = fault_trace_decode(data, used, fault_trace_feed, NULL);
+
+    fault_conf_clock(NULL);
+
+    return n;
+}/* fault_trace_replay */
+
+bool fault_trace_save(const FaultTrace *trace, const char *path)
+{
+    if (trace == NULL || path == NULL){
+        return false;
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL){
+        return false;
+    }
+
+    bool ok = (fwrite(trace->data, 1, trace->used, f) == trace->used);
+
+    if (fclose(f) != 0){
+        ok = false;
+    }
+
+    return ok;
+}/* fault_trace_save */
+
+long fault_trace_load(const char *path, void *buf, size_t size)
+{
+    if (path == NULL || buf == NULL){
+        return -1;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL){
+        return -1;
+    }
+
+    size_t n = fread(buf, 1, size, f);
+    bool more = (n == size && fgetc(f) != EOF);
+    fclose(f);
+
+    if (more || n > LONG_MAX ||
+        !fault_trace_valid((const unsigned char*)buf, n)){
+        return -1;
+    }
+
+    return (long)n;
+}/* fault_trace_load */
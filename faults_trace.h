@@ -0,0 +1,85 @@
+#pragma once
+#include "faults.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Faults Trace - Record and replay of the fault_update() input.
+ *
+ * The capture records every (timestamp, id, ref, condition) given to
+ * fault_update() into a user buffer, about 4 bytes per event.
+ * The replay feeds the events back to fault_update() with their original
+ * timestamps, so with the same configuration it reproduces the same
+ * statuses and logs. It is used to tune the policies offline.
+ * The fault_update_*_n() are recorded as a single bulk event and replayed
+ * by the same procedure (a count of 1 is a fault_update(), it differs only
+ * for fault_conf_refstats(), with a sample of 0 for fault_update_clear_n()).
+ *
+ * Trace format:
+ *   header: "FLTR" u32 version (little endian)
+ *   events: varint zigzag(timestamp delta),
+ *           varint (id << 2 | bulk << 1 | condition),
+ *           varint zigzag(ref),
+ *           varint n, only for a bulk event
+ */
+
+#define FAULT_TRACE_VERSION 2
+#define FAULT_TRACE_HEADER_SIZE 8
+
+struct FaultTrace {
+    unsigned char *data;
+    size_t size;  /* capacity of data */
+    size_t used;  /* bytes written, header included */
+    unsigned long events;  /* events recorded, a bulk update is one */
+    unsigned long dropped; /* events lost, the buffer was full */
+    fault_millisecs tsLast; /* timestamp of the last event */
+};
+
+typedef struct FaultTrace FaultTrace;
+
+/* Start recording into 'buf'.
+ * It registers itself with fault_conf_update_hook(), so it must be
+ * called after fault_init(). Only one trace can be recorded at a time.
+ * return false in case of error (already recording, buffer too small)
+ */
+bool fault_trace_start(FaultTrace *trace, void *buf, size_t size);
+
+/* Stop the recording, 'trace' keeps the data */
+void fault_trace_stop(void);
+
+/* Feed the events of a trace to fault_update() and fault_update_*_n().
+ * The library must be configured as it was during the recording.
+ * During the replay the time source is the trace (see fault_conf_clock()),
+ * at the end fault_now() is restored.
+ * The whole trace is validated first: an invalid one changes nothing.
+ * return the number of events replayed, -1 for an invalid trace
+ */
+long fault_trace_replay(const void *data, size_t used);
+
+/* Read the events of a trace, in order.
+ * visit: called for every event, as it was given to the update hook
+ *        (see fault_conf_update_hook()), never for an invalid trace
+ *        (validated first).
+ * return the number of events read, -1 for an invalid trace
+ */
+long fault_trace_decode(const void *data,
+                        size_t used,
+                        fault_update_hook visit,
+                        void *ctx);
+
+/* Write the trace data into a file.
+ * return false in case of error
+ */
+bool fault_trace_save(const FaultTrace *trace, const char *path);
+
+/* Read a trace file into 'buf'.
+ * return the number of bytes read, -1 in case of error
+ *        (cannot read, too big, not a trace)
+ */
+long fault_trace_load(const char *path, void *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,295 @@
+/* Faults What-If
+ *
+ * Author: Omar Rampado <omar@ognibit.it>
+ * Version: 1.0.x
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "faults_whatif.h"
+#include "faults_private.h"
+#include "faults_trace.h"
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FAULT_WHATIF_THREADS_MAX 256
+/* candidates evaluated together, their state stays in cache */
+#define FAULT_WHATIF_BLOCK 256
+
+/* State of a candidate during the evaluation */
+struct FaultWhatIfState {
+    FaultPolicy policy;
+    FaultCounterRecord record;
+    fault_status_type status;
+    bool alarm; /* in an episode out of NORMAL */
+    bool alarmError; /* the episode reached ERROR */
+};
+
+typedef struct FaultWhatIfState FaultWhatIfState;
+
+/* Work of a thread: candidates [first, last) */
+struct FaultWhatIfJob {
+    const FaultWhatIfGrid *grid;
+    const FaultWhatIfEvent *events;
+    size_t nevents;
+    FaultWhatIfResult *out;
+    size_t first;
+    size_t last;
+    pthread_t thread;
+    bool threaded; /* false when run by the caller */
+};
+
+typedef struct FaultWhatIfJob FaultWhatIfJob;
+
+/* Selection of the events of an id from a trace */
+struct FaultWhatIfSelect {
+    fault_id id;
+    FaultWhatIfEvent *out;
+    size_t max;
+    size_t n;
+};
+
+/* PROCEDURES */
+
+size_t fault_whatif_candidates(const FaultWhatIfGrid *grid)
+{
+    if (grid == NULL){
+        return 0;
+    }
+
+    size_t n = grid->warnLen * grid->errLen;
+
+    if (grid->type != FAULT_POL_COUNT_ABS){
+        n = n * grid->resetLen;
+    }
+
+    return n;
+}/* fault_whatif_candidates */
+
+/* fault_update_hook */
+static
+void fault_whatif_select(fault_millisecs now,
+                         fault_id id,
+                         long ref,
+                         bool condition,
+                         fault_counter n,
+                         void *ctx)
+{
+    struct FaultWhatIfSelect *sel = (struct FaultWhatIfSelect*)ctx;
+
+    if (id != sel->id){
+        return;
+    }
+
+    /* a bulk update as 'n' events, not beyond 'max' */
+    for (; n > 0 && sel->n < sel->max; n--){
+        sel->out[sel->n].timestamp = now;
+        sel->out[sel->n].ref = ref;
+        sel->out[sel->n].condition = condition;
+        sel->n = sel->n + 1;
+    }
+}/* fault_whatif_select */
+
+long fault_whatif_events(const void *trace,
+                         size_t used,
+                         fault_id id,
+                         FaultWhatIfEvent *out,
+                         size_t max)
+{
+    struct FaultWhatIfSelect sel = {id, out, max, 0};
+
+    if (out == NULL){
+        return -1;
+    }
+
+    if (fault_trace_decode(trace, used, fault_whatif_select, &sel) < 0){
+        return -1;
+    }
+
+    return (long)sel.n;
+}/* fault_whatif_events */
+
+/* Thresholds of the candidate 'c' */
+static
+void fault_whatif_candidate(const FaultWhatIfGrid *grid,
+                            size_t c,
+                            FaultWhatIfResult *res)
+{
+    size_t nreset = (grid->type == FAULT_POL_COUNT_ABS) ? 1 : grid->resetLen;
+
+    memset(res, 0, sizeof(FaultWhatIfResult));
+    res->reset = (grid->type == FAULT_POL_COUNT_ABS) ?
+                 0 : grid->reset[c % nreset];
+    c = c / nreset;
+    res->err = grid->err[c % grid->errLen];
+    c = c / grid->errLen;
+    res->warn = grid->warn[c];
+
+    res->toWarning = FAULT_WHATIF_NEVER;
+    res->toError = FAULT_WHATIF_NEVER;
+    res->status = FAULT_ST_NORMAL;
+}/* fault_whatif_candidate */
+
+/* Evaluate the candidates [first, first+n) */
+static
+void fault_whatif_block(const FaultWhatIfJob *job, size_t first, size_t n)
+{
+    FaultWhatIfState state[FAULT_WHATIF_BLOCK];
+    FaultWhatIfResult *res = job->out + first;
+
+    assert(n <= FAULT_WHATIF_BLOCK);
+
+    for (size_t c = 0; c < n; c++){
+        fault_whatif_candidate(job->grid, first + c, &res[c]);
+        res[c].valid = fault_policy_make(&state[c].policy,
+                                         job->grid->type,
+                                         res[c].warn,
+                                         res[c].err,
+                                         res[c].reset);
+        fault_record_reset(&state[c].record);
+        state[c].status = FAULT_ST_NORMAL;
+        state[c].alarm = false;
+        state[c].alarmError = false;
+    }
+
+    if (job->nevents == 0){
+        return;
+    }
+
+    fault_millisecs t0 = job->events[0].timestamp;
+
+    for (size_t e = 0; e < job->nevents; e++){
+        const FaultWhatIfEvent *ev = &job->events[e];
+
+        for (size_t c = 0; c < n; c++){
+            FaultWhatIfState *st = &state[c];
+            fault_status_type prev = st->status;
+            fault_status_type s = fault_record_update(&st->policy,
+                                                      &st->record,
+                                                      ev->timestamp,
+                                                      ev->ref,
+                                                      ev->condition);
+            if (s == prev){
+                continue;
+            }
+
+            st->status = s;
+            res[c].transitions++;
+
+            if (s >= FAULT_ST_WARNING && res[c].toWarning == FAULT_WHATIF_NEVER){
+                res[c].toWarning = ev->timestamp - t0;
+            }
+            if (s == FAULT_ST_ERROR && res[c].toError == FAULT_WHATIF_NEVER){
+                res[c].toError = ev->timestamp - t0;
+            }
+
+            if (s == FAULT_ST_NORMAL){
+                if (st->alarm && !st->alarmError){
+                    res[c].falseAlarms++;
+                }
+                st->alarm = false;
+                st->alarmError = false;
+            } else {
+                st->alarm = true;
+                st->alarmError = st->alarmError || (s == FAULT_ST_ERROR);
+            }
+        }/* for candidates */
+    }/* for events */
+
+    for (size_t c = 0; c < n; c++){
+        res[c].status = state[c].status;
+    }
+}/* fault_whatif_block */
+
+static
+void *fault_whatif_main(void *arg)
+{
+    const FaultWhatIfJob *job = (const FaultWhatIfJob*)arg;
+
+    for (size_t c = job->first; c < job->last; c += FAULT_WHATIF_BLOCK){
+        size_t n = job->last - c;
+        if (n > FAULT_WHATIF_BLOCK){
+            n = FAULT_WHATIF_BLOCK;
+        }
+        fault_whatif_block(job, c, n);
+    }
+
+    return NULL;
+}/* fault_whatif_main */
+
+bool fault_whatif_run(const FaultWhatIfGrid *grid,
+                      const FaultWhatIfEvent *events,
+                      size_t nevents,
+                      FaultWhatIfResult *out,
+                      size_t max,
+                      unsigned int threads)
+{
+    FaultWhatIfJob jobs[FAULT_WHATIF_THREADS_MAX];
+
+    if (grid == NULL || out == NULL || (events == NULL && nevents > 0)){
+        return false;
+    }
+
+    if (grid->type == FAULT_POL_HEARTBEAT){
+        /* the silence is not in the events */
+        return false;
+    }
+
+    if (grid->warn == NULL || grid->err == NULL ||
+        (grid->type != FAULT_POL_COUNT_ABS && grid->reset == NULL)){
+        return false;
+    }
+
+    size_t total = fault_whatif_candidates(grid);
+    if (total == 0 || total > max){
+        return false;
+    }
+
+    if (threads == 0){
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cores > 0) ? (unsigned int)cores : 1;
+    }
+    if (threads > FAULT_WHATIF_THREADS_MAX){
+        threads = FAULT_WHATIF_THREADS_MAX;
+    }
+    if (threads > total){
+        threads = (unsigned int)total;
+    }
+
+    /* input validated */
+
+    size_t chunk = (total + threads - 1) / threads;
+
+    for (unsigned int t = 0; t < threads; t++){
+        FaultWhatIfJob *job = &jobs[t];
+        job->grid = grid;
+        job->events = events;
+        job->nevents = nevents;
+        job->out = out;
+        job->first = t * chunk;
+        job->last = (job->first + chunk < total) ? job->first + chunk : total;
+        job->threaded = false;
+
+        if (job->first >= job->last){
+            threads = t;
+            break;
+        }
+
+        /* the last chunk runs in the caller, as any failed thread */
+        if (t + 1 < threads &&
+            pthread_create(&job->thread, NULL, fault_whatif_main, job) == 0){
+            job->threaded = true;
+        } else {
+            fault_whatif_main(job);
+        }
+    }/* for threads */
+
+    for (unsigned int t = 0; t < threads; t++){
+        if (jobs[t].threaded){
+            pthread_join(jobs[t].thread, NULL);
+        }
+    }
+
+    return true;
+}/* fault_whatif_run */
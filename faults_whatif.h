@@ -0,0 +1,93 @@
+#pragma once
+#include "faults.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Faults What-If - Evaluation of many policy configurations
+ * against the same recorded events.
+ *
+ * The candidates are all the combinations of the thresholds in a grid,
+ * each one is evaluated with the same procedures of fault_update(),
+ * spread over several threads.
+ *
+ * Requires POSIX threads.
+ */
+
+/* Value of the times for a status never reached */
+#define FAULT_WHATIF_NEVER ULONG_MAX
+
+/* Grid of candidate thresholds for a policy */
+struct FaultWhatIfGrid {
+    fault_policy_type type; /* FAULT_POL_COUNT_ABS, _COUNT_RESET, _TIME_RESET */
+    const unsigned long *warn;
+    size_t warnLen;
+    const unsigned long *err;
+    size_t errLen;
+    const unsigned long *reset; /* ignored for FAULT_POL_COUNT_ABS */
+    size_t resetLen;
+};
+
+typedef struct FaultWhatIfGrid FaultWhatIfGrid;
+
+/* A single validation of the id under evaluation */
+struct FaultWhatIfEvent {
+    fault_millisecs timestamp;
+    long ref;
+    bool condition;
+};
+
+typedef struct FaultWhatIfEvent FaultWhatIfEvent;
+
+struct FaultWhatIfResult {
+    /* the candidate */
+    unsigned long warn;
+    unsigned long err;
+    unsigned long reset;
+    bool valid; /* false when the policy rejects the thresholds */
+
+    /* from the first event, FAULT_WHATIF_NEVER if not reached */
+    fault_millisecs toWarning;
+    fault_millisecs toError;
+
+    unsigned long transitions; /* status changes */
+    /* episodes out of NORMAL that come back without reaching ERROR */
+    unsigned long falseAlarms;
+    fault_status_type status; /* after the last event */
+};
+
+typedef struct FaultWhatIfResult FaultWhatIfResult;
+
+/* Number of candidates in the grid (product of the lengths) */
+size_t fault_whatif_candidates(const FaultWhatIfGrid *grid);
+
+/* Select from a trace (see faults_trace.h) the events of 'id',
+ * a bulk update gives 'n' events.
+ * return the number of events written in 'out' (at most 'max'),
+ *        -1 for an invalid trace
+ */
+long fault_whatif_events(const void *trace,
+                         size_t used,
+                         fault_id id,
+                         FaultWhatIfEvent *out,
+                         size_t max);
+
+/* Evaluate all the candidates of the grid against the events.
+ * out: a result for every candidate, in the order warn, err, reset
+ *      (the last one changes faster).
+ * max: capacity of 'out', at least fault_whatif_candidates().
+ * threads: number of threads, 0 for one per online core.
+ * return false in case of error
+ */
+bool fault_whatif_run(const FaultWhatIfGrid *grid,
+                      const FaultWhatIfEvent *events,
+                      size_t nevents,
+                      FaultWhatIfResult *out,
+                      size_t max,
+                      unsigned int threads);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,49 @@
+/* Faults Journal decoder
+ *
+ * Usage: fjdump FILE...
+ * It prints one line for every entry:
+ *   sequence timestamp [module, code] (status) refValue
+ */
+#include "faults_journal.h"
+#include <stdio.h>
+
+/* required by the faults module, unused */
+fault_millisecs fault_now(void)
+{
+    return 0;
+}/* fault_now */
+
+static
+bool fjdump_print(const FaultLog *log, void *ctx)
+{
+    (void)ctx;
+
+    printf("%zu %lu [%u, %u] (%i) %li\n",
+           log->index,
+           log->timestamp,
+           log->module,
+           log->code,
+           (int)log->status,
+           log->refValue);
+
+    return true;
+}/* fjdump_print */
+
+int main(int argc, char *argv[])
+{
+    int rc = 0;
+
+    if (argc < 2){
+        fprintf(stderr, "usage: %s FILE...\n", argv[0]);
+        return 2;
+    }
+
+    for (int i = 1; i < argc; i++){
+        if (fault_journal_decode(argv[i], fjdump_print, NULL) < 0){
+            fprintf(stderr, "%s: cannot read or corrupted\n", argv[i]);
+            rc = 1;
+        }
+    }
+
+    return rc;
+}/* main */
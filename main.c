@@ -1,7 +1,21 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "faults.h"
+#include "faults_exporter.h"
+#include "faults_journal.h"
+#include "faults_loader.h"
+#include "faults_merge.h"
+#include "faults_trace.h"
+#include "faults_whatif.h"
 #include <assert.h>
 #include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 enum ModOne {
     MONE_1,
@@ -469,6 +483,2031 @@ void test_logs(void)
     puts("OK");
 }
 
+void test_logs_module(void)
+{
+    printf("test_logs_module: ");
+
+    fault_init();
+    fault_module mod1 = fault_conf_module(MONE_ALL, 1);
+    fault_module mod2 = fault_conf_module(MTWO_ALL, 2);
+
+    fault_id fid1 = fault_getid(mod1, MONE_1);
+    fault_id fid2 = fault_getid(mod2, MTWO_1);
+
+    assert(!fault_conf_module_logs(999, 1));
+    assert(!fault_conf_module_logs(mod2, 0));
+    assert(!fault_conf_module_logs(mod2, FAULT_LOG_MAX + 1));
+
+    /* half to mod2, half shared */
+    assert(FAULT_LOG_MAX == 2);
+    assert(fault_conf_module_logs(mod2, 1));
+    assert(!fault_conf_module_logs(mod2, 1));
+    assert(!fault_conf_module_logs(mod1, 2));
+
+    mockTime = 200;
+    fault_update(fid2, 1, true);
+    mockTime = 201;
+    fault_update(fid1, 2, true);
+
+    assert(fault_logs_length() == 2);
+    assert(fault_log(0).saved);
+    assert(fault_log(0).index == 0);
+    assert(fault_log(0).module == mod1);
+    assert(fault_log(0).refValue == 2);
+    assert(fault_log(1).saved);
+    assert(fault_log(1).index == 1);
+    assert(fault_log(1).module == mod2);
+    assert(fault_log(1).refValue == 1);
+    assert(!fault_log(2).saved);
+    /* the merge position is kept, in both directions */
+    assert(fault_log(1).module == mod2 && fault_log(0).module == mod1);
+    assert(fault_log(1).refValue == 1 && fault_log(0).refValue == 2);
+
+    /* the noisy mod1 does not erase mod2 */
+    mockTime = 202;
+    fault_update(fid1, 3, true);
+    fault_update(fid1, 4, true);
+
+    assert(fault_logs_length() == 2);
+    assert(fault_log(0).module == mod1);
+    assert(fault_log(0).refValue == 4);
+    assert(fault_log(1).module == mod2);
+    assert(fault_log(1).refValue == 1);
+
+    /* all the pool reserved, mod1 cannot log anymore */
+    fault_init();
+    mod1 = fault_conf_module(MONE_ALL, 1);
+    mod2 = fault_conf_module(MTWO_ALL, 2);
+    fid1 = fault_getid(mod1, MONE_1);
+    fid2 = fault_getid(mod2, MTWO_1);
+
+    assert(fault_conf_module_logs(mod2, 2));
+
+    fault_update(fid1, 5, true);
+    assert(fault_logs_length() == 0);
+
+    fault_update(fid2, 6, true);
+    fault_update(fid2, 7, true);
+    fault_update(fid2, 8, true);
+    assert(fault_logs_length() == 2);
+    assert(fault_log(0).refValue == 8);
+    assert(fault_log(1).refValue == 7);
+
+    fault_logs_reset();
+    assert(fault_logs_length() == 0);
+
+    puts("OK");
+}
+
+void test_logs_query(void)
+{
+    printf("test_logs_query: ");
+
+    fault_init();
+    fault_module mod1 = fault_conf_module(MONE_ALL, 1);
+    fault_module mod2 = fault_conf_module(MTWO_ALL, 2);
+
+    fault_id fid1 = fault_getid(mod1, MONE_1);
+    fault_id fid2 = fault_getid(mod1, MONE_2);
+
+    fault_policy_count_abs(fid1, 1, 2);
+
+    FaultLogSpan spans[4];
+    FaultLogFilter filter = {0};
+
+    assert(fault_logs_query(NULL, spans, 4) == 0);
+
+    mockTime = 10;
+    fault_update(fid1, 1, true);
+    mockTime = 20;
+    fault_update(fid1, 2, true);
+
+    /* all, oldest first */
+    assert(fault_logs_query(NULL, spans, 4) == 1);
+    assert(spans[0].len == 2);
+    assert(spans[0].logs[0].refValue == 1);
+    assert(spans[0].logs[1].refValue == 2);
+    assert(spans[0].logs[0].index < spans[0].logs[1].index);
+
+    /* time range */
+    filter.fields = FAULT_LF_TIME;
+    filter.from = 15;
+    filter.to = 30;
+    assert(fault_logs_query(&filter, spans, 4) == 1);
+    assert(spans[0].len == 1);
+    assert(spans[0].logs[0].timestamp == 20);
+
+    filter.from = 21;
+    assert(fault_logs_query(&filter, spans, 4) == 0);
+
+    filter.from = 10;
+    filter.to = 10;
+    assert(fault_logs_query(&filter, spans, 4) == 1);
+    assert(spans[0].logs[0].timestamp == 10);
+
+    /* status */
+    filter.fields = FAULT_LF_STATUS;
+    filter.status = FAULT_ST_ERROR;
+    assert(fault_logs_query(&filter, spans, 4) == 1);
+    assert(spans[0].len == 1);
+    assert(spans[0].logs[0].refValue == 2);
+
+    /* module and code */
+    filter.fields = FAULT_LF_MODULE | FAULT_LF_CODE;
+    filter.module = mod1;
+    filter.code = MONE_2;
+    assert(fault_logs_query(&filter, spans, 4) == 0);
+
+    mockTime = 30;
+    fault_update(fid2, 3, true);
+    assert(fault_logs_query(&filter, spans, 4) == 1);
+    assert(spans[0].logs[0].refValue == 3);
+
+    /* the queue wraps around: two spans */
+    assert(fault_logs_query(NULL, spans, 4) == 2);
+    assert(spans[0].len == 1);
+    assert(spans[0].logs[0].refValue == 2);
+    assert(spans[1].len == 1);
+    assert(spans[1].logs[0].refValue == 3);
+
+    /* limited output */
+    assert(fault_logs_query(NULL, spans, 1) == 1);
+    assert(spans[0].logs[0].refValue == 2);
+
+    /* dedicated queue */
+    assert(fault_conf_module_logs(mod2, 1));
+    mockTime = 40;
+    fault_update(fault_getid(mod2, MTWO_2), 4, true);
+    fault_update(fid1, 5, true);
+
+    filter.fields = FAULT_LF_MODULE;
+    filter.module = mod2;
+    assert(fault_logs_query(&filter, spans, 4) == 1);
+    assert(spans[0].len == 1);
+    assert(spans[0].logs[0].refValue == 4);
+
+    filter.module = mod1;
+    assert(fault_logs_query(&filter, spans, 4) == 1);
+    assert(spans[0].logs[0].refValue == 5);
+
+    puts("OK");
+}
+
+/* reference values stressing the encoding, the extremes are the latest.
+ * FAULT_COMPACT stores 32 bits values.
+ */
+static long cold_ref(int i, int n)
+{
+    long refs[] = {0, -1, 1,
+                   FAULT_COMPACT ? INT_MAX : LONG_MAX,
+                   FAULT_COMPACT ? INT_MIN : LONG_MIN,
+                   123456789, -987654321};
+    const int nrefs = sizeof(refs) / sizeof(refs[0]);
+
+    if (i >= n - nrefs){
+        return refs[n - 1 - i];
+    }
+
+    return (long)i * 1000 - 50000;
+}
+
+void test_logs_cold(void)
+{
+    printf("test_logs_cold: ");
+
+    fault_init();
+    fault_module mod1 = fault_conf_module(MONE_ALL, 1);
+    fault_module mod2 = fault_conf_module(MTWO_ALL, 2);
+
+    fault_id fid1 = fault_getid(mod1, MONE_3);
+    fault_id fid2 = fault_getid(mod2, MTWO_4);
+
+    fault_policy_count_abs(fid1, 1, 2);
+
+    if (FAULT_REALTIME){
+        /* not available */
+        assert(!fault_conf_logs_cold(true));
+        puts("OK");
+        return;
+    }
+
+    assert(fault_conf_logs_cold(true));
+
+    const int n = 100;
+
+    for (int i = 0; i < n; i++){
+        mockTime = 1000 + (fault_millisecs)i * 7;
+        fault_id fid = (i % 2) ? fid1 : fid2;
+        fault_update(fid, cold_ref(i, n), true);
+    }
+
+    /* 2 in the queue and about 10 per block, the oldest dropped */
+    size_t len = fault_logs_length();
+    assert(len > FAULT_LOG_MAX + FAULT_LOG_COLD_BLOCK_SIZE / 8);
+    assert(len < (size_t)n);
+
+    for (size_t k = 0; k < len; k++){
+        int i = n - 1 - (int)k;
+        FaultLog log = fault_log(k);
+
+        assert(log.saved);
+        assert(log.index == k);
+        assert(log.timestamp == 1000 + (fault_millisecs)i * 7);
+        assert(log.module == ((i % 2) ? mod1 : mod2));
+        assert(log.code == ((i % 2) ? MONE_3 : MTWO_4));
+        assert(log.refValue == cold_ref(i, n));
+        if (i % 2){
+            assert(log.status == ((i > 1) ? FAULT_ST_ERROR : FAULT_ST_WARNING));
+        } else {
+            assert(log.status == FAULT_ST_NORMAL);
+        }
+    }
+    assert(!fault_log(len).saved);
+
+    fault_logs_reset();
+    assert(fault_logs_length() == 0);
+    assert(!fault_log(0).saved);
+
+    /* disabled */
+    assert(fault_conf_logs_cold(false));
+    fault_update(fid1, 1, true);
+    fault_update(fid1, 2, true);
+    fault_update(fid1, 3, true);
+    assert(fault_logs_length() == FAULT_LOG_MAX);
+
+    /* the cold entries follow the queues in the order they left them,
+     * not in time order across the modules */
+    assert(fault_reset(fid1));
+    assert(fault_conf_logs_cold(true));
+    assert(fault_conf_module_logs(mod1, 1));
+    mockTime = 10;
+    fault_update(fid2, 0, true);
+    mockTime = 20;
+    fault_update(fid1, 0, true);
+    mockTime = 30;
+    fault_update(fid1, 0, true);
+    assert(fault_logs_length() == 3);
+    assert(fault_log(0).timestamp == 30);
+    assert(fault_log(1).timestamp == 10 && fault_log(1).module == mod2);
+    assert(fault_log(2).timestamp == 20 && fault_log(2).module == mod1);
+
+    puts("OK");
+}
+
+static bool journal_check(const FaultLog *log, void *ctx)
+{
+    size_t *n = (size_t*)ctx;
+
+    /* the entries are in sequence order */
+    assert(log->index == *n);
+    assert(log->timestamp == 300 + *n);
+    assert(log->refValue == -(long)*n);
+    assert(log->status == FAULT_ST_NORMAL);
+    *n = *n + 1;
+
+    return true;
+}
+
+void test_journal(void)
+{
+    printf("test_journal: ");
+
+    const char *path = "/tmp/faults_test.journal";
+    char name[64];
+    FaultJournalStats stats;
+    FaultJournalConf conf = {0};
+    conf.path = path;
+    conf.flushMs = 1;
+
+    remove(path);
+
+    fault_init();
+    fault_module mod1 = fault_conf_module(MONE_ALL, 1);
+    fault_id fid = fault_getid(mod1, MONE_2);
+
+    assert(!fault_journal_start(NULL));
+    assert(fault_journal_start(&conf));
+    assert(!fault_journal_start(&conf));
+
+    for (size_t i = 0; i < 50; i++){
+        mockTime = 300 + i;
+        fault_update(fid, -(long)i, true);
+    }
+
+    fault_journal_stop();
+    fault_journal_stats(&stats);
+    assert(stats.written == 50);
+    assert(stats.dropped == 0);
+    assert(stats.errors == 0);
+    assert(stats.backlog > 0);
+
+    size_t n = 0;
+    assert(fault_journal_decode(path, journal_check, &n) == 50);
+    assert(n == 50);
+    assert(fault_journal_decode("/tmp/faults_test.none", NULL, NULL) < 0);
+
+    /* rotation at every batch */
+    remove(path);
+    conf.rotateBytes = 1;
+    conf.rotateKeep = 1000;
+
+    fault_logs_reset();
+    assert(fault_journal_start(&conf));
+    for (size_t i = 0; i < 50; i++){
+        mockTime = 300 + i;
+        fault_update(fid, -(long)i, true);
+        if (i % 10 == 0){
+            /* let the writer run */
+            fault_journal_stop();
+            assert(fault_journal_start(&conf));
+        }
+    }
+    fault_journal_stop();
+
+    /* from the oldest file */
+    n = 0;
+    for (int k = 1000; k > 0; k--){
+        snprintf(name, sizeof(name), "%s.%i", path, k);
+        if (fault_journal_decode(name, journal_check, &n) >= 0){
+            remove(name);
+        }
+    }
+    assert(fault_journal_decode(path, journal_check, &n) >= 0);
+    assert(n == 50);
+
+    remove(path);
+
+    puts("OK");
+}
+
+/* configuration shared by the recording and the replay */
+static void trace_conf(fault_id fids[MONE_ALL + MTWO_ALL])
+{
+    fault_init();
+    fault_module mod1 = fault_conf_module(MONE_ALL, 1);
+    fault_module mod2 = fault_conf_module(MTWO_ALL, 2);
+
+    for (int i = 0; i < MONE_ALL; i++){
+        fids[i] = fault_getid(mod1, (fault_code)i);
+    }
+    for (int i = 0; i < MTWO_ALL; i++){
+        fids[MONE_ALL + i] = fault_getid(mod2, (fault_code)i);
+    }
+
+    fault_policy_count_abs(fids[0], 2, 4);
+    fault_policy_count_reset(fids[1], 1, 3, 2);
+    fault_policy_time_reset(fids[2], 3, 6, 4);
+    fault_policy_count_reset(fids[3], 2, 2, 5);
+    fault_policy_time_reset(fids[4], 1, 2, 3);
+}
+
+/* counts the new log entries */
+static void trace_log_count(const FaultLog *log, void *ctx)
+{
+    (void)log;
+    *(size_t*)ctx = *(size_t*)ctx + 1;
+}
+
+void test_trace(void)
+{
+    printf("test_trace: ");
+
+    enum {NIDS = MONE_ALL + MTWO_ALL, NEVENTS = 200};
+    static unsigned char buf[4096];
+    static unsigned char loaded[4096];
+    fault_id fids[NIDS];
+    fault_status_type status[NIDS];
+    fault_counter errors[NIDS];
+    long refs[NIDS];
+    FaultLog logs[FAULT_LOG_MAX];
+    FaultTrace trace;
+
+    trace_conf(fids);
+
+    assert(!fault_trace_start(&trace, buf, 8));
+    assert(fault_trace_start(&trace, buf, sizeof(buf)));
+    assert(!fault_trace_start(&trace, buf, sizeof(buf)));
+
+    /* pseudo random events */
+    unsigned long seed = 7;
+    for (int i = 0; i < NEVENTS; i++){
+        seed = seed * 1103515245UL + 12345UL;
+        mockTime = 5000 + (fault_millisecs)i + ((seed >> 8) % 3);
+        fault_id fid = (i == 50) ? 99999 : fids[(seed >> 16) % NIDS];
+        fault_update(fid, (long)((seed >> 20) % 4000) - 2000,
+                     ((seed >> 12) % 3) == 0);
+    }
+
+    fault_trace_stop();
+    assert(trace.events == NEVENTS);
+    assert(trace.dropped == 0);
+    assert(trace.used < NEVENTS * 8);
+
+    for (int i = 0; i < NIDS; i++){
+        status[i] = fault_status(fids[i]);
+        errors[i] = fault_count_errors(fids[i]);
+        refs[i] = fault_refval(fids[i]);
+    }
+    size_t nlogs = fault_logs_length();
+    for (size_t i = 0; i < nlogs && i < FAULT_LOG_MAX; i++){
+        logs[i] = fault_log(i);
+    }
+
+    /* save and load */
+    const char *path = "/tmp/faults_test.trace";
+    assert(fault_trace_save(&trace, path));
+    assert(fault_trace_load(path, loaded, 16) < 0);
+    assert(fault_trace_load(path, loaded, sizeof(loaded)) == (long)trace.used);
+    remove(path);
+
+    /* replay with a different clock */
+    trace_conf(fids);
+    mockTime = 0;
+    assert(fault_trace_replay(loaded, 4) < 0);
+
+    /* a truncated trace changes nothing */
+    assert(fault_trace_replay(loaded, trace.used - 1) < 0);
+    assert(fault_trace_decode(loaded, trace.used - 1, NULL, NULL) < 0);
+    for (int i = 0; i < NIDS; i++){
+        assert(fault_count_errors(fids[i]) == 0);
+    }
+    assert(fault_logs_length() == 0);
+
+    assert(fault_trace_replay(loaded, trace.used) == NEVENTS);
+
+    for (int i = 0; i < NIDS; i++){
+        assert(fault_status(fids[i]) == status[i]);
+        assert(fault_count_errors(fids[i]) == errors[i]);
+        assert(fault_refval(fids[i]) == refs[i]);
+    }
+    assert(fault_logs_length() == nlogs);
+    for (size_t i = 0; i < nlogs && i < FAULT_LOG_MAX; i++){
+        FaultLog log = fault_log(i);
+        assert(log.saved == logs[i].saved);
+        assert(log.index == logs[i].index);
+        assert(log.timestamp == logs[i].timestamp);
+        assert(log.module == logs[i].module);
+        assert(log.code == logs[i].code);
+        assert(log.status == logs[i].status);
+        assert(log.refValue == logs[i].refValue);
+    }
+
+    /* the clock is restored */
+    mockTime = 42;
+    fault_update(fids[0], 0, true);
+    assert(fault_log(0).timestamp == 42);
+
+    /* a bulk update is a single event, replayed as a bulk update */
+    trace_conf(fids);
+    size_t nentries = 0;
+    fault_conf_logs_hook(trace_log_count, &nentries);
+    assert(fault_trace_start(&trace, buf, sizeof(buf)));
+    unsigned long nbulk = 0;
+    for (int i = 0; i < NIDS; i++){
+        mockTime = 6000 + (fault_millisecs)i;
+        nbulk += (i % 4 == 0) ? 1 : 2; /* clear_n() of 0 is not recorded */
+        fault_update_fault_n(fids[i], i, (fault_counter)(1 + i % 3) * 1000);
+        fault_update_clear_n(fids[(i + 1) % NIDS], (fault_counter)(i % 4));
+    }
+    fault_update(fids[0], 5, true);
+    nbulk++;
+    fault_trace_stop();
+    assert(trace.events == nbulk && trace.dropped == 0);
+
+    for (int i = 0; i < NIDS; i++){
+        status[i] = fault_status(fids[i]);
+        errors[i] = fault_count_errors(fids[i]);
+        refs[i] = fault_refval(fids[i]);
+    }
+    nlogs = fault_logs_length();
+    assert(nlogs > 0);
+    for (size_t i = 0; i < nlogs && i < FAULT_LOG_MAX; i++){
+        logs[i] = fault_log(i);
+    }
+    size_t recorded = nentries;
+
+    trace_conf(fids);
+    nentries = 0;
+    fault_conf_logs_hook(trace_log_count, &nentries);
+    assert(fault_trace_replay(buf, trace.used) == (long)trace.events);
+    fault_conf_logs_hook(NULL, NULL);
+    assert(nentries == recorded);
+    for (int i = 0; i < NIDS; i++){
+        assert(fault_status(fids[i]) == status[i]);
+        assert(fault_count_errors(fids[i]) == errors[i]);
+        assert(fault_refval(fids[i]) == refs[i]);
+    }
+    assert(fault_logs_length() == nlogs);
+    for (size_t i = 0; i < nlogs && i < FAULT_LOG_MAX; i++){
+        FaultLog log = fault_log(i);
+        assert(log.index == logs[i].index);
+        assert(log.timestamp == logs[i].timestamp);
+        assert(log.module == logs[i].module);
+        assert(log.code == logs[i].code);
+        assert(log.status == logs[i].status);
+        assert(log.refValue == logs[i].refValue);
+    }
+
+    puts("OK");
+}
+
+/* evaluate a candidate with the real library */
+static FaultWhatIfResult whatif_reference(fault_policy_type type,
+                                          const FaultWhatIfResult *cand,
+                                          const FaultWhatIfEvent *events,
+                                          size_t n)
+{
+    FaultWhatIfResult res = *cand;
+    res.toWarning = FAULT_WHATIF_NEVER;
+    res.toError = FAULT_WHATIF_NEVER;
+    res.transitions = 0;
+    res.falseAlarms = 0;
+
+    fault_init();
+    fault_module mod1 = fault_conf_module(MONE_ALL, 1);
+    fault_id fid = fault_getid(mod1, MONE_1);
+
+    if (type == FAULT_POL_COUNT_ABS){
+        res.valid = fault_policy_count_abs(fid, cand->warn, cand->err);
+    } else if (type == FAULT_POL_COUNT_RESET){
+        res.valid = fault_policy_count_reset(fid, cand->warn, cand->err,
+                                             cand->reset);
+    } else {
+        res.valid = fault_policy_time_reset(fid, cand->warn, cand->err,
+                                            cand->reset);
+    }
+
+    if (!res.valid){
+        return res;
+    }
+
+    fault_status_type prev = FAULT_ST_NORMAL;
+    bool alarmError = false;
+    for (size_t i = 0; i < n; i++){
+        mockTime = events[i].timestamp;
+        fault_update(fid, events[i].ref, events[i].condition);
+        fault_status_type s = fault_status(fid);
+        if (s != prev){
+            res.transitions++;
+        }
+        if (s >= FAULT_ST_WARNING && res.toWarning == FAULT_WHATIF_NEVER){
+            res.toWarning = events[i].timestamp - events[0].timestamp;
+        }
+        if (s == FAULT_ST_ERROR && res.toError == FAULT_WHATIF_NEVER){
+            res.toError = events[i].timestamp - events[0].timestamp;
+        }
+        if (s == FAULT_ST_NORMAL && prev != FAULT_ST_NORMAL && !alarmError){
+            res.falseAlarms++;
+        }
+        alarmError = (s == FAULT_ST_NORMAL) ? false :
+                     (alarmError || s == FAULT_ST_ERROR);
+        prev = s;
+    }
+    res.status = prev;
+
+    return res;
+}
+
+void test_whatif(void)
+{
+    printf("test_whatif: ");
+
+    enum {NEVENTS = 300};
+    static unsigned char buf[8192];
+    FaultWhatIfEvent events[NEVENTS];
+    FaultWhatIfResult results[64];
+    FaultTrace trace;
+    const unsigned long warn[] = {1, 2, 3};
+    const unsigned long err[] = {2, 4};
+    const unsigned long reset[] = {1, 3, 5};
+
+    /* record the events of two ids */
+    fault_init();
+    fault_module mod1 = fault_conf_module(MONE_ALL, 1);
+    fault_id fid1 = fault_getid(mod1, MONE_1);
+    fault_id fid2 = fault_getid(mod1, MONE_2);
+
+    assert(fault_trace_start(&trace, buf, sizeof(buf)));
+    unsigned long seed = 3;
+    for (int i = 0; i < NEVENTS; i++){
+        seed = seed * 1103515245UL + 12345UL;
+        mockTime = 100 + (fault_millisecs)i;
+        /* bursts of faults */
+        bool cond = ((i / 20) % 3 == 0) ? ((seed >> 16) % 2 == 0)
+                                        : ((seed >> 16) % 9 == 0);
+        fault_update(fid1, i, cond);
+        fault_update(fid2, -i, true);
+    }
+    fault_trace_stop();
+
+    long n = fault_whatif_events(trace.data, trace.used, fid1, events, NEVENTS);
+    assert(n == NEVENTS);
+    assert(events[7].ref == 7);
+    assert(fault_whatif_events(trace.data, 3, fid1, events, NEVENTS) < 0);
+
+    fault_policy_type types[] = {FAULT_POL_COUNT_ABS,
+                                 FAULT_POL_COUNT_RESET,
+                                 FAULT_POL_TIME_RESET};
+
+    for (int t = 0; t < 3; t++){
+        FaultWhatIfGrid grid = {types[t], warn, 3, err, 2, reset, 3};
+        size_t total = fault_whatif_candidates(&grid);
+        assert(total == ((t == 0) ? 6u : 18u));
+
+        assert(!fault_whatif_run(&grid, events, (size_t)n, results, 2, 0));
+        assert(fault_whatif_run(&grid, events, (size_t)n, results, 64, 4));
+
+        bool alarms = false;
+        for (size_t c = 0; c < total; c++){
+            FaultWhatIfResult ref = whatif_reference(types[t], &results[c],
+                                                     events, (size_t)n);
+            assert(results[c].valid == ref.valid);
+            assert(results[c].valid == (results[c].warn <= results[c].err));
+            if (!ref.valid){
+                continue;
+            }
+            assert(results[c].toWarning == ref.toWarning);
+            assert(results[c].toError == ref.toError);
+            assert(results[c].transitions == ref.transitions);
+            assert(results[c].falseAlarms == ref.falseAlarms);
+            assert(results[c].status == ref.status);
+            alarms = alarms || (ref.falseAlarms > 0);
+        }
+        assert(t == 0 || alarms);
+    }
+
+    /* the order of the candidates */
+    FaultWhatIfGrid grid = {FAULT_POL_COUNT_RESET, warn, 3, err, 2, reset, 3};
+    assert(fault_whatif_run(&grid, events, 0, results, 64, 1));
+    assert(results[0].warn == 1 && results[0].err == 2 && results[0].reset == 1);
+    assert(results[1].warn == 1 && results[1].err == 2 && results[1].reset == 3);
+    assert(results[3].warn == 1 && results[3].err == 4 && results[3].reset == 1);
+    assert(results[6].warn == 2 && results[6].err == 2 && results[6].reset == 1);
+    assert(results[0].toWarning == FAULT_WHATIF_NEVER);
+
+    puts("OK");
+}
+
+/* Run the same events in eager or lazy mode, the statuses are
+ * read every few updates into 'out' (3 for each read).
+ */
+static
+size_t lazy_run(bool lazy, fault_status_type *out, fault_status_module_type *mout)
+{
+    fault_init();
+    fault_module mod = fault_conf_module(MONE_ALL, 1);
+    fault_id abs = fault_getid(mod, MONE_1);
+    fault_id cnt = fault_getid(mod, MONE_2);
+    fault_id tim = fault_getid(mod, MONE_3);
+
+    assert(fault_policy_count_abs(abs, 20, 40));
+    assert(fault_policy_count_reset(cnt, 2, 4, 5));
+    assert(fault_policy_time_reset(tim, 3, 6, 4));
+    fault_conf_lazy(lazy);
+
+    unsigned long seed = 7;
+    size_t n = 0;
+
+    for (int i = 0; i < 3000; i++){
+        seed = seed * 1103515245UL + 12345UL;
+        fault_id id = (fault_id)((seed >> 16) % 3) + abs;
+        mockTime = (fault_millisecs)i / 2;
+        fault_update(id, i, ((seed >> 8) % 3) == 0);
+
+        if ((seed >> 20) % 7 == 0){
+            out[n] = fault_status(abs);
+            out[n+1] = fault_status(cnt);
+            out[n+2] = fault_status(tim);
+            mout[n/3] = fault_status_module(mod);
+            n += 3;
+        }
+    }
+
+    return n;
+}/* lazy_run */
+
+void test_lazy(void)
+{
+    printf("test_lazy: ");
+
+    static fault_status_type eager[3000 * 3];
+    static fault_status_type lazy[3000 * 3];
+    static fault_status_module_type meager[3000];
+    static fault_status_module_type mlazy[3000];
+
+    size_t n = lazy_run(false, eager, meager);
+    assert(n > 0);
+    assert(lazy_run(true, lazy, mlazy) == n);
+
+    for (size_t i = 0; i < n; i++){
+        assert(eager[i] == lazy[i]);
+        assert(meager[i/3] == mlazy[i/3]);
+    }
+
+    /* logging */
+    fault_init();
+    fault_module mod = fault_conf_module(MONE_ALL, 1);
+    fault_id f1 = fault_getid(mod, MONE_1);
+    fault_id f2 = fault_getid(mod, MONE_2);
+    assert(fault_policy_count_abs(f1, 1, 2));
+    fault_conf_lazy(true);
+
+    mockTime = 10;
+    fault_update(f1, 5, true);
+    fault_update(f1, 6, true);
+    fault_update(f2, 7, true);
+    assert(fault_logs_length() == 0);
+    assert(fault_count_errors(f1) == 2);
+
+    mockTime = 20;
+    assert(fault_status(f1) == FAULT_ST_ERROR);
+    assert(fault_logs_length() == 1);
+    FaultLog log = fault_log(0);
+    assert(log.timestamp == 20);
+    assert(log.code == MONE_1);
+    assert(log.status == FAULT_ST_ERROR);
+    assert(log.refValue == 6);
+
+    /* already evaluated */
+    assert(fault_status(f1) == FAULT_ST_ERROR);
+    assert(fault_logs_length() == 1);
+
+    assert(fault_flush() == 1);
+    assert(fault_flush() == 0);
+    assert(fault_logs_length() == 2);
+    assert(fault_log(0).code == MONE_2);
+
+    /* reset drops the pending evaluation */
+    fault_update(f2, 8, true);
+    assert(fault_reset(f2));
+    assert(fault_flush() == 0);
+
+    /* back to eager */
+    fault_update(f2, 9, true);
+    fault_conf_lazy(false);
+    assert(fault_logs_length() == 2);
+    fault_update(f2, 10, true);
+    assert(fault_logs_length() == 2);
+    assert(fault_log(0).refValue == 10);
+    assert(fault_log(1).refValue == 9);
+
+    puts("OK");
+}/* test_lazy */
+
+/* counts the calls of the update hook and the updates */
+static void update_n_hook(fault_millisecs now,
+                          fault_id id,
+                          long ref,
+                          bool condition,
+                          fault_counter n,
+                          void *ctx)
+{
+    fault_counter *calls = (fault_counter*)ctx;
+
+    (void)now;
+    (void)id;
+    (void)ref;
+    (void)condition;
+    calls[0] = calls[0] + 1;
+    calls[1] = n;
+}
+
+void test_update_n(void)
+{
+    printf("test_update_n: ");
+
+    /* single updates on f1, bulk on f2 */
+    for (int pol = 0; pol < 4; pol++){
+        fault_init();
+        fault_module mod = fault_conf_module(MONE_ALL, 1);
+        fault_id f1 = fault_getid(mod, MONE_1);
+        fault_id f2 = fault_getid(mod, MONE_2);
+
+        for (fault_id f = f1; f <= f2; f++){
+            switch (pol){
+            case 0: assert(fault_policy_none(f)); break;
+            case 1: assert(fault_policy_count_abs(f, 10, 30)); break;
+            case 2: assert(fault_policy_count_reset(f, 5, 12, 7)); break;
+            default: assert(fault_policy_time_reset(f, 8, 20, 5)); break;
+            }
+        }
+
+        unsigned long seed = 3;
+        for (int run = 0; run < 400; run++){
+            seed = seed * 1103515245UL + 12345UL;
+            bool cond = ((seed >> 8) % 3) == 0;
+            fault_counter n = (seed >> 12) % 20;
+            long ref = (long)((seed >> 16) % 100);
+            mockTime += (seed >> 20) % 4;
+
+            for (fault_counter i = 0; i < n; i++){
+                fault_update(f1, ref, cond);
+            }
+            if (cond){
+                assert(fault_update_fault_n(f2, ref, n));
+            } else {
+                assert(!fault_update_clear_n(f2, n));
+            }
+
+            assert(fault_count_errors(f1) == fault_count_errors(f2));
+            assert(fault_status(f1) == fault_status(f2));
+            assert(fault_refval(f1) == fault_refval(f2));
+        }
+    }/* for policies */
+
+    /* one log entry */
+    fault_init();
+    fault_module mod = fault_conf_module(MONE_ALL, 1);
+    fault_id fid = fault_getid(mod, MONE_1);
+    assert(fault_policy_count_reset(fid, 1, 2, 3));
+    assert(fault_update_fault_n(fid, 4, 1000));
+    assert(fault_logs_length() == 1);
+    assert(fault_log(0).status == FAULT_ST_ERROR);
+    assert(fault_log(0).refValue == 4);
+    assert(!fault_update_clear_n(fid, 0));
+    assert(fault_logs_length() == 1);
+    assert(!fault_update_clear_n(fid, 1000000));
+    assert(fault_status(fid) == FAULT_ST_NORMAL);
+    assert(fault_count_errors(fid) == 0);
+
+    /* overflow of the total counter */
+    const fault_counter max = FAULT_COMPACT ? UINT_MAX : ULONG_MAX;
+    assert(fault_policy_count_abs(fid, 1, 2));
+    assert(fault_update_fault_n(fid, 1, max));
+    assert(fault_count_errors(fid) == max);
+    fault_update(fid, 2, true);
+    assert(fault_count_errors(fid) == 1);
+
+    assert(fault_reset(fid));
+    assert(fault_update_fault_n(fid, 1, max - 1));
+    assert(fault_update_fault_n(fid, 1, 3));
+    assert(fault_count_errors(fid) == 2);
+
+    assert(fault_reset(fid));
+    assert(!fault_update_clear_n(fid, max - 1));
+    assert(fault_update_fault_n(fid, 1, 3));
+    assert(fault_count_errors(fid) == 2);
+
+    /* periodic overflows */
+    assert(fault_reset(fid));
+    assert(fault_update_fault_n(fid, 1, ULONG_MAX));
+    assert(fault_count_errors(fid) == max);
+
+    /* a single call of the hook, with the count */
+    fault_counter calls[2] = {0, 0};
+    fault_conf_update_hook(update_n_hook, calls);
+    assert(fault_update_fault_n(fid, 1, max));
+    assert(calls[0] == 1 && calls[1] == max);
+    assert(!fault_update_clear_n(fid, 0));
+    assert(calls[0] == 1);
+    fault_update(fid, 1, false);
+    assert(calls[0] == 2 && calls[1] == 1);
+    fault_conf_update_hook(NULL, NULL);
+
+    puts("OK");
+}/* test_update_n */
+
+void test_stats(void)
+{
+    printf("test_stats: ");
+
+    FaultStats st;
+
+    fault_init();
+    fault_stats(&st);
+    assert(st.updates == 0);
+    assert(st.logs == 0);
+
+    fault_module mod1 = fault_conf_module(MONE_ALL, 1);
+    fault_id fid = fault_getid(mod1, MONE_1);
+    assert(fault_policy_count_reset(fid, 1, 2, 2));
+
+    fault_update(fid, 1, true);
+    fault_update(fid, 2, false);
+    fault_update(fid, 3, false); /* reset */
+    fault_update(999, 4, true);  /* unknown */
+    assert(!fault_update_clear_n(fid, 10)); /* 5 resets */
+    assert(fault_update_fault_n(999, 5, 3));
+
+    fault_stats(&st);
+    if (FAULT_STATS){
+        assert(st.updates == 17);
+        assert(st.unknown == 4);
+        assert(st.policyResets == 6);
+        assert(st.overflows == 0);
+        assert(st.logs == 6);
+        assert(st.logsEvicted == 6 - FAULT_LOG_MAX);
+        assert(st.logsDropped == 0);
+    } else {
+        assert(st.updates == 0);
+        assert(st.logs == 0);
+    }
+
+    /* no slots left to the shared queue */
+    assert(fault_conf_module_logs(mod1, FAULT_LOG_MAX));
+    fault_update(999, 4, true);
+    fault_stats(&st);
+    assert(st.logsDropped == (FAULT_STATS ? 1 : 0));
+
+    fault_init();
+    fault_stats(&st);
+    assert(st.updates == 0);
+
+    puts("OK");
+}/* test_stats */
+
+void test_inhibit(void)
+{
+    printf("test_inhibit: ");
+
+    FaultStats st;
+
+    fault_init();
+    fault_module mod1 = fault_conf_module(MONE_ALL, 1);
+    fault_module mod2 = fault_conf_module(MTWO_ALL, 1);
+    fault_id power = fault_getid(mod1, MONE_1);
+    fault_id other = fault_getid(mod2, MTWO_4);
+
+    assert(fault_policy_count_abs(power, 1, 1));
+    assert(fault_policy_count_abs(other, 1, 1));
+    for (fault_code c = MTWO_1; c <= MTWO_3; c++){
+        fault_id fid = fault_getid(mod2, c);
+        assert(fault_policy_count_abs(fid, 1, 1));
+        assert(fault_inhibit(power, fid));
+    }
+
+    assert(!fault_inhibit(power, power));
+    assert(!fault_inhibit(power, 999));
+    assert(!fault_inhibit(999, other));
+    assert(!fault_inhibited(999));
+    assert(!fault_inhibited(fault_getid(mod2, MTWO_1)));
+
+    /* the cascade */
+    fault_update(power, 1, true);
+    assert(fault_status_module(mod1) == FAULT_SM_FAULTED);
+    assert(fault_inhibited(fault_getid(mod2, MTWO_1)));
+    assert(!fault_inhibited(other));
+
+    size_t logs = fault_logs_length();
+    FaultLog last = fault_log(0);
+    for (fault_code c = MTWO_1; c <= MTWO_3; c++){
+        fault_update(fault_getid(mod2, c), 2, true);
+        assert(fault_status(fault_getid(mod2, c)) == FAULT_ST_ERROR);
+    }
+    assert(fault_logs_length() == logs);
+    assert(fault_log(0).index == last.index);
+    assert(fault_status_module(mod2) == FAULT_SM_NORMAL);
+
+    fault_stats(&st);
+    assert(st.logsInhibited == (FAULT_STATS ? 3 : 0));
+
+    fault_update(other, 3, true);
+    assert(fault_status_module(mod2) == FAULT_SM_FAULTED);
+    assert(fault_log(0).code == MTWO_4);
+
+    /* the parent recovers, the children count again */
+    assert(fault_reset(power));
+    assert(!fault_inhibited(fault_getid(mod2, MTWO_1)));
+    assert(fault_status_module(mod2) == FAULT_SM_FAILED);
+
+    /* lazy mode, the parents are evaluated first */
+    fault_conf_lazy(true);
+    fault_update(power, 4, true);
+    assert(fault_status_module(mod2) == FAULT_SM_FAULTED);
+    fault_conf_lazy(false);
+
+    /* a parent already in error */
+    fault_id child = fault_getid(mod1, MONE_2);
+    assert(fault_inhibit(other, child));
+    assert(fault_inhibited(child));
+
+    fault_init();
+    assert(!fault_inhibited(child));
+
+    puts("OK");
+}/* test_inhibit */
+
+void test_top_k(void)
+{
+    printf("test_top_k: ");
+
+    FaultTopK top[FAULT_TOPK_MAX + 1];
+
+    fault_init();
+    fault_module mod1 = fault_conf_module(MONE_ALL, 1);
+    fault_module mod2 = fault_conf_module(MTWO_ALL, 1);
+    fault_id a = fault_getid(mod1, MONE_1);
+    fault_id b = fault_getid(mod1, MONE_2);
+    fault_id c = fault_getid(mod2, MTWO_1);
+    fault_id d = fault_getid(mod2, MTWO_2);
+
+    assert(fault_top_k(top, 3) == 0);
+
+    assert(fault_policy_count_reset(a, 1, 2, 1));
+    for (int i = 0; i < 5; i++){
+        fault_update(a, i, true);
+        fault_update(a, i, false); /* not counted, it resets the policy */
+    }
+    fault_update(b, 0, true);
+    fault_update(b, 0, true);
+    fault_update(b, 0, true);
+    fault_update(c, 0, true);
+    assert(fault_count_errors(a) == 0);
+
+    assert(fault_top_k(top, 3) == 3);
+    assert(top[0].id == a && top[0].count == 5 && top[0].error == 0);
+    assert(top[1].id == b && top[1].count == 3 && top[1].error == 0);
+    assert(top[2].id == c && top[2].count == 1 && top[2].error == 0);
+
+    if (FAULT_TOPK_MAX == 3){
+        /* d takes the place of c, 1 <= count(d) <= 2 */
+        fault_update(d, 0, true);
+        assert(fault_top_k(top, 3) == 3);
+        assert(top[2].id == d && top[2].count == 2 && top[2].error == 1);
+
+        /* c is back, 1 <= count(c) <= 3 */
+        fault_update(c, 0, true);
+        fault_update(c, 0, true);
+        assert(fault_top_k(top, 3) == 3);
+        assert(top[1].id == c || top[2].id == c);
+    }
+
+    /* the policy resets and fault_reset() do not change the counts */
+    assert(fault_reset(a));
+    assert(fault_update_fault_n(b, 0, 10));
+    assert(fault_top_k(top, 1) == 1);
+    assert(top[0].id == b && top[0].count == 13);
+    assert(fault_top_k(top, 2) == 2);
+    assert(top[1].id == a && top[1].count == 5);
+
+    fault_init();
+    assert(fault_top_k(top, 3) == 0);
+
+    puts("OK");
+}/* test_top_k */
+
+void test_invalid_ids(void)
+{
+    printf("test_invalid_ids: ");
+
+    FaultInvalidId bad[4];
+
+    fault_init();
+    fault_module mod1 = fault_conf_module(MONE_ALL, 1);
+    fault_id fid = fault_getid(mod1, MONE_1);
+
+    assert(fault_invalid_ids(bad, 4) == 0);
+
+    for (int i = 0; i < 5; i++){
+        fault_update(100, i, true);
+    }
+    fault_update(200, 0, true);
+    fault_update(200, 0, false);
+    fault_update(200, 0, true);
+    assert(fault_update_fault_n(300, 0, 2));
+    fault_update(fid, 0, true);
+
+    assert(fault_invalid_count(fid) == 0);
+    if (FAULT_INVALID_WIDTH == 0){
+        assert(fault_invalid_ids(bad, 4) == 0);
+        puts("OK");
+        return;
+    }
+
+    /* the counts can only be overestimated */
+    assert(fault_invalid_count(100) >= 5);
+    assert(fault_invalid_count(300) >= 2);
+
+    assert(FAULT_INVALID_TOP == 2);
+    assert(fault_invalid_ids(bad, 4) == 2);
+    assert(bad[0].id == 100 && bad[0].count == 5 && bad[0].error == 0);
+    assert(bad[1].id == 200 && bad[1].count == 3 && bad[1].error == 0);
+
+    /* 300 takes the place of the lowest */
+    assert(fault_update_fault_n(300, 0, 10));
+    assert(fault_invalid_ids(bad, 4) == 2);
+    assert(bad[0].id == 300 && bad[0].count == 12 && bad[0].error == 2);
+    assert(bad[1].id == 100 && bad[1].count == 5);
+
+    /* exact from the entry in the table */
+    fault_update(300, 0, true);
+    assert(fault_invalid_ids(bad, 4) == 2);
+    assert(bad[0].count == 13 && bad[0].error == 2);
+
+    assert(fault_invalid_ids(bad, 1) == 1);
+    assert(bad[0].id == 300);
+
+    fault_init();
+    assert(fault_invalid_ids(bad, 4) == 0);
+    assert(fault_invalid_count(300) == 0);
+
+    puts("OK");
+}/* test_invalid_ids */
+
+void test_flap(void)
+{
+    printf("test_flap: ");
+
+    fault_init();
+    mockTime = 0;
+    fault_module mod1 = fault_conf_module(MONE_ALL, 1);
+    fault_id fid = fault_getid(mod1, MONE_1);
+    fault_id fid2 = fault_getid(mod1, MONE_2);
+
+    /* hysteresis */
+    assert(!fault_conf_hysteresis(999, 3));
+    assert(fault_conf_hysteresis(fid, 3));
+    assert(fault_policy_count_reset(fid, 1, 2, 1)); /* keeps it */
+
+    fault_update(fid, 1, true);
+    assert(fault_status(fid) == FAULT_ST_WARNING);
+    fault_update(fid, 2, true);
+    assert(fault_status(fid) == FAULT_ST_ERROR);
+    fault_update(fid, 3, false); /* reset by the policy */
+    assert(fault_count_errors(fid) == 0);
+    assert(fault_status(fid) == FAULT_ST_ERROR);
+    fault_update(fid, 4, false);
+    assert(fault_status(fid) == FAULT_ST_ERROR);
+    fault_update(fid, 5, false);
+    assert(fault_status(fid) == FAULT_ST_NORMAL);
+
+    /* the more severe status is immediate */
+    fault_update(fid, 6, true);
+    assert(fault_status(fid) == FAULT_ST_WARNING);
+    assert(fault_conf_hysteresis(fid, 0));
+    fault_update(fid, 7, false);
+    assert(fault_status(fid) == FAULT_ST_NORMAL);
+
+    /* damping */
+    FaultDamping damping = {1000, 2500, 1000, 1000};
+    FaultDamping bad = damping;
+    bad.penalty = 0;
+    assert(!fault_conf_damping(fid2, &bad));
+    bad = damping;
+    bad.halfLife = 0;
+    assert(!fault_conf_damping(fid2, &bad));
+    bad = damping;
+    bad.reuse = 3000;
+    assert(!fault_conf_damping(fid2, &bad));
+    assert(!fault_conf_damping(999, &damping));
+    assert(!fault_damped(999));
+
+    assert(fault_policy_count_reset(fid2, 1, 1, 1));
+    assert(fault_conf_damping(fid2, &damping));
+
+    fault_update(fid2, 1, true);  /* 1000 */
+    assert(fault_status(fid2) == FAULT_ST_ERROR);
+    fault_update(fid2, 2, false); /* 2000 */
+    assert(fault_status(fid2) == FAULT_ST_NORMAL);
+    fault_update(fid2, 3, true);  /* 3000, suppressed */
+    assert(fault_status(fid2) == FAULT_ST_ERROR);
+    assert(fault_damped(fid2));
+    fault_update(fid2, 4, false); /* 4000, held */
+    assert(fault_status(fid2) == FAULT_ST_ERROR);
+
+    mockTime = 2000;
+    fault_update(fid2, 5, false); /* 1000 */
+    assert(fault_status(fid2) == FAULT_ST_ERROR);
+    mockTime = 2100;
+    fault_update(fid2, 6, false); /* < 1000, released */
+    assert(fault_status(fid2) == FAULT_ST_NORMAL);
+    assert(!fault_damped(fid2));
+
+    assert(fault_conf_damping(fid2, NULL));
+    fault_update(fid2, 7, true);
+    fault_update(fid2, 8, false);
+    fault_update(fid2, 9, true);
+    fault_update(fid2, 10, false);
+    assert(fault_status(fid2) == FAULT_ST_NORMAL);
+    assert(!fault_damped(fid2));
+
+    puts("OK");
+}/* test_flap */
+
+static bool reconfDone;
+
+/* Retune the threshold of the id 'arg' from another thread */
+static
+void *reconf_writer(void *arg)
+{
+    fault_id fid = *(const fault_id *)arg;
+
+    for (unsigned long warn = 2; warn <= 100; warn++){
+        while (!fault_reconf_begin()){
+            sched_yield();
+        }
+        assert(fault_reconf_policy(fid, FAULT_POL_COUNT_ABS, warn, 1000, 0));
+        assert(fault_reconf_commit(true));
+    }
+    __atomic_store_n(&reconfDone, true, __ATOMIC_RELEASE);
+
+    return NULL;
+}/* reconf_writer */
+
+void test_reconf(void)
+{
+    printf("test_reconf: ");
+
+    fault_init();
+    fault_module mod1 = fault_conf_module(MONE_ALL, 1);
+    fault_id fid = fault_getid(mod1, MONE_1);
+    fault_id fid2 = fault_getid(mod1, MONE_2);
+    assert(fault_policy_count_abs(fid, 5, 10));
+    assert(fault_policy_count_abs(fid2, 5, 10));
+
+    assert(!fault_reconf_policy(fid, FAULT_POL_COUNT_ABS, 1, 2, 0));
+    assert(!fault_reconf_commit(true));
+
+    fault_update(fid, 1, true);
+    fault_update(fid, 2, true);
+    fault_update(fid2, 3, true);
+    assert(fault_status(fid) == FAULT_ST_NORMAL);
+
+    /* keep the counters */
+    assert(fault_reconf_begin());
+    assert(!fault_reconf_begin());
+    assert(!fault_reconf_policy(999, FAULT_POL_COUNT_ABS, 1, 2, 0));
+    assert(!fault_reconf_policy(fid, FAULT_POL_COUNT_ABS, 0, 2, 0));
+    assert(fault_reconf_policy(fid, FAULT_POL_COUNT_ABS, 1, 2, 0));
+    assert(fault_status(fid) == FAULT_ST_NORMAL); /* not published */
+    assert(fault_reconf_commit(true));
+
+    /* not seen by the update thread yet */
+    assert(!fault_reconf_begin());
+    assert(fault_flush() == 0);
+    assert(fault_status(fid) == FAULT_ST_ERROR);
+    assert(fault_count_errors(fid) == 2);
+    assert(fault_log(0).code == MONE_1);
+
+    /* reset the counters, the other ids are not touched */
+    assert(fault_reconf_begin());
+    assert(fault_reconf_policy(fid, FAULT_POL_COUNT_ABS, 3, 3, 0));
+    assert(fault_reconf_commit(false));
+    fault_update(fid, 4, true);
+    assert(fault_count_errors(fid) == 1);
+    assert(fault_status(fid) == FAULT_ST_NORMAL);
+    assert(fault_count_errors(fid2) == 1);
+
+    /* aborted */
+    assert(fault_reconf_begin());
+    assert(fault_reconf_policy(fid, FAULT_POL_NONE, 0, 0, 0));
+    fault_reconf_abort();
+    assert(!fault_reconf_commit(true));
+    fault_update(fid, 5, true);
+    fault_update(fid, 6, true);
+    assert(fault_status(fid) == FAULT_ST_ERROR);
+
+    /* while updating */
+    pthread_t writer;
+    reconfDone = false;
+    assert(pthread_create(&writer, NULL, reconf_writer, &fid) == 0);
+    for (long i = 0; !__atomic_load_n(&reconfDone, __ATOMIC_ACQUIRE); i++){
+        fault_update(fid, i, false);
+    }
+    assert(pthread_join(writer, NULL) == 0);
+    fault_update(fid, 0, false);
+    assert(fault_status(fid) == FAULT_ST_NORMAL); /* warn 100 */
+    assert(fault_count_errors(fid) == 3);
+
+    puts("OK");
+}/* test_reconf */
+
+void test_history(void)
+{
+    printf("test_history: ");
+
+    FaultSample out[8];
+
+    fault_init();
+    fault_module mod = fault_conf_module(MONE_ALL, 1);
+    fault_id f1 = fault_getid(mod, MONE_1);
+    fault_id f2 = fault_getid(mod, MONE_2);
+    fault_id f3 = fault_getid(mod, MONE_3);
+
+    assert(!fault_conf_history(FAULT_ID_MAX, 1));
+    assert(!fault_conf_history(f1, 0));
+    assert(fault_conf_history(f1, 4));
+    assert(!fault_conf_history(f1, 1));
+    assert(!fault_conf_history(f2, 3)); /* pool of 6 */
+    assert(fault_conf_history(f2, 2));
+    assert(!fault_conf_history(f3, 1));
+
+    /* only the faults */
+    assert(fault_policy_count_reset(f1, 1, 2, 1));
+    assert(fault_history(f1, out, 8) == 0);
+    for (long i = 1; i <= 3; i++){
+        mockTime = (fault_millisecs)(i * 10);
+        fault_update(f1, i, true);
+        fault_update(f1, -i, false);
+    }
+    assert(fault_history(f1, out, 8) == 3);
+    assert(out[0].refValue == 1 && out[0].timestamp == 10);
+    assert(out[2].refValue == 3 && out[2].timestamp == 30);
+
+    /* the oldest are overwritten, kept by the policy resets */
+    for (long i = 4; i <= 6; i++){
+        mockTime = (fault_millisecs)(i * 10);
+        fault_update(f1, i, true);
+        fault_update(f1, 0, false);
+    }
+    assert(fault_count_errors(f1) == 0);
+    assert(fault_history(f1, out, 8) == 4);
+    for (int k = 0; k < 4; k++){
+        assert(out[k].refValue == 3 + k);
+        assert(out[k].timestamp == (fault_millisecs)(30 + k * 10));
+    }
+    assert(fault_history(f1, out, 2) == 2);
+    assert(out[0].refValue == 5 && out[1].refValue == 6);
+
+    fault_update_fault_n(f2, 7, 100);
+    assert(fault_history(f2, out, 8) == 1);
+    assert(out[0].refValue == 7);
+    assert(fault_history(f3, out, 8) == 0);
+    assert(fault_history(FAULT_ID_MAX, out, 8) == 0);
+
+    assert(fault_reset(f1));
+    assert(fault_history(f1, out, 8) == 0);
+    fault_update(f1, 8, true);
+    assert(fault_history(f1, out, 8) == 1 && out[0].refValue == 8);
+
+    /* the pool is free again */
+    fault_init();
+    mod = fault_conf_module(MONE_ALL, 1);
+    assert(fault_history(fault_getid(mod, MONE_1), out, 8) == 0);
+    assert(fault_conf_history(fault_getid(mod, MONE_3), 6));
+
+    puts("OK");
+}/* test_history */
+
+void test_refstats(void)
+{
+    printf("test_refstats: ");
+
+    FaultRefStats st;
+
+    fault_init();
+    fault_module mod = fault_conf_module(MONE_ALL, 1);
+    fault_id f1 = fault_getid(mod, MONE_1);
+    fault_id f2 = fault_getid(mod, MONE_2);
+    fault_id f3 = fault_getid(mod, MONE_3);
+
+    assert(!fault_conf_refstats(FAULT_ID_MAX, 0));
+    assert(!fault_conf_refstats(f1, sizeof(unsigned long) * CHAR_BIT));
+    assert(fault_conf_refstats(f1, 0));
+    assert(!fault_conf_refstats(f1, 0));
+    assert(fault_conf_refstats(f2, 4));
+    assert(!fault_conf_refstats(f3, 0)); /* FAULT_REFSTATS_MAX */
+    assert(!fault_refstats(f3, &st));
+
+    assert(fault_refstats(f1, &st));
+    assert(st.count == 0 && st.mean == 0 && st.variance == 0);
+
+    /* 2, 4, 4, 4, 5, 5, 7, 9: mean 5, variance 4 */
+    const long values[8] = {2, 4, 4, 4, 5, 5, 7, 9};
+    for (int i = 0; i < 8; i++){
+        fault_update(f1, values[i], values[i] > 4);
+    }
+    assert(fault_refstats(f1, &st));
+    assert(st.count == 8 && st.faults == 4);
+    assert(st.min == 2 && st.max == 9);
+    assert(st.mean > 4.999 && st.mean < 5.001);
+    assert(st.variance > 3.999 && st.variance < 4.001);
+    assert(st.buckets[16 + 2] == 1); /* 2 */
+    assert(st.buckets[16 + 3] == 6); /* 4..7 */
+    assert(st.buckets[16 + 4] == 1); /* 9 */
+
+    /* n samples at once, negative values and the open buckets */
+    fault_update_fault_n(f2, -100, 3);
+    fault_update_clear_n(f2, 10);
+    fault_update(f2, 5, false);
+    fault_update(f2, LONG_MIN, false);
+    fault_update(f2, LONG_MAX, false);
+    assert(fault_refstats(f2, &st));
+    assert(st.count == 6 && st.faults == 3);
+    assert(st.min == LONG_MIN && st.max == LONG_MAX);
+    assert(st.buckets[16 - 3] == 3); /* -100 / 16 = -6 */
+    assert(st.buckets[16] == 1);     /* 5 / 16 = 0 */
+    assert(st.buckets[0] == 1);
+    assert(st.buckets[FAULT_REFSTATS_BUCKETS - 1] == 1);
+
+    fault_init();
+    fault_conf_module(MONE_ALL, 1);
+    fault_conf_refstats(f1, 0);
+    fault_update_fault_n(f1, 10, 4);
+    assert(fault_refstats(f1, &st));
+    assert(st.count == 4 && st.mean == 10 && st.variance == 0);
+
+    /* cleared by the policies, the configuration is kept */
+    assert(fault_policy_count_abs(f1, 1, 2));
+    assert(fault_refstats(f1, &st) && st.count == 0);
+    fault_update(f1, -3, false);
+    assert(fault_refstats(f1, &st));
+    assert(st.count == 1 && st.min == -3 && st.buckets[16 - 2] == 1);
+    assert(!fault_refstats(f2, &st));
+
+    puts("OK");
+}/* test_refstats */
+
+void test_incidents(void)
+{
+    printf("test_incidents: ");
+
+    FaultIncident inc;
+    fault_id ids[FAULT_ID_MAX];
+
+    fault_init();
+    fault_module mod1 = fault_conf_module(MONE_ALL, 1);
+    fault_module mod2 = fault_conf_module(MTWO_ALL, 2);
+    fault_id f1 = fault_getid(mod1, MONE_1);
+    fault_id f2 = fault_getid(mod1, MONE_2);
+    fault_id f3 = fault_getid(mod1, MONE_3);
+    fault_id g1 = fault_getid(mod2, MTWO_1);
+    fault_id g2 = fault_getid(mod2, MTWO_2);
+
+    /* disabled by default */
+    mockTime = 100;
+    fault_update(f1, 1, true);
+    assert(fault_incidents() == 0);
+    fault_reset(f1);
+
+    assert(!fault_conf_incidents(10, 0));
+    assert(fault_conf_incidents(10, 2));
+
+    /* a burst across the modules, a fault already started is not counted */
+    fault_update(f1, 1, true);
+    mockTime = 105;
+    fault_update(g1, 1, true);
+    fault_update(f1, 1, true);
+    mockTime = 110;
+    fault_update(f2, 1, true);
+    assert(fault_incidents() == 1);
+    assert(fault_incident(0, &inc));
+    assert(inc.start == 100 && inc.end == 110 && inc.open);
+    assert(inc.count == 3 && inc.modules == 2);
+    assert(fault_incident_ids(0, ids, FAULT_ID_MAX) == 3);
+    assert(ids[0] == f1 && ids[1] == f2 && ids[2] == g1);
+    assert(fault_incident_ids(0, ids, 1) == 1 && ids[0] == f1);
+
+    /* out of the window, a single fault is not an incident */
+    mockTime = 200;
+    fault_update(f3, 1, true);
+    assert(fault_incidents() == 1);
+    assert(fault_incident(0, &inc) && inc.start == 100 && !inc.open);
+
+    /* it is replaced by the next one */
+    mockTime = 300;
+    fault_reset(f1);
+    fault_update(f1, 1, true);
+    fault_update(g1, 1, true);
+    fault_update_fault_n(g2, 1, 5);
+    assert(fault_incidents() == 2);
+    assert(fault_incident(0, &inc) && inc.start == 300 && inc.open);
+    assert(inc.count == 2);
+    assert(fault_incident(1, &inc) && inc.start == 100);
+    assert(!fault_incident(2, &inc));
+    assert(fault_incident_module(0, mod1) && fault_incident_module(0, mod2));
+    assert(!fault_incident_module(0, FAULT_GENERIC_MODULE));
+    assert(!fault_incident_module(2, mod1));
+
+    assert(fault_incidents_common(f1, g1) == 1);
+    assert(fault_incidents_common(f1, g2) == 1);
+    assert(fault_incidents_common(f1, f1) == 2);
+    assert(fault_incidents_common(f1, f3) == 0);
+    assert(fault_incidents_common(f1, FAULT_ID_MAX) == 0);
+
+    /* the last FAULT_INCIDENT_MAX and the current one */
+    for (fault_millisecs t = 400; t <= 600; t += 100){
+        mockTime = t;
+        fault_reset(f2);
+        fault_reset(f3);
+        fault_update(f2, 1, true);
+        fault_update(f3, 1, true);
+    }
+    assert(fault_incidents() == FAULT_INCIDENT_MAX + 1);
+    assert(fault_incident(0, &inc) && inc.start == 600 && inc.open);
+    assert(fault_incident(FAULT_INCIDENT_MAX, &inc) && inc.start == 600 - 100 * FAULT_INCIDENT_MAX);
+
+    /* the configuration empties them */
+    assert(fault_conf_incidents(0, 1));
+    assert(fault_incidents() == 0);
+    fault_reset(f2);
+    fault_update(f2, 1, true);
+    assert(fault_incidents() == 0);
+    assert(fault_incident_ids(0, ids, FAULT_ID_MAX) == 0);
+
+    mockTime = 0;
+    puts("OK");
+}/* test_incidents */
+
+void test_heartbeat(void)
+{
+    printf("test_heartbeat: ");
+
+    static const char conf[] = "module 2 0\npolicy * heartbeat 10 20\n";
+
+    fault_init();
+    fault_module mod = fault_conf_module(MONE_ALL, 1);
+    fault_id f1 = fault_getid(mod, MONE_1);
+    fault_id f2 = fault_getid(mod, MONE_2);
+    fault_id f3 = fault_getid(mod, MONE_3);
+
+    assert(!fault_policy_heartbeat(FAULT_ID_MAX, 1, 2));
+    assert(!fault_policy_heartbeat(f1, 0, 2));
+    assert(!fault_policy_heartbeat(f1, 5, 4));
+
+    /* the silence starts at the configuration */
+    mockTime = 100;
+    assert(fault_policy_heartbeat(f1, 10, 30));
+    assert(fault_policy_count_abs(f2, 1, 2));
+    assert(fault_policy_heartbeat(f3, 5, 5));
+
+    assert(fault_check_stale(105) == 1);
+    assert(fault_status(f3) == FAULT_ST_ERROR);
+    assert(fault_status(f1) == FAULT_ST_NORMAL);
+    assert(fault_check_stale(110) == 1);
+    assert(fault_status(f1) == FAULT_ST_WARNING);
+    assert(fault_status(f2) == FAULT_ST_NORMAL);
+    assert(fault_check_stale(110) == 0);
+    assert(fault_check_stale(130) == 1);
+    assert(fault_status(f1) == FAULT_ST_ERROR);
+
+    /* any update is alive, the faults are counted only */
+    mockTime = 131;
+    fault_update(f1, 1, true);
+    assert(fault_status(f1) == FAULT_ST_NORMAL);
+    assert(fault_count_errors(f1) == 1);
+    assert(fault_check_stale(135) == 0);
+    assert(fault_status(f3) == FAULT_ST_ERROR);
+
+    /* another policy is never stale */
+    assert(fault_policy_count_abs(f3, 1, 2));
+    assert(fault_status(f3) == FAULT_ST_NORMAL);
+    assert(fault_check_stale(1000) == 1); /* f1 */
+    assert(fault_status(f3) == FAULT_ST_NORMAL);
+
+    /* lazy, evaluated at the read */
+    fault_conf_lazy(true);
+    mockTime = 1000;
+    fault_update(f1, 1, false);
+    assert(fault_check_stale(1010) == 1);
+    assert(fault_status(f1) == FAULT_ST_WARNING);
+    fault_conf_lazy(false);
+
+    /* from the loader */
+    mockTime = 2000;
+    assert(fault_load_text(conf, strlen(conf), NULL));
+    fault_id g1 = fault_getid(mod + 1, 0);
+    fault_id g2 = fault_getid(mod + 1, 1);
+    assert(fault_check_stale(2019) == 3); /* and f1 */
+    assert(fault_status(g1) == FAULT_ST_WARNING);
+    mockTime = 2015;
+    fault_update(g2, 0, false);
+    assert(fault_check_stale(2020) == 1);
+    assert(fault_status(g1) == FAULT_ST_ERROR);
+    assert(fault_status(g2) == FAULT_ST_NORMAL);
+
+    /* a reconfiguration to heartbeat starts the silence */
+    mockTime = 3000;
+    assert(fault_reconf_begin());
+    assert(fault_reconf_policy(f3, FAULT_POL_HEARTBEAT, 10, 20, 0));
+    assert(fault_reconf_commit(true));
+    fault_flush();
+    fault_check_stale(3009);
+    assert(fault_status(f3) == FAULT_ST_NORMAL);
+    fault_check_stale(3010);
+    assert(fault_status(f3) == FAULT_ST_WARNING);
+
+    mockTime = 0;
+    puts("OK");
+}/* test_heartbeat */
+
+void test_loader(void)
+{
+    printf("test_loader: ");
+
+    static const char conf[] =
+        "# plant\n"
+        "module 3 1\n"
+        "policy * count_abs 1 2\n"
+        "policy 2 time_reset 10 20 30\n"
+        "\n"
+        "module 4 0   # second\n"
+        "\tpolicy 0-1 count_reset 1 1 2\r\n";
+    unsigned char bin[256];
+    FaultLoaderError err;
+
+    fault_init();
+    assert(fault_load_text(conf, strlen(conf), &err));
+    assert(fault_modules_length() == 3);
+    assert(fault_module_codes(1) == 3);
+    assert(fault_module_codes(2) == 4);
+
+    fault_update(fault_getid(1, 0), 1, true);
+    assert(fault_status(fault_getid(1, 0)) == FAULT_ST_WARNING);
+    fault_update(fault_getid(2, 1), 1, true);
+    assert(fault_status(fault_getid(2, 1)) == FAULT_ST_ERROR);
+    fault_update(fault_getid(2, 2), 1, true);
+    assert(fault_status(fault_getid(2, 2)) == FAULT_ST_NORMAL);
+
+    /* errors, nothing is configured */
+    struct {
+        const char *text;
+        size_t line;
+        size_t column;
+    } bad[] = {
+        {"module 3 1\npolicy 5 none\n", 2, 1},
+        {"module 3 x\n", 1, 10},
+        {"module 3\n", 1, 9},
+        {"policy * none\n", 1, 1},
+        {"module 3 1\npolicy * count_max 1 2\n", 2, 10},
+        {"module 3 1\npolicy 2-1 none\n", 2, 1},
+        {"module 3 1\npolicy 1 count_abs 0 2\n", 2, 1},
+        {"module 3 1\npolicy 1 none 5\n", 2, 15},
+        {"module 3 1\nmodule 9 1\n", 2, 1},
+        {"module 1 1\nmodule 1 1\nmodule 1 1\n", 3, 1},
+        {"modules 3 1\n", 1, 1},
+        {"module 3 4294967296\n", 1, 10} /* u32 in the binary format */
+    };
+
+    fault_init();
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++){
+        assert(!fault_load_text(bad[i].text, strlen(bad[i].text), &err));
+        assert(err.line == bad[i].line);
+        assert(err.column == bad[i].column);
+        assert(err.message != NULL);
+        assert(fault_modules_length() == 1);
+    }
+    assert(fault_load_text("# empty\n", 8, NULL));
+    assert(fault_modules_length() == 1);
+
+    /* binary */
+    size_t len = fault_load_compile(conf, strlen(conf), NULL, 0, &err);
+    assert(len == 16 + 2 * 8 + 3 * 40);
+    assert(fault_load_compile(conf, strlen(conf), bin, 4, &err) == len);
+    assert(fault_load_compile(conf, strlen(conf), bin, sizeof(bin), &err) == len);
+    assert(fault_load_compile("module 3\n", 9, bin, sizeof(bin), &err) == 0);
+
+    assert(fault_load_binary(bin, len, &err));
+    assert(fault_modules_length() == 3);
+    fault_update(fault_getid(2, 1), 1, true);
+    assert(fault_status(fault_getid(2, 1)) == FAULT_ST_ERROR);
+
+    fault_init();
+    assert(!fault_load_binary(bin, len - 1, &err));
+    assert(err.line == 0 && err.column == 8);
+    bin[16 + 2 * 8 + 12] = FAULT_POL_ALL; /* type of the first policy */
+    assert(!fault_load_binary(bin, len, &err));
+    assert(err.column == 16 + 2 * 8);
+    assert(fault_modules_length() == 1);
+
+    /* files */
+    const char *path = "/tmp/faults_test.conf";
+    FILE *f = fopen(path, "wb");
+    assert(f != NULL);
+    assert(fwrite(conf, 1, strlen(conf), f) == strlen(conf));
+    fclose(f);
+    assert(fault_load_file(path, &err));
+    assert(fault_modules_length() == 3);
+
+    fault_init();
+    assert(fault_load_compile(conf, strlen(conf), bin, sizeof(bin), &err) == len);
+    f = fopen(path, "wb");
+    assert(f != NULL);
+    assert(fwrite(bin, 1, len, f) == len);
+    fclose(f);
+    assert(fault_load_file(path, &err));
+    assert(fault_module_codes(2) == 4);
+    remove(path);
+
+    assert(!fault_load_file(path, &err));
+    assert(err.line == 0);
+
+    /* the records of the same policy on the following codes,
+     * applied as a range, stop at a different one
+     */
+    static const char each[] =
+        "module 4 1\n"
+        "policy 0 count_abs 1 2\n"
+        "policy 1 count_abs 1 2\n"
+        "policy 2 count_abs 2 3\n"
+        "policy 3 count_abs 2 3\n";
+    fault_init();
+    len = fault_load_compile(each, strlen(each), bin, sizeof(bin), &err);
+    assert(len == 16 + 8 + 4 * 40);
+    assert(fault_load_binary(bin, len, &err));
+    for (fault_code c = 0; c < 4; c++){
+        fault_update(fault_getid(1, c), 1, true);
+        assert(fault_status(fault_getid(1, c)) ==
+               (c < 2 ? FAULT_ST_WARNING : FAULT_ST_NORMAL));
+    }
+    bin[16 + 8 + 3 * 40 + 16] = 0; /* warn 0 in the last record */
+    fault_init();
+    assert(!fault_load_binary(bin, len, &err));
+    assert(err.column == 16 + 8 + 3 * 40);
+
+    puts("OK");
+}/* test_loader */
+
+/* Scrape the exporter socket into 'buf', return the bytes read */
+static
+size_t exporter_scrape(const char *path, char *buf, size_t size)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+
+    const char *req = "GET /metrics HTTP/1.0\r\n\r\n";
+    assert(write(fd, req, strlen(req)) == (ssize_t)strlen(req));
+
+    size_t len = 0;
+    ssize_t r;
+    while ((r = read(fd, buf + len, size - 1 - len)) > 0){
+        len += (size_t)r;
+    }
+    buf[len] = '\0';
+    close(fd);
+
+    return len;
+}/* exporter_scrape */
+
+/* The line of the sample 'name' has 'value', after the blanks */
+static bool exporter_sample(const char *text,
+                            const char *name,
+                            const char *value)
+{
+    size_t len = strlen(name);
+    size_t vlen = strlen(value);
+
+    for (const char *p = strstr(text, name); p != NULL;
+         p = strstr(p + 1, name)){
+        const char *v = p + len;
+        if ((p != text && p[-1] != '\n') || *v != ' '){
+            continue;
+        }
+        while (*v == ' '){
+            v++;
+        }
+        if (strncmp(v, value, vlen) == 0 && v[vlen] == '\n'){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void test_exporter(void)
+{
+    printf("test_exporter: ");
+
+    static char buf[FAULT_EXPORTER_BUFFER];
+    const char *path = "/tmp/faults_test.sock";
+    const char *text;
+    size_t len;
+
+    fault_init();
+    fault_module mod1 = fault_conf_module(MONE_ALL, 1);
+    fault_module mod2 = fault_conf_module(MTWO_ALL, 0);
+    fault_id f1 = fault_getid(mod1, MONE_2);
+    fault_id f2 = fault_getid(mod2, MTWO_4);
+    assert(fault_policy_count_abs(f1, 1, 2));
+    assert(fault_policy_count_abs(f2, 1, 1));
+
+    assert(fault_modules_length() == 3);
+    assert(fault_module_codes(mod2) == MTWO_ALL);
+    assert(fault_module_codes(99) == 0);
+
+    /* nothing published */
+    assert(fault_exporter_render(&len) == NULL);
+    assert(len == 0);
+
+    fault_update(f1, -42, true);
+    fault_update(f2, 1234567, true);
+    fault_update(999, 0, true);
+    assert(fault_exporter_publish());
+
+    text = fault_exporter_render(&len);
+    assert(text != NULL);
+    assert(len > 0 && len < sizeof(buf));
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+    assert(buf[len-1] == '\n');
+    assert(strstr(buf, "# TYPE faults_errors gauge\n") != NULL);
+    assert(strstr(buf, "faults_module_status{module=\"1\"} 1\n") != NULL);
+    assert(strstr(buf, "faults_module_status{module=\"2\"} 3\n") != NULL);
+    assert(strstr(buf, "faults_status{module=\"1\",code=\"1\"} 1\n") != NULL);
+    assert(exporter_sample(buf, "faults_errors{module=\"1\",code=\"1\"}", "1"));
+    assert(exporter_sample(buf, "faults_refvalue{module=\"1\",code=\"1\"}", "-42"));
+    assert(exporter_sample(buf, "faults_refvalue{module=\"2\",code=\"3\"}", "1234567"));
+    assert(strstr(buf, "faults_status{module=\"0\",code=\"0\"} 0\n") != NULL);
+    assert(exporter_sample(buf, "faults_errors{module=\"2\",code=\"0\"}", "0"));
+    if (FAULT_STATS){
+        assert(exporter_sample(buf, "faults_updates_total", "3"));
+        assert(exporter_sample(buf, "faults_unknown_total", "1"));
+    }
+    assert(exporter_sample(buf, "faults_exporter_snapshots_total", "1"));
+    assert(strstr(buf, " \n") == NULL);
+
+    /* fixed width values, changed in place */
+    fault_update(f1, 5, true);
+    fault_update(f2, 0, false);
+    assert(fault_exporter_publish());
+    assert(fault_exporter_render(&len) == text);
+    assert(len == strlen(buf));
+    memcpy(buf, text, len);
+    assert(exporter_sample(buf, "faults_errors{module=\"1\",code=\"1\"}", "2"));
+    assert(exporter_sample(buf, "faults_refvalue{module=\"1\",code=\"1\"}", "5"));
+    assert(exporter_sample(buf, "faults_refvalue{module=\"2\",code=\"3\"}", "1234567"));
+    assert(fault_status_module(mod1) == FAULT_SM_FAULTED);
+    assert(strstr(buf, "faults_module_status{module=\"1\"} 2\n") != NULL);
+
+    /* new layout */
+    assert(fault_conf_module(1, 0) == FAULT_MODULE_KO); /* FAULT_ID_MAX */
+    fault_init();
+    assert(fault_conf_module(MONE_ALL, 0) != FAULT_MODULE_KO);
+    assert(fault_exporter_publish());
+    text = fault_exporter_render(&len);
+    assert(text != NULL && len < strlen(buf));
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+    assert(strstr(buf, "module=\"2\"") == NULL);
+    assert(exporter_sample(buf, "faults_errors{module=\"1\",code=\"2\"}", "0"));
+
+    fault_update(fault_getid(1, MONE_1), 3, true);
+
+    /* served by the thread */
+    assert(!fault_exporter_start(NULL));
+    assert(fault_exporter_start(path));
+    assert(!fault_exporter_start(path));
+
+    assert(fault_exporter_publish());
+
+    len = exporter_scrape(path, buf, sizeof(buf));
+    assert(len > 0);
+    assert(strncmp(buf, "HTTP/1.0 200 OK\r\n", 17) == 0);
+    char *body = strstr(buf, "\r\n\r\n");
+    assert(body != NULL);
+    body += 4;
+    char clen[64];
+    snprintf(clen, sizeof(clen), "Content-Length: %zu\r\n",
+             len - (size_t)(body - buf));
+    assert(strstr(buf, clen) != NULL);
+    assert(exporter_sample(body, "faults_errors{module=\"1\",code=\"0\"}", "1"));
+    assert(exporter_sample(body, "faults_refvalue{module=\"1\",code=\"0\"}", "3"));
+    assert(exporter_sample(body, "faults_exporter_snapshots_total", "4"));
+
+    fault_exporter_stop();
+    assert(access(path, F_OK) != 0);
+
+    puts("OK");
+}/* test_exporter */
+
+void test_merge(void)
+{
+    printf("test_merge: ");
+
+    static unsigned char d1[FAULT_MERGE_DATAGRAM];
+    static unsigned char d2[FAULT_MERGE_DATAGRAM];
+    static unsigned char d3[FAULT_MERGE_DATAGRAM];
+    const char *path = "/tmp/faults_merge.sock";
+    FaultMergeRecord rec;
+    FaultMergeLog logs[8];
+    uint32_t source;
+    size_t len1, len2, len3;
+
+    fault_init();
+    fault_module mod = fault_conf_module(MONE_ALL, 1);
+    fault_id f1 = fault_getid(mod, MONE_1);
+    fault_id f2 = fault_getid(mod, MONE_3);
+    assert(fault_policy_count_abs(f1, 1, 2));
+    assert(fault_policy_count_abs(f2, 1, 2));
+    fault_merge_reset();
+    assert(fault_merge_sources() == 0);
+
+    /* the first delta has all the ids */
+    mockTime = 100;
+    fault_update(f1, 7, true);
+    assert(fault_merge_delta(1, d1, 8) == 0);
+    len1 = fault_merge_delta(1, d1, sizeof(d1));
+    assert(len1 > 0);
+    assert(fault_merge_apply(d1, len1));
+    assert(fault_merge_sources() == 1);
+    assert(fault_merge_source(0, &source) && source == 1);
+    assert(!fault_merge_source(1, &source));
+    assert(fault_merge_record(1, f1, &rec));
+    assert(rec.status == FAULT_ST_WARNING);
+    assert(rec.errors == 1 && rec.refValue == 7 && rec.timestamp == 100);
+    assert(fault_merge_record(1, f2, &rec));
+    assert(rec.status == FAULT_ST_NORMAL && rec.errors == 0);
+    assert(!fault_merge_record(2, f1, &rec));
+    assert(!fault_merge_record(1, FAULT_ID_MAX, &rec));
+    assert(fault_merge_logs(logs, 8) == 1);
+    assert(logs[0].source == 1 && logs[0].log.code == MONE_1);
+    assert(logs[0].log.status == FAULT_ST_WARNING);
+
+    /* then only the changes */
+    mockTime = 200;
+    fault_update(f1, 8, true);
+    len2 = fault_merge_delta(1, d2, sizeof(d2));
+    assert(len2 > 0 && len2 < len1);
+    len3 = fault_merge_delta(1, d3, sizeof(d3));
+    assert(len3 > 0 && len3 < len2);
+
+    /* late and repeated deltas change nothing */
+    assert(fault_merge_apply(d3, len3));
+    assert(fault_merge_apply(d2, len2));
+    assert(fault_merge_apply(d1, len1));
+    assert(fault_merge_apply(d2, len2));
+    assert(fault_merge_record(1, f1, &rec));
+    assert(rec.status == FAULT_ST_ERROR);
+    assert(rec.errors == 2 && rec.refValue == 8 && rec.timestamp == 200);
+    assert(fault_merge_logs(logs, 8) == 2);
+    assert(logs[0].log.status == FAULT_ST_ERROR);
+    assert(logs[1].log.status == FAULT_ST_WARNING);
+    assert(fault_merge_logs(logs, 1) == 1);
+
+    /* the full state in two deltas */
+    fault_merge_resync();
+    len1 = fault_merge_delta(2, d1, sizeof(d1));
+    fault_merge_resync();
+    len2 = fault_merge_delta(2, d2, len1 - 1);
+    len3 = fault_merge_delta(2, d3, sizeof(d3));
+    assert(len2 > 0 && len2 < len1);
+    assert(len3 > 0 && len3 < len2);
+    assert(fault_merge_apply(d3, len3));
+    assert(fault_merge_apply(d2, len2));
+
+    /* across the sources */
+    assert(fault_merge_sources() == 2);
+    assert(fault_merge_total(f1, &rec));
+    assert(rec.status == FAULT_ST_ERROR && rec.errors == 4);
+    assert(fault_merge_total(f2, &rec));
+    assert(rec.status == FAULT_ST_NORMAL && rec.errors == 0);
+    assert(!fault_merge_total(FAULT_ID_MAX, &rec));
+
+    /* the logs of a late delta are kept in order */
+    mockTime = 300;
+    fault_update(f2, 10, true);
+    len2 = fault_merge_delta(1, d2, sizeof(d2));
+    mockTime = 400;
+    fault_update(f2, 11, true);
+    len3 = fault_merge_delta(1, d3, sizeof(d3));
+    assert(fault_merge_apply(d3, len3));
+    assert(fault_merge_apply(d2, len2));
+    assert(fault_merge_apply(d2, len2));
+    assert(fault_merge_logs(logs, 8) == 4);
+    assert(logs[0].log.status == FAULT_ST_ERROR && logs[0].log.timestamp == 400);
+    assert(logs[1].log.status == FAULT_ST_WARNING && logs[1].log.timestamp == 300);
+    assert(logs[1].log.index + 1 == logs[0].log.index);
+    assert(logs[2].log.timestamp == 200 && logs[3].log.timestamp == 100);
+
+    /* no room for a new source, malformed deltas */
+    len3 = fault_merge_delta(3, d3, sizeof(d3));
+    assert(!fault_merge_apply(d3, len3));
+    assert(fault_merge_sources() == 2);
+    assert(!fault_merge_apply(d2, len2 - 1));
+    assert(!fault_merge_apply(NULL, 0));
+    d2[0] ^= 0xff;
+    assert(!fault_merge_apply(d2, len2));
+
+    /* a restart of the producer replaces its values */
+    fault_init();
+    assert(fault_conf_module(MONE_ALL, 1) == mod);
+    len1 = fault_merge_delta(1, d1, sizeof(d1));
+    assert(fault_merge_apply(d1, len1));
+    assert(fault_merge_record(1, f1, &rec));
+    assert(rec.status == FAULT_ST_NORMAL && rec.errors == 0);
+    assert(fault_merge_logs(logs, 8) == 0);
+
+    /* over the socket */
+    fault_merge_close();
+    assert(fault_merge_connect(path) < 0);
+    assert(fault_merge_poll(0) == 0);
+    assert(fault_merge_listen(path));
+    assert(!fault_merge_listen(path));
+    int fd = fault_merge_connect(path);
+    assert(fd >= 0);
+
+    fault_update(f2, 9, true);
+    assert(fault_merge_send(fd, 1) == 1);
+    assert(fault_merge_poll(1000) == 1);
+    assert(fault_merge_record(1, f2, &rec));
+    assert(rec.errors == 1 && rec.refValue == 9);
+    assert(fault_merge_logs(logs, 8) == 1);
+    assert(fault_merge_poll(0) == 0);
+
+    close(fd);
+    fault_merge_close();
+    assert(access(path, F_OK) != 0);
+    assert(fault_merge_send(-1, 1) < 0);
+
+    puts("OK");
+}/* test_merge */
+
 int main()
 {
     test_conf_module();
@@ -480,5 +2519,26 @@ int main()
     test_policy_count_reset();
     test_policy_time_reset();
     test_logs();
+    test_logs_module();
+    test_logs_query();
+    test_logs_cold();
+    test_journal();
+    test_trace();
+    test_whatif();
+    test_lazy();
+    test_update_n();
+    test_stats();
+    test_inhibit();
+    test_top_k();
+    test_invalid_ids();
+    test_flap();
+    test_reconf();
+    test_history();
+    test_refstats();
+    test_incidents();
+    test_heartbeat();
+    test_loader();
+    test_merge();
+    test_exporter();
     return 0;
 }/* main */
@@ -0,0 +1,112 @@
+/* Tests of the C++ interface, see faults.hpp */
+#include "faults.hpp"
+#include <cassert>
+#include <cstdio>
+
+enum class Sensor {
+    Pressure,
+    Temperature,
+    ALL
+};
+
+/* C style enumeration */
+enum Motor {
+    MOTOR_SPEED,
+    MOTOR_CURRENT,
+    MOTOR_TORQUE,
+    MOTOR_ALL
+};
+
+template <>
+struct faults::CodeCount<Motor> {
+    static constexpr fault_counter value = MOTOR_ALL;
+};
+
+static fault_millisecs mockTime = 0;
+
+fault_millisecs fault_now(void)
+{
+    return mockTime;
+}/* fault_now */
+
+void test_hpp_module()
+{
+    printf("test_hpp_module: ");
+
+    fault_init();
+
+    auto sensors = faults::Module<Sensor>::configure(0);
+    auto motor = faults::Module<Motor>::configure(1);
+    assert(sensors);
+    assert(motor);
+    assert(sensors->raw() != motor->raw());
+    static_assert(faults::Module<Sensor>::codes == 2);
+    static_assert(faults::Module<Motor>::codes == 3);
+
+    faults::Id pres = sensors->id<Sensor::Pressure>();
+    faults::Id temp = sensors->id<Sensor::Temperature>();
+    assert(pres.raw() == fault_getid(sensors->raw(), 0));
+    assert(temp.raw() == fault_getid(sensors->raw(), 1));
+    assert(sensors->id(Sensor::Temperature) == temp);
+    assert(!sensors->id(Sensor::ALL));
+    assert(motor->id(MOTOR_TORQUE));
+
+    /* too many codes */
+    while (faults::Module<Motor>::configure(0)){
+    }
+    assert(!faults::Module<Motor>::configure(0));
+
+    puts("OK");
+}
+
+void test_hpp_update()
+{
+    printf("test_hpp_update: ");
+
+    fault_init();
+
+    auto sensors = faults::Module<Sensor>::configure(0);
+    faults::Id pres = sensors->id<Sensor::Pressure>();
+    faults::Id temp = sensors->id<Sensor::Temperature>();
+
+    assert(pres.policy(faults::CountAbs{1, 2}));
+    assert(!pres.policy(faults::CountAbs{2, 1}));
+    assert(temp.policy(faults::CountReset{1, 1, 2}));
+    assert(!temp.policy(faults::TimeReset{1, 2, 0}));
+    assert(!temp.policy(faults::Heartbeat{2, 1}));
+
+    assert(sensors->status() == faults::ModuleStatus::Normal);
+
+    assert(pres.update(10, true));
+    assert(pres.errors() == 1);
+    assert(pres.refval() == 10);
+    assert(pres.status() == faults::Status::Warning);
+    assert(fault_status(pres.raw()) == FAULT_ST_WARNING);
+    assert(sensors->status() == faults::ModuleStatus::Warning);
+
+    assert(temp.update(20, true));
+    assert(temp.status() == faults::Status::Error);
+    assert(sensors->status() == faults::ModuleStatus::Failed);
+
+    assert(!temp.update(21, false));
+    assert(!temp.update(22, false));
+    assert(temp.status() == faults::Status::Normal);
+
+    pres.reset();
+    assert(pres.errors() == 0);
+    assert(pres.policy(faults::None{}));
+
+    /* shared with the C interface */
+    fault_update(pres.raw(), 30, true);
+    assert(pres.refval() == 30);
+    assert(fault_logs_length() > 0);
+
+    puts("OK");
+}
+
+int main()
+{
+    test_hpp_module();
+    test_hpp_update();
+    return 0;
+}/* main */
@@ -0,0 +1,271 @@
+/* Faults Module - Worst case execution time of the update path
+ *
+ * Usage: wcet [WARM [COLD]]
+ * It measures the cycles of every call of a fixed sequence of updates
+ * (all the policies, resets, status changes, full log queues, wrong ids),
+ * with the caches warm and flushed before each call.
+ * The sequence is repeated WCET_RUNS times from fault_init(), the same
+ * state every time, and the minimum of each call is kept: what is left
+ * is the cost of the code and of the data, not of the interrupts.
+ * It exits with 1 when the maximum exceeds the budget WARM or COLD.
+ *
+ * Build with 'make wcet', it uses FAULT_REALTIME. The process is pinned
+ * to one core and, when allowed, locked in memory with SCHED_FIFO.
+ */
+#define _GNU_SOURCE
+
+#include "faults.h"
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define WCET_UNIT "cycles"
+#else
+#define WCET_UNIT "ns"
+#endif
+
+#define WCET_MODULES 4
+#define WCET_CODES   64
+#define WCET_RUNS    5
+#define WCET_WARM    4096
+#define WCET_COLD    128
+/* larger than the caches to flush */
+#define WCET_FLUSH   (8 * 1024 * 1024)
+
+static fault_millisecs mockTime = 0;
+
+fault_millisecs fault_now(void)
+{
+    return mockTime;
+}/* fault_now */
+
+static unsigned char flushBuffer[WCET_FLUSH];
+
+static
+uint64_t wcet_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+#endif
+}/* wcet_ticks */
+
+/* Evict the state of the faults module from the caches */
+static
+void wcet_flush(void)
+{
+    for (size_t i = 0; i < WCET_FLUSH; i += 64){
+        flushBuffer[i] = (unsigned char)(flushBuffer[i] + 1);
+    }
+}/* wcet_flush */
+
+/* Pin to the current core, lock the memory, real time priority */
+static
+void wcet_isolate(void)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(sched_getcpu(), &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0){
+        perror("sched_setaffinity");
+    }
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0){
+        fprintf(stderr, "wcet: memory not locked\n");
+    }
+
+    struct sched_param sp = {.sched_priority = sched_get_priority_max(SCHED_FIFO)};
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) != 0){
+        fprintf(stderr, "wcet: SCHED_FIFO not allowed\n");
+    }
+}/* wcet_isolate */
+
+/* Modules with all the policies, small log queues always full */
+static
+void wcet_setup(void)
+{
+    fault_init();
+    mockTime = 0;
+
+    for (int m = 0; m < WCET_MODULES; m++){
+        fault_module mod = fault_conf_module(WCET_CODES, 2);
+        fault_conf_module_logs(mod, 4);
+
+        for (fault_code c = 0; c < WCET_CODES; c++){
+            fault_id id = fault_getid(mod, c);
+            switch (c % 4){
+            case 0:
+                fault_policy_none(id);
+                break;
+            case 1:
+                fault_policy_count_abs(id, 2, 4);
+                break;
+            case 2:
+                fault_policy_count_reset(id, 1, 2, 3);
+                break;
+            default:
+                fault_policy_time_reset(id, 10, 30, 20);
+                break;
+            }
+            if (c % 8 == 5){
+                FaultDamping d = {1000, 2000, 500, 100};
+                fault_conf_damping(id, &d);
+                fault_conf_hysteresis(id, 2);
+            }
+        }
+    }/* for modules */
+
+    /* the first code of every module inhibits the others */
+    for (int m = 1; m <= WCET_MODULES; m++){
+        for (fault_code c = 1; c < WCET_CODES; c++){
+            fault_inhibit(fault_getid((fault_module)m, 0),
+                          fault_getid((fault_module)m, c));
+        }
+    }
+}/* wcet_setup */
+
+typedef void (*wcet_call)(size_t i);
+
+/* Calls of the sequence, 'i' is the position */
+
+static
+void wcet_update(size_t i)
+{
+    fault_id id = (fault_id)(1 + (i * 7) % (WCET_MODULES * WCET_CODES));
+    mockTime = i * 3;
+    fault_update(id, (long)i, (i / 5) % 3 != 0);
+}/* wcet_update */
+
+static
+void wcet_update_wrong(size_t i)
+{
+    fault_update((fault_id)(FAULT_ID_MAX + i % 97), (long)i, true);
+}/* wcet_update_wrong */
+
+static
+void wcet_update_n(size_t i)
+{
+    fault_id id = (fault_id)(1 + (i * 13) % (WCET_MODULES * WCET_CODES));
+    mockTime = i * 3;
+    if (i % 2){
+        fault_update_fault_n(id, (long)i, 1000);
+    } else {
+        fault_update_clear_n(id, 1000);
+    }
+}/* wcet_update_n */
+
+static
+void wcet_status(size_t i)
+{
+    fault_id id = (fault_id)(1 + (i * 7) % (WCET_MODULES * WCET_CODES));
+    volatile fault_status_type s = fault_status(id);
+    (void)s;
+}/* wcet_status */
+
+/* Worst of the minimums of every call.
+ * return the maximum, in ticks
+ */
+static
+uint64_t wcet_measure(const char *name,
+                      wcet_call call,
+                      size_t samples,
+                      bool cold,
+                      uint64_t overhead)
+{
+    static uint64_t best[WCET_WARM];
+    uint64_t worst = 0;
+    size_t at = 0;
+
+    for (int r = 0; r < WCET_RUNS; r++){
+        wcet_setup();
+        /* a sequence of updates before, to fill the queues and sketches */
+        for (size_t i = 0; i < WCET_WARM; i++){
+            wcet_update(i);
+        }
+
+        for (size_t i = 0; i < samples; i++){
+            if (cold){
+                wcet_flush();
+            }
+            uint64_t t0 = wcet_ticks();
+            call(i);
+            uint64_t t = wcet_ticks() - t0;
+            t = (t > overhead) ? t - overhead : 0;
+
+            if (r == 0 || t < best[i]){
+                best[i] = t;
+            }
+        }
+    }/* for runs */
+
+    for (size_t i = 0; i < samples; i++){
+        if (best[i] > worst){
+            worst = best[i];
+            at = i;
+        }
+    }
+
+    printf("%-24s %-4s max %8llu %s (call %zu)\n", name, cold ? "cold" : "warm",
+           (unsigned long long)worst, WCET_UNIT, at);
+
+    return worst;
+}/* wcet_measure */
+
+int main(int argc, char *argv[])
+{
+    uint64_t budget[2] = {0, 0}; /* warm, cold; 0 for none */
+    const struct {
+        const char *name;
+        wcet_call call;
+    } calls[] = {
+        {"fault_update()", wcet_update},
+        {"fault_update() wrong id", wcet_update_wrong},
+        {"fault_update_*_n()", wcet_update_n},
+        {"fault_status()", wcet_status}
+    };
+    int failed = 0;
+
+    for (int a = 1; a < argc && a <= 2; a++){
+        budget[a - 1] = strtoull(argv[a], NULL, 10);
+    }
+
+    printf("FAULT_REALTIME=%d FAULT_ID_MAX=%d FAULT_LOG_MAX=%d\n",
+           FAULT_REALTIME, FAULT_ID_MAX, FAULT_LOG_MAX);
+    wcet_isolate();
+
+    /* cost of the measurement */
+    uint64_t overhead = UINT64_MAX;
+    for (int i = 0; i < 1000; i++){
+        uint64_t t0 = wcet_ticks();
+        uint64_t t = wcet_ticks() - t0;
+        overhead = (t < overhead) ? t : overhead;
+    }
+
+    for (size_t c = 0; c < sizeof(calls) / sizeof(calls[0]); c++){
+        for (int cold = 0; cold <= 1; cold++){
+            uint64_t worst = wcet_measure(calls[c].name, calls[c].call,
+                                          cold ? WCET_COLD : WCET_WARM,
+                                          cold, overhead);
+            if (budget[cold] > 0 && worst > budget[cold]){
+                printf("  over the budget of %llu %s\n",
+                       (unsigned long long)budget[cold], WCET_UNIT);
+                failed = 1;
+            }
+        }
+    }/* for calls */
+
+    return failed;
+}/* main */